@@ -1,8 +1,38 @@
 {
+    "variables": {
+        "audio_trace%": 1,
+        "capture_tools%": 0
+    },
     "targets": [
         {
             "target_name": "AudioInputNative",
-            "sources": ["src/wrappers.cpp"],
+            "sources": [
+                "src/wrappers.cpp",
+                "src/AudioBuffer.cpp",
+                "src/MessageQueue.cpp",
+                "src/PcmFormat.cpp",
+                "src/AudioTap.cpp",
+                "src/FileSink.cpp",
+                "src/RtpSink.cpp",
+                "src/FdSink.cpp",
+                "src/ReplayInput.cpp",
+                "src/FileReplay.cpp",
+                "src/CallbackTrace.cpp",
+                "src/ProcessingGraph.cpp",
+                "src/WorkerPool.cpp",
+                "src/CaptureSpool.cpp",
+                "src/ThreadConfig.cpp",
+                "src/Trace.cpp",
+                "src/Dispatcher.cpp",
+                "src/NativeMemory.cpp",
+                "src/PcmKernels.cpp",
+                "src/SampleClock.cpp",
+                "src/kernels/PcmKernelsScalar.cpp",
+                "src/kernels/PcmKernelsSse2.cpp",
+                "src/kernels/PcmKernelsAvx2.cpp",
+                "src/kernels/PcmKernelsAvx512.cpp",
+                "src/kernels/PcmKernelsNeon.cpp"
+            ],
             "cflags": ["-std=c++11"],
             "include_dirs": [
                 "src",
@@ -12,6 +42,9 @@
                 "OTHER_FLAGS": ["-std=c++11"]
             },
             "conditions": [
+                ['audio_trace==1', {
+                    "defines": ["AUDIO_TRACE"]
+                }],
                 ['OS=="linux"', {
                     "sources": ["src/PortAudioInput.cpp"]
                 }],
@@ -26,9 +59,97 @@
                     }
                 }],
                 ['OS=="win"', {
-                    "sources": ["src/PortAudioInput.cpp"]
+                    "sources": ["src/PortAudioInput.cpp"],
+                    "libraries": ["ws2_32.lib"]
                 }]
             ]
         }
+    ],
+    "conditions": [
+        ['capture_tools==1 and OS!="win"', {
+            "targets": [
+                {
+                    "target_name": "capture",
+                    "type": "executable",
+                    "sources": [
+                        "src/tools/capture.cpp",
+                        "src/PortAudioInput.cpp",
+                        "src/ReplayInput.cpp",
+                        "src/FileReplay.cpp",
+                        "src/CallbackTrace.cpp",
+                        "src/AudioBuffer.cpp",
+                        "src/FdSink.cpp",
+                        "src/PcmFormat.cpp",
+                        "src/PcmKernels.cpp",
+                        "src/SampleClock.cpp",
+                        "src/ThreadConfig.cpp",
+                        "src/Trace.cpp",
+                        "src/NativeMemory.cpp",
+                        "src/kernels/PcmKernelsScalar.cpp",
+                        "src/kernels/PcmKernelsSse2.cpp",
+                        "src/kernels/PcmKernelsAvx2.cpp",
+                        "src/kernels/PcmKernelsAvx512.cpp",
+                        "src/kernels/PcmKernelsNeon.cpp"
+                    ],
+                    "cflags": ["-std=c++11"],
+                    "include_dirs": ["src"],
+                    "libraries": ["-ldl", "-lpthread"],
+                    "xcode_settings": {
+                        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11", "-stdlib=libc++"]
+                    },
+                    "conditions": [
+                        ['audio_trace==1', {
+                            "defines": ["AUDIO_TRACE"]
+                        }]
+                    ]
+                },
+                {
+                    "target_name": "bench",
+                    "type": "executable",
+                    "sources": [
+                        "src/tools/bench.cpp",
+                        "src/PortAudioInput.cpp",
+                        "src/ReplayInput.cpp",
+                        "src/FileReplay.cpp",
+                        "src/CallbackTrace.cpp",
+                        "src/AudioBuffer.cpp",
+                        "src/MessageQueue.cpp",
+                        "src/PcmFormat.cpp",
+                        "src/PcmKernels.cpp",
+                        "src/SampleClock.cpp",
+                        "src/ThreadConfig.cpp",
+                        "src/Trace.cpp",
+                        "src/NativeMemory.cpp",
+                        "src/kernels/PcmKernelsScalar.cpp",
+                        "src/kernels/PcmKernelsSse2.cpp",
+                        "src/kernels/PcmKernelsAvx2.cpp",
+                        "src/kernels/PcmKernelsAvx512.cpp",
+                        "src/kernels/PcmKernelsNeon.cpp"
+                    ],
+                    "cflags": ["-std=c++11", "-O2"],
+                    "include_dirs": ["src"],
+                    "libraries": ["-ldl", "-lpthread"],
+                    "xcode_settings": {
+                        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11", "-stdlib=libc++"]
+                    },
+                    "conditions": [
+                        ['audio_trace==1', {
+                            "defines": ["AUDIO_TRACE"]
+                        }]
+                    ]
+                },
+                {
+                    "target_name": "portaudio_stub",
+                    "type": "shared_library",
+                    "sources": ["src/tools/PortAudioStub.cpp"],
+                    "cflags": ["-std=c++11"],
+                    "include_dirs": ["src"],
+                    "libraries": ["-lpthread"],
+                    "xcode_settings": {
+                        "OTHER_CPLUSPLUSFLAGS": ["-std=c++11", "-stdlib=libc++"]
+                    }
+                }
+            ]
+        }]
     ]
 }
@@ -7,6 +7,180 @@ declare interface AudioInputOptions {
     channels?: 1 | 2;
     deviceName?: string;
     timePerFrame?: number;
+    framesPerChunk?: number;
+    threadPolicy?: 'normal' | 'fifo' | 'rr';
+    threadPriority?: number;
+    threadCpus?: number[];
+    lockMemory?: boolean;
+    jobPriority?: 'high' | 'low';
+    minEmitLatency?: number;
+    maxEmitLatency?: number;
+    file?: string;
+    callbackTrace?: string;
+    speed?: number;
+    loop?: boolean;
+    hostApi?: string | string[];
+    latency?: 'low' | 'high' | number;
+    clipOff?: boolean;
+    ditherOff?: boolean;
+    stallTimeout?: number;
+    fallbackDevices?: string[];
+}
+
+declare interface AudioTapOptions {
+    samplerate?: number;
+    bps?: 8 | 16 | 24 | 32;
+    channels?: 1 | 2;
+    channelMap?: number[];
+    maxQueue?: number;
+    queuePolicy?: 'dropOldest' | 'dropNewest';
+    gain?: number;
+    clockCorrection?: boolean;
+}
+
+declare interface RecordingOptions {
+    path: string;
+    format?: 'wav' | 'raw' | 'flac';
+    rotateBytes?: number;
+    rotateSeconds?: number;
+    batchBytes?: number;
+}
+
+declare interface FdPipeOptions {
+    batchBytes?: number;
+    zeroCopy?: boolean;
+}
+
+declare interface WorkerPoolStats {
+    workers: number;
+    jobs: number;
+    steals: number;
+    utilization: number;
+    high: { avg: number; max: number; };
+    low: { avg: number; max: number; };
+}
+
+declare interface GraphNode {
+    id: string;
+    input?: string;
+    type: 'gain' | 'convert' | 'resample' | 'map' | 'file' | 'fd' | 'rtp' | 'js';
+    gain?: number;
+    bitsPerSample?: number;
+    sampleRate?: number;
+    clockCorrection?: boolean;
+    channelMap?: number[];
+    maxQueue?: number;
+    fd?: number;
+    [option: string]: any;
+}
+
+declare interface GraphNodeStats {
+    id: string;
+    chunks: number;
+    avgTime: number;
+    maxTime: number;
+    queued: number;
+    dropped: number;
+}
+
+declare interface GraphStats {
+    queued: number;
+    droppedInput: number;
+    nodes: GraphNodeStats[];
+}
+
+declare interface RtpOptions {
+    host: string;
+    port: number;
+    encoding?: 'L16' | 'L24' | 'opus';
+    payloadType?: number;
+    packetTime?: number;
+    ttl?: number;
+    rtcpInterval?: number;
+    bitrate?: number;
+}
+
+declare interface SpoolOptions {
+    path: string;
+    seconds?: number;
+}
+
+declare interface SpoolInfo {
+    sampleRate: number;
+    firstSample: number;
+    lastSample: number;
+    firstTime: number;
+    lastTime: number;
+}
+
+declare interface ChunkTime {
+    pts: number;
+    sample: number;
+    discontinuity?: boolean;
+}
+
+declare interface StreamInfo {
+    device: string;
+    hostApi: string;
+    inputLatency: number;
+    sampleRate: number;
+}
+
+declare interface AudioInputStats {
+    callbacks: number;
+    frames: number;
+    inputOverflows: number;
+    inputUnderflows: number;
+    maxCallbackTime: number;
+    droppedFrames: number;
+    stalls: number;
+    recoveries: number;
+    taps: { id: number; chunks: number; bytes: number; dropped: number; queued: number; peak: number; }[];
+    tapInputDropped?: number;
+    fileSinks: {
+        id: number;
+        file: string;
+        files: number;
+        bytesWritten: number;
+        writes: number;
+        droppedChunks: number;
+        discontinuities: number;
+        lostBytes: number;
+        failed: boolean;
+        avgWriteLatency: number;
+        maxWriteLatency: number;
+        lastError?: string;
+    }[];
+    rtpSinks: {
+        id: number;
+        packets: number;
+        bytes: number;
+        reports: number;
+        sendCalls: number;
+        droppedChunks: number;
+        droppedPackets: number;
+        sendErrors: number;
+        queued: number;
+        packetTime: number;
+        lastError?: string;
+    }[];
+    fdSinks: {
+        id: number;
+        bytesWritten: number;
+        splicedBytes: number;
+        writes: number;
+        droppedChunks: number;
+        discontinuities: number;
+        inFlight: number;
+        zeroCopy: boolean;
+        closed: boolean;
+        lastError?: string;
+    }[];
+    threads: { configured: number; lockedBytes: number; errors: string[]; };
+    dispatcher: { wakeups: number; drains: number; instances: number; };
+    emit: { adaptive: boolean; targetLatency: number; loopLag: number; };
+    memory: { nativeBytes: number; reportedBytes: number; };
+    clock: { samples: number; rate: number; driftPpm: number; jitter: number; locked: boolean; };
 }
 
 declare interface ChromecastDeviceInfo {
@@ -48,17 +222,74 @@ declare module "chromecaster-lib" {
         public static getDevices(): string[];
         public static loadNativeLibrary(path: string): true;
         public static isNativeLibraryLoaded(): boolean;
+        public static startTrace(): boolean;
+        public static stopTrace(): void;
+        public static dumpTrace(): string;
+        public static isTraceAvailable(): boolean;
+        public static getKernelInfo(): { level: string; available: string[]; };
+        public static setKernelLevel(level: 'avx512' | 'avx2' | 'sse2' | 'neon' | 'scalar'): boolean;
+        public static getWorkerPoolStats(): WorkerPoolStats;
+        public static refreshDevices(): boolean;
+        public static on(eventName: 'devicesChanged', listener: (diff: { added: string[], removed: string[] }) => void): void;
 
         constructor(opts: AudioInputOptions);
         public open(): void;
         public close(): void;
-        public pause(): void;
+        public pause(soft?: boolean): void;
         public isOpen(): void;
         public isPaused(): void;
+        public getStats(): AudioInputStats;
+        public getStreamInfo(): StreamInfo | null;
+        public addTap(opts?: AudioTapOptions): AudioTap;
+        public record(opts: RecordingOptions | string): Recording;
+        public sendRtp(opts: RtpOptions): RtpStream;
+        public pipeToFd(fd: number, opts?: FdPipeOptions): FdPipe;
+        public createGraph(nodes: GraphNode[]): Graph;
+        public enableSpool(opts: SpoolOptions): void;
+        public disableSpool(): void;
+        public startCallbackTrace(path: string): void;
+        public stopCallbackTrace(): { callbacks: number, dropped: number } | null;
+        public getSpoolInfo(): SpoolInfo | null;
+        public readSpool(sample: number, frames: number): Buffer | null;
+        public getSpoolSampleAt(time: number): number;
+        public replay(seconds: number, duration?: number): Buffer | null;
+
+        public on(eventName: 'data', listener: (pcm: Buffer, time: ChunkTime) => void);
+        public on(eventName: 'end', listener: () => void);
+        public on(eventName: 'stall', listener: (gap: number) => void);
+        public on(eventName: 'recovered', listener: (gap: number, info: { sample: number, device?: string }) => void);
+    }
+
+    export class AudioTap extends Event.EventEmitter {
+        public readonly id: number;
+        public close(): void;
 
         public on(eventName: 'data', listener: (pcm: Buffer) => void);
     }
 
+    export class Recording {
+        public readonly id: number | null;
+        public stop(): void;
+    }
+
+    export class FdPipe {
+        public readonly id: number | null;
+        public stop(): void;
+    }
+
+    export class Graph extends Event.EventEmitter {
+        public readonly id: number | null;
+        public stop(): void;
+        public getStats(): GraphStats | null;
+        public on(eventName: 'data', listener: (node: string, pcm: Buffer, time: ChunkTime) => void);
+    }
+
+    export class RtpStream {
+        public readonly id: number | null;
+        public readonly sdp: string;
+        public stop(): void;
+    }
+
     export class ChromecastDiscover extends Event.EventEmitter {
         constructor();
         public start(): void;
@@ -75,11 +306,14 @@ declare module "chromecaster-lib" {
         public readonly localIp: string;
         public readonly contentType: string;
         public readonly port: number;
-        constructor(opts: Stream.WritableOptions & { port?: number; contentType?: string; });
+        public readonly hls: boolean;
+        public readonly playlistPath: string | null;
+        constructor(opts: Stream.WritableOptions & { port?: number; contentType?: string; burstSeconds?: number; hls?: boolean; segmentDuration?: number; playlistSize?: number; });
         public stop(): void;
 
         public on(event: 'connect', listener: (data: WebcastEvent) => void);
         public on(event: 'disconnect', listener: (data: WebcastEvent) => void);
+        public on(event: 'segment', listener: (sequence: number) => void);
     }
 
 }
\ No newline at end of file
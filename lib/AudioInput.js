@@ -8,5 +8,186 @@ AudioInputNative.AudioInput.error = AudioInputNative.AudioInputError;
 AudioInputNative.AudioInput.getDevices = AudioInputNative.GetDevices;
 AudioInputNative.AudioInput.loadNativeLibrary = AudioInputNative.loadPortaudioLibrary;
 AudioInputNative.AudioInput.isNativeLibraryLoaded = AudioInputNative.isNativeLibraryLoaded;
+AudioInputNative.AudioInput.startTrace = AudioInputNative.startTrace;
+AudioInputNative.AudioInput.stopTrace = AudioInputNative.stopTrace;
+AudioInputNative.AudioInput.dumpTrace = AudioInputNative.dumpTrace;
+AudioInputNative.AudioInput.isTraceAvailable = AudioInputNative.isTraceAvailable;
+AudioInputNative.AudioInput.getKernelInfo = AudioInputNative.getKernelInfo;
+AudioInputNative.AudioInput.setKernelLevel = AudioInputNative.setKernelLevel;
+AudioInputNative.AudioInput.getWorkerPoolStats = AudioInputNative.getWorkerPoolStats;
+AudioInputNative.AudioInput.refreshDevices = AudioInputNative.refreshDevices;
+
+//Events of the class: 'devicesChanged'
+const classEvents = new events.EventEmitter();
+AudioInputNative.AudioInput.on = classEvents.on.bind(classEvents);
+AudioInputNative.AudioInput.once = classEvents.once.bind(classEvents);
+AudioInputNative.AudioInput.removeListener = classEvents.removeListener.bind(classEvents);
+AudioInputNative.setDevicesChangedCallback((added, removed) => {
+    classEvents.emit('devicesChanged', { added, removed });
+});
+
+class AudioTap extends events.EventEmitter {
+    constructor(input, id) {
+        super();
+        this._input = input;
+        this._id = id;
+    }
+
+    close() {
+        if(this._input._taps[this._id]) {
+            delete this._input._taps[this._id];
+            this._input._removeTap(this._id);
+        }
+    }
+
+    get id() {
+        return this._id;
+    }
+}
+
+class Recording {
+    constructor(input, id) {
+        this._input = input;
+        this._id = id;
+    }
+
+    stop() {
+        if(this._id !== null) {
+            this._input._removeFileSink(this._id);
+            this._id = null;
+        }
+    }
+
+    get id() {
+        return this._id;
+    }
+}
+
+class RtpStream {
+    constructor(input, sink) {
+        this._input = input;
+        this._id = sink.id;
+        this._sdp = sink.sdp;
+    }
+
+    stop() {
+        if(this._id !== null) {
+            this._input._removeRtpSink(this._id);
+            this._id = null;
+        }
+    }
+
+    get id() {
+        return this._id;
+    }
+
+    get sdp() {
+        return this._sdp;
+    }
+}
+
+class FdPipe {
+    constructor(input, id) {
+        this._input = input;
+        this._id = id;
+    }
+
+    stop() {
+        if(this._id !== null) {
+            this._input._removeFdSink(this._id);
+            this._id = null;
+        }
+    }
+
+    get id() {
+        return this._id;
+    }
+}
+
+class Graph extends events.EventEmitter {
+    constructor(input, id) {
+        super();
+        this._input = input;
+        this._id = id;
+    }
+
+    stop() {
+        if(this._id !== null) {
+            delete this._input._graphs[this._id];
+            this._input._removeGraph(this._id);
+            this._id = null;
+        }
+    }
+
+    getStats() {
+        return this._id !== null ? this._input._getGraphStats(this._id) : null;
+    }
+
+    get id() {
+        return this._id;
+    }
+}
+
+AudioInputNative.AudioInput.prototype.record = function(opts) {
+    if(typeof opts === 'string') {
+        opts = { path: opts };
+    }
+    return new Recording(this, this._addFileSink(opts));
+};
+
+AudioInputNative.AudioInput.prototype.pipeToFd = function(fd, opts) {
+    return new FdPipe(this, this._addFdSink(fd, opts || {}));
+};
+
+AudioInputNative.AudioInput.prototype.sendRtp = function(opts) {
+    return new RtpStream(this, this._addRtpSink(opts));
+};
+
+AudioInputNative.AudioInput.prototype.replay = function(seconds, duration) {
+    const info = this.getSpoolInfo();
+    if(!info) {
+        return null;
+    }
+
+    const start = Math.max(info.firstSample, info.lastSample - Math.round(seconds * info.sampleRate));
+    const frames = duration === undefined ?
+        info.lastSample - start :
+        Math.min(info.lastSample - start, Math.round(duration * info.sampleRate));
+    return this.readSpool(start, frames);
+};
+
+AudioInputNative.AudioInput.prototype.addTap = function(opts) {
+    if(!this._taps) {
+        this._taps = {};
+        this.on('tap', (id, pcm) => {
+            const tap = this._taps[id];
+            if(tap) {
+                tap.emit('data', pcm);
+            }
+        });
+    }
+
+    const id = this._addTap(opts || {});
+    const tap = new AudioTap(this, id);
+    this._taps[id] = tap;
+    return tap;
+};
+
+AudioInputNative.AudioInput.prototype.createGraph = function(nodes) {
+    if(!this._graphs) {
+        this._graphs = {};
+        this.on('graph', (id, node, pcm, time) => {
+            const graph = this._graphs[id];
+            if(graph) {
+                graph.emit('data', node, pcm, time);
+            }
+        });
+    }
+
+    const id = this._addGraph(nodes);
+    const graph = new Graph(this, id);
+    this._graphs[id] = graph;
+    return graph;
+};
 
 module.exports = AudioInputNative.AudioInput;
@@ -28,20 +28,28 @@ class ChromecastDevice extends events.EventEmitter {
         cbk = 'function' === typeof streamName ? streamName : cbk;
         streamName = 'string' === typeof streamName ? streamName : 'Chromecaster lib stream';
         
+        //With HLS the receiver follows the playlist of short segments as a live stream,
+        //the endless body of the plain webcast is still loaded as before
+        const webcast = this._webcast;
+        const media = {
+            contentId: `http://${webcast.localIp}:${webcast.port}${webcast.hls ? webcast.playlistPath : '/'}`,
+            contentType: webcast.hls ? 'application/x-mpegurl' : webcast.contentType,
+            streamType: webcast.hls ? 'LIVE' : 'BUFFERED',
+            metadata: {
+                metadataType: 0,
+                title: streamName
+            }
+        };
+        if(webcast.hls) {
+            media.hlsSegmentFormat = webcast.contentType === 'audio/aac' || webcast.contentType === 'audio/aacp' ? 'aac' : 'mp3';
+        }
+
         const body = (cbk) => {
             this._client.connect(this._device.addresses[0], () => {
                 this._client.launch(DefaultMediaReceiver, (err, player) => {
                     if(err) cbk(err);
                     else {
-                        player.load({
-                            contentId: `http://${this._webcast.localIp}:${this._webcast.port}/`,
-                            contentType: this._webcast.contentType,
-                            streamType: 'BUFFERED',
-                            metadata: {
-                                metadataType: 0,
-                                title: streamName
-                            }
-                        }, { autoplay: true }, (err, status) => {
+                        player.load(media, { autoplay: true }, (err, status) => {
                             this._player = player;
                             if(err) cbk(err);
                             else cbk(null, status);
@@ -3,6 +3,23 @@ const http = require('http');
 const interfaces = require('os').networkInterfaces();
 const stream = require('stream');
 
+//Bitrates (kbps) of MPEG audio by [MPEG-1, MPEG-2/2.5][layer I, II, III]
+const mpegBitrates = [
+    [
+        [0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448],
+        [0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384],
+        [0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320]
+    ],
+    [
+        [0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256],
+        [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160],
+        [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160]
+    ]
+];
+const mpegSampleRates = [44100, 48000, 32000];
+const adtsSampleRates = [96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350];
+const timestampOwner = 'com.apple.streaming.transportStreamTimestamp';
+
 class Webcast extends stream.Writable {
     constructor(opt) {
         super(opt);
@@ -10,9 +27,28 @@ class Webcast extends stream.Writable {
         this._port = opt.port || 3000;
         this._contentType = opt.contentType || 'audio/mp3';
         this._connectedClients = [];
+        this._burstSeconds = opt.burstSeconds || 0;
+        this._history = [];
+        this._sequence = 0;
+
+        this._hls = !!opt.hls;
+        if(this._hls && ['audio/mp3', 'audio/mpeg', 'audio/aac', 'audio/aacp'].indexOf(this._contentType) === -1) {
+            throw new Error(`HLS needs MP3 or AAC (ADTS), not ${this._contentType}`);
+        }
+        this._segmentDuration = opt.segmentDuration || 2;
+        this._playlistSize = opt.playlistSize || 6;
+        this._segments = [];
+        this._nextSegment = 0;
+        this._pendingBytes = null;
+        this._frames = [];
+        this._framesDuration = 0;
+        this._samples = 0;
+        this._segmentStart = 0;
 
         this._server = http.createServer((req, res) => {
-            if(req.method === 'GET') {
+            if(this._hls && req.method === 'GET' && req.url !== '/') {
+                this._serveHls(req, res);
+            } else if(req.method === 'GET') {
                 res.setHeader('Content-Type', this._contentType);
                 res.setHeader('Cache-Control', 'no-cache');
                 res.setHeader('Pragma', 'no-cache');
@@ -34,6 +70,8 @@ class Webcast extends stream.Writable {
                     }
                 };
 
+                //Pre-roll from the history so the receiver can start playing right away
+                this._writeBurst(res);
                 this._connectedClients.push(res);
                 res.on('close', close);
                 res.on('finish', close);
@@ -73,6 +111,16 @@ class Webcast extends stream.Writable {
 
     _write(buffer, enc, cbk) {
         if(buffer !== undefined && buffer !== null) {
+            if(this._burstSeconds > 0 || this._hls) {
+                buffer = typeof buffer === 'string' ? Buffer.from(buffer, enc) : buffer;
+            }
+            if(this._burstSeconds > 0) {
+                this._addToHistory(buffer);
+            }
+            if(this._hls) {
+                this._addToSegments(buffer);
+            }
+
             var cbkCalled = this._connectedClients.length + 1;
             let _cbk = () => {
                 if(--cbkCalled === 0) {
@@ -103,11 +151,204 @@ class Webcast extends stream.Writable {
         _cbk();
     }
 
+    _addToHistory(buffer) {
+        const now = Date.now();
+        this._history.push({ sequence: this._sequence++, time: now, buffer: buffer });
+        while(this._history.length > 1 && now - this._history[1].time > this._burstSeconds * 1000) {
+            this._history.shift();
+        }
+    }
+
+    _writeBurst(res) {
+        if(this._history.length === 0) {
+            return;
+        }
+
+        //The burst must start in a frame boundary or the decoder could fail
+        let first = 0;
+        let offset = -1;
+        for(; first < this._history.length && offset === -1; first++) {
+            offset = this._findFrameStart(this._history[first].buffer);
+        }
+        first--;
+
+        if(offset !== -1) {
+            res.write(this._history[first].buffer.slice(offset));
+            for(let i = first + 1; i < this._history.length; i++) {
+                res.write(this._history[i].buffer);
+            }
+        }
+    }
+
+    _findFrameStart(buffer, start) {
+        const type = this._contentType;
+        if(type === 'audio/mp3' || type === 'audio/mpeg') {
+            //MPEG audio frame sync: 11 bits set, valid version, layer, bitrate and sample rate
+            for(let i = start || 0; i + 3 < buffer.length; i++) {
+                if(buffer[i] === 0xFF && (buffer[i + 1] & 0xE0) === 0xE0 &&
+                    (buffer[i + 1] & 0x18) !== 0x08 && (buffer[i + 1] & 0x06) !== 0 &&
+                    (buffer[i + 2] & 0xF0) !== 0xF0 && (buffer[i + 2] & 0x0C) !== 0x0C) {
+                    return i;
+                }
+            }
+            return -1;
+        } else if(type === 'audio/aac' || type === 'audio/aacp') {
+            //ADTS sync word
+            for(let i = start || 0; i + 1 < buffer.length; i++) {
+                if(buffer[i] === 0xFF && (buffer[i + 1] & 0xF6) === 0xF0) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        return 0;
+    }
+
+    //Length and samples of the frame at `pos`, null if its header is not valid
+    _parseFrame(buffer, pos) {
+        const b1 = buffer[pos + 1], b2 = buffer[pos + 2];
+        if(this._contentType === 'audio/aac' || this._contentType === 'audio/aacp') {
+            if(pos + 7 > buffer.length) {
+                return { length: 7 }; //Incomplete header, it waits for more bytes
+            }
+            const sampleRate = adtsSampleRates[(b2 >> 2) & 0x0F];
+            const length = ((buffer[pos + 3] & 0x03) << 11) | (buffer[pos + 4] << 3) | (buffer[pos + 5] >> 5);
+            if(!sampleRate || length < 7) {
+                return null;
+            }
+            return { length, sampleRate, samples: 1024 * ((buffer[pos + 6] & 0x03) + 1) };
+        }
+
+        const version = (b1 >> 3) & 0x03; //0 MPEG-2.5, 2 MPEG-2, 3 MPEG-1
+        const layer = 3 - ((b1 >> 1) & 0x03); //0 layer I, 1 layer II, 2 layer III
+        const bitrate = mpegBitrates[version === 3 ? 0 : 1][layer][b2 >> 4] * 1000;
+        const sampleRate = mpegSampleRates[(b2 >> 2) & 0x03] / (version === 3 ? 1 : version === 2 ? 2 : 4);
+        const padding = (b2 >> 1) & 0x01;
+        if(!bitrate) {
+            return null;
+        }
+
+        if(layer === 0) {
+            return { length: (Math.floor(12 * bitrate / sampleRate) + padding) * 4, sampleRate, samples: 384 };
+        }
+        const samples = layer === 2 && version !== 3 ? 576 : 1152;
+        return { length: Math.floor(samples / 8 * bitrate / sampleRate) + padding, sampleRate, samples };
+    }
+
+    //Cuts the encoded stream into whole frames and groups them into segments
+    _addToSegments(buffer) {
+        const data = this._pendingBytes ? Buffer.concat([this._pendingBytes, buffer]) : buffer;
+        let pos = this._findFrameStart(data, 0);
+        while(pos !== -1) {
+            const frame = this._parseFrame(data, pos);
+            if(frame === null) {
+                pos = this._findFrameStart(data, pos + 1);
+                continue;
+            }
+            if(pos + frame.length > data.length) {
+                break;
+            }
+
+            if(this._frames.length === 0) {
+                this._segmentStart = this._samples * 90000 / frame.sampleRate;
+            }
+            this._frames.push(data.slice(pos, pos + frame.length));
+            this._framesDuration += frame.samples / frame.sampleRate;
+            this._samples += frame.samples;
+            if(this._framesDuration >= this._segmentDuration) {
+                this._closeSegment();
+            }
+            pos = this._findFrameStart(data, pos + frame.length);
+        }
+
+        //The rest of the last frame waits for the next write, garbage without a sync word is dropped
+        this._pendingBytes = pos === -1 ? null : Buffer.from(data.slice(pos));
+    }
+
+    _closeSegment() {
+        //Packed audio segments start with the timestamp of their first sample in an ID3 tag
+        const id3 = Buffer.alloc(10 + 10 + timestampOwner.length + 1 + 8);
+        id3.write('ID3', 0);
+        id3[3] = 4;
+        id3[9] = id3.length - 10;
+        id3.write('PRIV', 10);
+        id3[17] = timestampOwner.length + 1 + 8;
+        id3.write(timestampOwner, 20);
+        const timestamp = Math.floor(this._segmentStart) % 8589934592;
+        id3.writeUInt32BE(Math.floor(timestamp / 4294967296), id3.length - 8);
+        id3.writeUInt32BE(timestamp % 4294967296, id3.length - 4);
+
+        //One buffer for the whole segment, it is sent as is to every client
+        this._segments.push({
+            sequence: this._nextSegment++,
+            duration: this._framesDuration,
+            time: Date.now() - this._framesDuration * 1000,
+            buffer: Buffer.concat([id3].concat(this._frames))
+        });
+        this._frames = [];
+        this._framesDuration = 0;
+
+        //A few segments more than in the playlist for the clients that are downloading them
+        while(this._segments.length > this._playlistSize + 3) {
+            this._segments.shift();
+        }
+        this.emit('segment', this._segments[this._segments.length - 1].sequence);
+    }
+
+    _playlist() {
+        const segments = this._segments.slice(-this._playlistSize);
+        const ext = this._segmentExtension;
+        let target = this._segmentDuration;
+        for(let segment of segments) {
+            target = Math.max(target, segment.duration);
+        }
+
+        let playlist = '#EXTM3U\n#EXT-X-VERSION:3\n' +
+            `#EXT-X-TARGETDURATION:${Math.ceil(target)}\n` +
+            `#EXT-X-MEDIA-SEQUENCE:${segments.length > 0 ? segments[0].sequence : 0}\n`;
+        for(let segment of segments) {
+            playlist += `#EXT-X-PROGRAM-DATE-TIME:${new Date(segment.time).toISOString()}\n`;
+            playlist += `#EXTINF:${segment.duration.toFixed(3)},\nsegment-${segment.sequence}.${ext}\n`;
+        }
+        return playlist;
+    }
+
+    _serveHls(req, res) {
+        //Cast receivers download the playlist and the segments from another origin
+        res.setHeader('Access-Control-Allow-Origin', '*');
+        res.setHeader('Date', new Date().toUTCString());
+
+        const url = req.url.split('?')[0];
+        const match = /^\/segment-(\d+)\.\w+$/.exec(url);
+        if(url === '/live.m3u8') {
+            res.setHeader('Content-Type', 'application/vnd.apple.mpegurl');
+            res.setHeader('Cache-Control', 'no-cache');
+            res.end(this._playlist());
+        } else if(match) {
+            const sequence = parseInt(match[1]);
+            const segment = this._segments.find((s) => s.sequence === sequence);
+            if(segment) {
+                res.setHeader('Content-Type', this._contentType);
+                res.setHeader('Content-Length', segment.buffer.length);
+                res.setHeader('Cache-Control', 'max-age=60');
+                res.end(segment.buffer);
+            } else {
+                res.statusCode = 404;
+                res.end();
+            }
+        } else {
+            res.statusCode = 404;
+            res.end();
+        }
+    }
+
     stop() {
         for(let client of this._connectedClients) {
             client.end();
         }
         this._connectedClients = [];
+        this._history = [];
+        this._segments = [];
         this._server.close();
     }
 
@@ -130,6 +371,18 @@ class Webcast extends stream.Writable {
         return this._contentType;
     }
 
+    get hls() {
+        return this._hls;
+    }
+
+    get playlistPath() {
+        return this._hls ? '/live.m3u8' : null;
+    }
+
+    get _segmentExtension() {
+        return this._contentType === 'audio/aac' || this._contentType === 'audio/aacp' ? 'aac' : 'mp3';
+    }
+
     get port() {
         return this._port;
     }
@@ -0,0 +1,115 @@
+#include "AudioBuffer.hpp"
+#include "NativeMemory.hpp"
+#include <new>
+
+char* AudioBuffer::alloc(size_t size) {
+    return (char*) allocHeader(size, nullptr) + sizeof(Header);
+}
+
+void AudioBuffer::retain(const void* data) {
+    header(data)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioBuffer::release(const void* data) {
+    if(data == nullptr) return;
+    Header* h = header(data);
+    if(h->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if(h->pool != nullptr) {
+            h->pool->recycle(h);
+        } else {
+            free(h);
+        }
+    }
+}
+
+size_t AudioBuffer::capacity(const void* data) {
+    return header(data)->capacity;
+}
+
+void AudioBuffer::free(Header* h) {
+    NativeMemory::sub(sizeof(Header) + h->capacity);
+    h->~Header();
+    delete[] (char*) h;
+}
+
+AudioBuffer::Header* AudioBuffer::allocHeader(size_t size, BufferPool* pool) {
+    char* mem = new char[sizeof(Header) + size];
+    NativeMemory::add(sizeof(Header) + size);
+    Header* h = new (mem) Header;
+    h->refs = 1;
+    h->capacity = (uint32_t) size;
+    h->pool = pool;
+    return h;
+}
+
+
+BufferPool* BufferPool::create(size_t bufferSize, size_t count) {
+    return new BufferPool(bufferSize, count);
+}
+
+BufferPool::BufferPool(size_t bufferSize, size_t count):
+    size(bufferSize),
+    //Keeps every header aligned
+    stride(sizeof(AudioBuffer::Header) + (bufferSize + alignof(AudioBuffer::Header) - 1) / alignof(AudioBuffer::Header) * alignof(AudioBuffer::Header)),
+    count(count),
+    block(new char[stride * count]),
+    next(new std::atomic<uint32_t>[count]) {
+    NativeMemory::add(stride * count);
+    for(size_t i = 0; i < count; i++) {
+        AudioBuffer::Header* h = new (block + i * stride) AudioBuffer::Header;
+        h->refs = 0;
+        h->capacity = (uint32_t) bufferSize;
+        h->pool = this;
+        next[i] = i + 1 < count ? (uint32_t) (i + 2) : 0;
+    }
+    head = count > 0 ? 1 : 0;
+}
+
+BufferPool::~BufferPool() {
+    for(size_t i = 0; i < count; i++) {
+        at((uint32_t) i)->~Header();
+    }
+    NativeMemory::sub(stride * count);
+    delete[] block;
+}
+
+void BufferPool::destroy() {
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+char* BufferPool::acquire() {
+    refs.fetch_add(1, std::memory_order_relaxed);
+    uint64_t top = head.load(std::memory_order_acquire);
+    uint32_t index;
+    do {
+        index = (uint32_t) top;
+        if(index == 0) {
+            //The owner still holds its reference, this is never the last one
+            refs.fetch_sub(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        //Stale if the buffer was taken and given back meanwhile, then the tag fails the exchange
+        uint64_t below = next[index - 1].load(std::memory_order_relaxed);
+        if(head.compare_exchange_weak(top, ((top >> 32) + 1) << 32 | below, std::memory_order_acquire, std::memory_order_acquire)) {
+            break;
+        }
+    } while(true);
+
+    AudioBuffer::Header* h = at(index - 1);
+    h->refs.store(1, std::memory_order_relaxed);
+    return (char*) h + sizeof(AudioBuffer::Header);
+}
+
+void BufferPool::recycle(AudioBuffer::Header* h) {
+    uint32_t index = (uint32_t) (((char*) h - block) / stride) + 1;
+    uint64_t top = head.load(std::memory_order_relaxed);
+    do {
+        next[index - 1].store((uint32_t) top, std::memory_order_relaxed);
+    } while(!head.compare_exchange_weak(top, ((top >> 32) + 1) << 32 | index, std::memory_order_release, std::memory_order_relaxed));
+
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
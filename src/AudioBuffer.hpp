@@ -0,0 +1,71 @@
+#ifndef AUDIO_BUFFER_H
+#define AUDIO_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+class BufferPool;
+
+//Reference counted storage for captured audio. The data can be shared between
+//the JS Buffer and the native consumers without copying it.
+class AudioBuffer {
+public:
+    static char* alloc(size_t size);
+    static void retain(const void* data);
+    static void release(const void* data);
+    static size_t capacity(const void* data);
+
+private:
+    friend class BufferPool;
+
+    struct alignas(16) Header {
+        std::atomic<uint32_t> refs;
+        uint32_t capacity;
+        BufferPool* pool;
+    };
+
+    static Header* header(const void* data) {
+        return reinterpret_cast<Header*>((char*) data - sizeof(Header));
+    }
+
+    static Header* allocHeader(size_t size, BufferPool* pool);
+    static void free(Header* h);
+};
+
+//Fixed pool of AudioBuffers of the same size, allocated up front in one block.
+//acquire() and the release of a buffer neither lock nor allocate, so they can
+//run in the audio callback: the free buffers are a lock-free stack of indexes,
+//tagged against ABA. The pool is deleted when it has been destroyed and all
+//its buffers have been released, because JS can hold them for a long time.
+class BufferPool {
+public:
+    static BufferPool* create(size_t bufferSize, size_t count);
+    void destroy();
+
+    //nullptr when every buffer is in use
+    char* acquire();
+    size_t bufferSize() const { return size; }
+
+private:
+    friend class AudioBuffer;
+
+    BufferPool(size_t bufferSize, size_t count);
+    ~BufferPool();
+    void recycle(AudioBuffer::Header* h);
+    AudioBuffer::Header* at(uint32_t index) { return (AudioBuffer::Header*) (block + index * stride); }
+
+    const size_t size;
+    const size_t stride;
+    const size_t count;
+    char* block;
+    //Index + 1 of the next free buffer of each buffer, 0 ends the stack
+    std::unique_ptr<std::atomic<uint32_t>[]> next;
+    //Tag in the high 32 bits, index + 1 of the top free buffer in the low ones
+    std::atomic<uint64_t> head{0};
+    //One for the owner and one for every acquired buffer
+    std::atomic<size_t> refs{1};
+};
+
+#endif
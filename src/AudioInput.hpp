@@ -6,9 +6,35 @@
 #include <vector>
 #include <string>
 
+#include "ThreadConfig.hpp"
+#include "SampleClock.hpp"
+
+//Native consumer of the captured audio. `push` is called from the capture
+//thread for every chunk, so it must not block. The chunk is an AudioBuffer
+//and must be retained if it is used after `push` returns. `sample` is the
+//index of its first sample in the clock of the input. `discontinuity` is set
+//on the first chunk after a stall of the device, audio is missing before it.
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+    virtual void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) = 0;
+};
+
 class AudioInput {
 public:
-    typedef void (*AudioInputCallback)(uint32_t, const void*, void*);
+    //Size, chunk, index of its first sample in the clock, if audio is missing before it and user data
+    typedef void (*AudioInputCallback)(uint32_t, const void*, uint64_t, bool, void*);
+    //Receives the errors of PortAudio, the addon throws them as JS exceptions
+    typedef void (*ErrorHandler)(const char*);
+    //End of a replayed file, with the user data of the input callback
+    typedef void (*EndCallback)(void*);
+    //Chunks delivered and not consumed yet, the replays wait while there are too many
+    typedef size_t (*BacklogCallback)(void*);
+    //Stall of the device (recovered false) or first callback after the stream was reopened,
+    //with the ms without callbacks, the index of the first sample of the new stream and the user data
+    typedef void (*StallCallback)(bool recovered, double gap, uint64_t sample, void*);
+    //Input devices (like getInputDevices) that appeared and disappeared after a refresh
+    typedef void (*DevicesChangedCallback)(const std::vector<std::string> &added, const std::vector<std::string> &removed);
 
     struct Options {
         uint32_t sampleRate;
@@ -16,13 +42,57 @@ public:
         uint8_t channels;
         uint16_t frameDuration;
         const char* devName;
+        uint32_t framesPerChunk; //0 emits chunks as they come from the device
+        ThreadConfig threads;
+        const char* inputFile;     //WAV or raw file replayed in place of the device
+        const char* callbackTrace; //Callback trace replayed with synthetic audio in place of the device
+        double inputSpeed;         //Times real time for the replays, 0 as fast as possible
+        bool inputLoop;
+        std::vector<std::string> hostApis; //Preferred host APIs (part of their names), in order
+        double latency;            //Suggested latency in ms, 0 for the low default of the device and -1 for the high one
+        bool clipOff;
+        bool ditherOff;
+        uint32_t stallTimeout;     //ms without callbacks before the stream is reopened, 0 disables the watchdog
+        std::vector<std::string> fallbackDevices; //Tried in order when the device cannot be reopened
     };
 
+    struct StreamInfo {
+        std::string device;
+        std::string hostApi;
+        double inputLatency; //ms, negotiated with the driver
+        double sampleRate;
+    };
+
+    struct Stats {
+        uint64_t callbacks;
+        uint64_t frames;
+        uint64_t inputOverflows;
+        uint64_t inputUnderflows;
+        double maxCallbackTime; //us spent in the capture callback
+        uint64_t droppedFrames; //Lost with `framesPerChunk` because every chunk of the pool was in use
+        uint64_t stalls;
+        uint64_t recoveries;
+    };
+
+    //Largest chunk of `framesPerChunk`
+    static const uint64_t maxChunkBytes = 16 * 1024 * 1024;
+
     static const char* errorCodeToString(int);
     static void getInputDevices(std::vector<std::string> &);
+    //Index of the input device whose name is in `name` (the default one for null),
+    //from the first host API of `hostApis` that has one
+    static int findDevice(const char* name, const std::vector<std::string> &hostApis = std::vector<std::string>());
     static void staticInit(std::string path = "");
     static void staticDeinit();
     static bool isLoaded();
+    static void setErrorHandler(ErrorHandler handler);
+    //PortAudio only finds new devices when it is initialized again, which closes every stream. The
+    //rescan is done now if no input has a PortAudio stream, and returns true, or when the last one
+    //is closed. The callback is called from there if the list changed
+    static bool refreshDevices();
+    //Drops a deferred refresh, before closing everything at exit
+    static void cancelRefreshDevices();
+    static void setDevicesChangedCallback(DevicesChangedCallback cbk);
 
     AudioInput(const Options &opt) : options(opt) {
         selfInit();
@@ -34,25 +104,48 @@ public:
         this->userData = userData;
     }
 
+    void setEndCallback(EndCallback cbk) {
+        this->endCbk = cbk;
+    }
+
+    void setStallCallback(StallCallback cbk) {
+        this->stallCbk = cbk;
+    }
+
+    void setBacklogCallback(BacklogCallback cbk) {
+        this->backlogCbk = cbk;
+    }
+
     int open();
     void close();
-    void pause();
+    void pause(bool soft = false);
     bool isOpen();
     bool isPaused();
+    void getStats(Stats &);
+    SampleClock& getClock();
+    //Returns false if there is no PortAudio stream
+    bool getStreamInfo(StreamInfo &);
+
+    //Records the size, time info and flags of every callback into `path`, without the audio
+    bool startCallbackTrace(const std::string &path, std::string &error);
+    //Returns false if it was not recording
+    bool stopCallbackTrace(uint64_t &recorded, uint64_t &dropped);
+
+    void addSink(AudioSink* sink);
+    void removeSink(AudioSink* sink);
 
     Options options;
 
-    void callCallback(uint32_t size, const void* pcm) {
-        if(cbk) {
-            cbk(size, pcm, userData);
-        }
-    }
+    void callCallback(uint32_t size, const void* pcm, uint64_t sample);
 
     void selfInit();
 
     AudioInputCallback cbk = nullptr;
+    EndCallback endCbk = nullptr;
+    StallCallback stallCbk = nullptr;
+    BacklogCallback backlogCbk = nullptr;
     void* userData;
-    struct private_data* self;
+    struct private_data* self = nullptr;
 };
 
 #endif
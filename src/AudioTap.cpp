@@ -0,0 +1,182 @@
+#include "AudioTap.hpp"
+#include "AudioBuffer.hpp"
+#include "Trace.hpp"
+#include "PcmKernels.hpp"
+
+static AudioTap::Options withDefaultChannelMap(AudioTap::Options opt, uint8_t inChannels) {
+    if(opt.channelMap.empty()) {
+        for(uint8_t c = 0; c < inChannels; c++) {
+            opt.channelMap.push_back(c);
+        }
+    }
+    return opt;
+}
+
+AudioTap::AudioTap(int id, const Options &opt, const AudioInput::Options &input):
+    id(id),
+    options(withDefaultChannelMap(opt, input.channels)),
+    resampler(input.sampleRate, opt.sampleRate, (uint8_t) options.channelMap.size()) {}
+
+AudioTap::~AudioTap() {
+    for(auto &chunk: queue) {
+        AudioBuffer::release(chunk.pcm);
+    }
+}
+
+bool AudioTap::pop(const void** pcm, uint32_t* size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(queue.empty()) return false;
+    *pcm = queue.front().pcm;
+    *size = queue.front().size;
+    queue.pop_front();
+    return true;
+}
+
+void AudioTap::getStats(Stats &stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.chunks = chunks;
+    stats.bytes = bytes;
+    stats.dropped = dropped;
+    stats.queued = queue.size();
+    stats.peak = peak;
+    peak = 0.0f;
+}
+
+void AudioTap::process(const float* in, uint8_t inChannels, size_t frames, double correction, bool discontinuity) {
+    size_t outChannels = options.channelMap.size();
+    mapped.resize(frames * outChannels);
+    PcmFormat::mapChannels(in, inChannels, mapped.data(), options.channelMap, frames);
+    const PcmKernelSet& kernels = PcmKernels::get();
+    if(options.gain != 1.0f) {
+        kernels.scale(mapped.data(), options.gain, mapped.size());
+    }
+    float chunkPeak = kernels.peak(mapped.data(), mapped.size());
+
+    if(options.clockCorrection) {
+        resampler.setRatio(correction);
+    }
+    //Not interpolated across a stall of the device
+    if(discontinuity) {
+        resampler.reset();
+    }
+
+    const std::vector<float>* out = &mapped;
+    if(!resampler.isPassthrough()) {
+        resampled.clear();
+        resampler.process(mapped.data(), frames, resampled);
+        out = &resampled;
+    }
+
+    trackedBytes.update((mapped.capacity() + resampled.capacity()) * sizeof(float));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(chunkPeak > peak) peak = chunkPeak;
+    }
+
+    if(out->empty()) return;
+    uint32_t size = (uint32_t) (out->size() * PcmFormat::bytesPerSample(options.bitsPerSample));
+    char* pcm = AudioBuffer::alloc(size);
+    PcmFormat::fromFloat(out->data(), options.bitsPerSample, pcm, out->size());
+    enqueue(pcm, size);
+}
+
+void AudioTap::enqueue(const void* pcm, uint32_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(options.maxQueue != 0 && queue.size() >= options.maxQueue) {
+        dropped++;
+        if(!options.dropOldest) {
+            AudioBuffer::release(pcm);
+            return;
+        }
+        AudioBuffer::release(queue.front().pcm);
+        queue.pop_front();
+    }
+
+    queue.push_back({ pcm, size });
+    chunks++;
+    bytes += size;
+}
+
+
+TapProcessor::TapProcessor(const AudioInput::Options &input, const SampleClock* clock, NotifyCallback notify, void* userData):
+    input(input), clock(clock), notify(notify), userData(userData) {
+    strand.reset(new WorkerPool::Strand(input.threads.lowPriority ? WorkerPool::Low : WorkerPool::High, &TapProcessor::runJob, this));
+}
+
+TapProcessor::~TapProcessor() {
+    //Waits for the chunk being converted
+    strand.reset();
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+}
+
+int TapProcessor::addTap(const AudioTap::Options &opt) {
+    std::lock_guard<std::mutex> lock(tapsMutex);
+    int id = nextId++;
+    taps.push_back(std::make_shared<AudioTap>(id, opt, input));
+    return id;
+}
+
+bool TapProcessor::removeTap(int id) {
+    std::lock_guard<std::mutex> lock(tapsMutex);
+    for(auto it = taps.begin(); it != taps.end(); it++) {
+        if((*it)->id == id) {
+            taps.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::shared_ptr<AudioTap>> TapProcessor::getTaps() {
+    std::lock_guard<std::mutex> lock(tapsMutex);
+    return taps;
+}
+
+void TapProcessor::push(const void* pcm, uint32_t size, uint64_t, bool discontinuity) {
+    AudioBuffer::retain(pcm);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.size() >= maxPendingInput) {
+            AudioBuffer::release(pending.front().pcm);
+            pending.pop_front();
+            droppedInput++;
+            //The audio that was dropped is missing before the next one
+            pending.front().discontinuity = true;
+        }
+        pending.push_back({ pcm, size, discontinuity });
+    }
+    strand->signal();
+}
+
+bool TapProcessor::runJob(void* userData) {
+    TapProcessor* self = (TapProcessor*) userData;
+    Chunk chunk;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if(self->pending.empty()) return false;
+        chunk = self->pending.front();
+        self->pending.pop_front();
+    }
+
+    //One chunk per job, so the other streams of the pool are not delayed by a backlog
+    const AudioInput::Options &input = self->input;
+    TRACE_SCOPE("tap convert", chunk.size);
+    size_t count = chunk.size / PcmFormat::bytesPerSample(input.bitsPerSample);
+    self->samples.resize(count);
+    self->trackedBytes.update(self->samples.capacity() * sizeof(float));
+    PcmFormat::toFloat(chunk.pcm, input.bitsPerSample, self->samples.data(), count);
+    AudioBuffer::release(chunk.pcm);
+
+    double correction = self->clock->correctionRatio();
+    for(auto &tap: self->getTaps()) {
+        tap->process(self->samples.data(), input.channels, count / input.channels, correction, chunk.discontinuity);
+    }
+    self->notify(self->userData);
+
+    std::lock_guard<std::mutex> lock(self->mutex);
+    return !self->pending.empty();
+}
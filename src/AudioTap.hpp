@@ -0,0 +1,115 @@
+#ifndef AUDIO_TAP_H
+#define AUDIO_TAP_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "AudioInput.hpp"
+#include "PcmFormat.hpp"
+#include "NativeMemory.hpp"
+#include "WorkerPool.hpp"
+
+//A tap is a second view of the captured stream with its own format. Converted
+//chunks are kept in the tap queue until they are popped by the JS side.
+class AudioTap {
+public:
+    struct Options {
+        uint32_t sampleRate;
+        uint8_t bitsPerSample;
+        std::vector<int> channelMap;
+        uint32_t maxQueue; //0 means unbounded
+        bool dropOldest;
+        float gain;
+        bool clockCorrection; //Resamples slightly to follow the system clock
+    };
+
+    struct Stats {
+        uint64_t chunks;
+        uint64_t bytes;
+        uint64_t dropped;
+        size_t queued;
+        float peak; //Max absolute sample since the last getStats
+    };
+
+    AudioTap(int id, const Options &opt, const AudioInput::Options &input);
+    ~AudioTap();
+
+    const int id;
+    const Options options;
+
+    bool pop(const void** pcm, uint32_t* size);
+    void getStats(Stats &);
+
+private:
+    friend class TapProcessor;
+
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+    };
+
+    void process(const float* in, uint8_t inChannels, size_t frames, double correction, bool discontinuity);
+    void enqueue(const void* pcm, uint32_t size);
+
+    Resampler resampler;
+    std::vector<float> mapped;
+    std::vector<float> resampled;
+    TrackedCapacity trackedBytes;
+
+    std::mutex mutex;
+    std::deque<Chunk> queue;
+    uint64_t chunks = 0;
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;
+    float peak = 0.0f;
+};
+
+//Feeds every tap of an AudioInput from a single capture callback. The format
+//conversion is done on the shared worker pool, never in the capture thread.
+class TapProcessor: public AudioSink {
+public:
+    typedef void (*NotifyCallback)(void*);
+
+    TapProcessor(const AudioInput::Options &input, const SampleClock* clock, NotifyCallback notify, void* userData);
+    ~TapProcessor();
+
+    int addTap(const AudioTap::Options &opt);
+    bool removeTap(int id);
+    std::vector<std::shared_ptr<AudioTap>> getTaps();
+    uint64_t getDroppedInput() const { return droppedInput; }
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+        bool discontinuity;
+    };
+
+    static const size_t maxPendingInput = 256;
+
+    static bool runJob(void* userData);
+
+    const AudioInput::Options input;
+    const SampleClock* clock;
+    NotifyCallback notify;
+    void* userData;
+
+    std::mutex tapsMutex;
+    std::vector<std::shared_ptr<AudioTap>> taps;
+    int nextId = 0;
+
+    std::vector<float> samples;
+    TrackedCapacity trackedBytes;
+
+    std::mutex mutex;
+    std::deque<Chunk> pending;
+    uint64_t droppedInput = 0;
+    std::unique_ptr<WorkerPool::Strand> strand;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "CallbackTrace.hpp"
+#include "SampleClock.hpp"
+#include "PcmFormat.hpp"
+#include "Trace.hpp"
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+static_assert(sizeof(CallbackTrace::Header) == 32, "The trace header must be packed");
+static_assert(sizeof(CallbackTrace::Record) == 32, "The trace records must be packed");
+
+const char CallbackTrace::magic[8] = { 'P', 'A', 'C', 'B', 'T', 'R', '1', 0 };
+
+//The records are written to the file this often
+static const int flushIntervalMs = 100;
+static const double toneFrequency = 440;
+static const double pi = 3.14159265358979323846;
+
+CallbackTraceWriter::CallbackTraceWriter(const AudioInput::Options &input): input(input), ring(ringSize) {}
+
+CallbackTraceWriter::~CallbackTraceWriter() {
+    finish();
+}
+
+void CallbackTraceWriter::finish() {
+    if(running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+
+    if(file != nullptr) {
+        flush();
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool CallbackTraceWriter::start(const std::string &path, std::string &error) {
+    file = fopen(path.c_str(), "wb");
+    if(file == nullptr) {
+        error = "Could not open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    CallbackTrace::Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CallbackTrace::magic, sizeof(header.magic));
+    header.sampleRate = input.sampleRate;
+    header.bitsPerSample = input.bitsPerSample;
+    header.channels = input.channels;
+    header.framesPerBuffer = input.sampleRate * input.frameDuration / 1000;
+    header.startTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if(fwrite(&header, sizeof(header), 1, file) != 1) {
+        error = std::string("Could not write the trace: ") + strerror(errno);
+        return false;
+    }
+
+    startTime = SampleClock::now();
+    running = true;
+    thread = std::thread(&CallbackTraceWriter::run, this);
+    return true;
+}
+
+void CallbackTraceWriter::record(unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags flags) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if(h - tail.load(std::memory_order_acquire) >= ringSize) {
+        droppedRecords++;
+        return;
+    }
+
+    CallbackTrace::Record &record = ring[h % ringSize];
+    record.callTime = SampleClock::now() - startTime;
+    record.currentTime = timeInfo != nullptr ? timeInfo->currentTime : 0;
+    record.adcTime = timeInfo != nullptr ? timeInfo->inputBufferAdcTime : 0;
+    record.frames = (uint32_t) frames;
+    record.flags = (uint32_t) flags;
+    head.store(h + 1, std::memory_order_release);
+}
+
+void CallbackTraceWriter::flush() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    while(t != h) {
+        //Up to the end of the ring in one write
+        size_t n = std::min(h - t, ringSize - t % ringSize);
+        fwrite(&ring[t % ringSize], sizeof(CallbackTrace::Record), n, file);
+        t += n;
+        written += n;
+    }
+    tail.store(t, std::memory_order_release);
+}
+
+void CallbackTraceWriter::run() {
+    TRACE_THREAD_NAME("callback trace");
+    std::unique_lock<std::mutex> lock(mutex);
+    while(running) {
+        cond.wait_for(lock, std::chrono::milliseconds(flushIntervalMs));
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+CallbackTraceReplay::CallbackTraceReplay(const Options &opt, const AudioInput::Options &input, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData):
+    ReplayInput(opt.speed, callback, onEnd, backlog, userData), options(opt), input(input) {}
+
+CallbackTraceReplay::~CallbackTraceReplay() {
+    stop();
+}
+
+bool CallbackTraceReplay::open(std::string &error) {
+    FILE* file = fopen(options.path.c_str(), "rb");
+    if(file == nullptr) {
+        error = "Could not open " + options.path + ": " + strerror(errno);
+        return false;
+    }
+
+    CallbackTrace::Header header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CallbackTrace::magic, sizeof(header.magic))) {
+        fclose(file);
+        error = "Invalid callback trace " + options.path;
+        return false;
+    }
+
+    CallbackTrace::Record record;
+    uint32_t maxFrames = 0;
+    while(fread(&record, sizeof(record), 1, file) == 1) {
+        records.push_back(record);
+        maxFrames = std::max(maxFrames, record.frames);
+    }
+    fclose(file);
+    if(records.empty()) {
+        error = "The callback trace " + options.path + " is empty";
+        return false;
+    }
+
+    samples.resize((size_t) maxFrames * input.channels);
+    buffer.resize((size_t) maxFrames * input.channels * input.bitsPerSample / 8);
+    return true;
+}
+
+bool CallbackTraceReplay::next(Buffer &next) {
+    if(index == records.size()) {
+        if(!options.loop) return false;
+        const CallbackTrace::Record &last = records.back();
+        offset += last.callTime + (double) last.frames / input.sampleRate;
+        index = 0;
+    }
+
+    const CallbackTrace::Record &record = records[index++];
+    double step = 2 * pi * toneFrequency / input.sampleRate;
+    for(uint32_t i = 0; i < record.frames; i++) {
+        float value = (float) (0.5 * sin(phase));
+        phase += step;
+        for(uint8_t c = 0; c < input.channels; c++) {
+            samples[i * input.channels + c] = value;
+        }
+    }
+    phase = fmod(phase, 2 * pi);
+    PcmFormat::fromFloat(samples.data(), input.bitsPerSample, buffer.data(), (size_t) record.frames * input.channels);
+
+    next.pcm = buffer.data();
+    next.frames = record.frames;
+    next.time = offset + record.callTime;
+    //The latency of the driver, if it gave a sensible one
+    double latency = record.currentTime - record.adcTime;
+    next.latency = record.adcTime > 0 && latency >= 0 && latency < 1.0 ? latency : 0;
+    next.flags = record.flags;
+    return true;
+}
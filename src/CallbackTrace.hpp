@@ -0,0 +1,105 @@
+#ifndef CALLBACK_TRACE_H
+#define CALLBACK_TRACE_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "ReplayInput.hpp"
+
+//Pattern of the callbacks of a driver (sizes, times and status flags), without
+//the audio. The file is a Header and one Record per callback, little endian.
+namespace CallbackTrace {
+    struct Header {
+        char magic[8];
+        uint32_t sampleRate;
+        uint16_t bitsPerSample;
+        uint16_t channels;
+        uint32_t framesPerBuffer; //Requested to PortAudio, 0 if unspecified
+        uint32_t reserved;
+        double startTime;         //s since the epoch
+    };
+
+    struct Record {
+        double callTime;    //s since the start of the trace
+        double currentTime; //PaStreamCallbackTimeInfo, in the clock of the driver
+        double adcTime;
+        uint32_t frames;
+        uint32_t flags;
+    };
+
+    extern const char magic[8];
+}
+
+//Records the callbacks of a stream. `record` is called from the capture thread
+//and only copies into a ring, a thread writes the ring into the file.
+class CallbackTraceWriter {
+public:
+    CallbackTraceWriter(const AudioInput::Options &input);
+    ~CallbackTraceWriter();
+
+    bool start(const std::string &path, std::string &error);
+    //Writes what is still in the ring and closes the file
+    void finish();
+    void record(unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags flags);
+
+    uint64_t recorded() const { return written; }
+    uint64_t dropped() const { return droppedRecords; }
+
+private:
+    static const size_t ringSize = 4096;
+
+    void run();
+    void flush();
+
+    const AudioInput::Options input;
+    FILE* file = nullptr;
+    double startTime = 0;
+    std::vector<CallbackTrace::Record> ring;
+    std::atomic<size_t> head{0}; //Written by the capture thread
+    std::atomic<size_t> tail{0}; //Written by the writer thread
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> droppedRecords{0};
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool running = false;
+    std::thread thread;
+};
+
+//Replays a trace with synthetic audio (a sine) in place of the device, with
+//the sizes, timing and flags of the recorded callbacks.
+class CallbackTraceReplay: public ReplayInput {
+public:
+    struct Options {
+        std::string path;
+        double speed; //1 is the recorded timing, 0 as fast as possible
+        bool loop;
+    };
+
+    CallbackTraceReplay(const Options &opt, const AudioInput::Options &input, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData);
+    ~CallbackTraceReplay();
+
+    bool open(std::string &error) override;
+
+protected:
+    bool next(Buffer &buffer) override;
+    bool isOpen() override { return !records.empty(); }
+
+private:
+    const Options options;
+    const AudioInput::Options input;
+    std::vector<CallbackTrace::Record> records;
+    size_t index = 0;
+    double offset = 0; //Duration of the previous loops
+    double phase = 0;
+    std::vector<float> samples;
+    std::vector<char> buffer;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "CaptureSpool.hpp"
+#include "AudioBuffer.hpp"
+#include "Trace.hpp"
+#include "NativeMemory.hpp"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+CaptureSpool::CaptureSpool(const Options &opt, const AudioInput::Options &input, const SampleClock* clock):
+    options(opt), input(input), clock(clock), frameBytes(input.bitsPerSample / 8 * input.channels) {}
+
+CaptureSpool::~CaptureSpool() {
+    stop();
+#ifndef _WIN32
+    if(base != nullptr) {
+        input.threads.unlock(base, capacity);
+        munmap(base, capacity * 2);
+        NativeMemory::sub(capacity);
+    }
+    if(fd != -1) {
+        ::close(fd);
+    }
+#endif
+}
+
+bool CaptureSpool::start(std::string &error) {
+#ifdef _WIN32
+    error = "The capture spool is not available on Windows";
+    return false;
+#else
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    capacity = (size_t) (options.seconds + guardSeconds) * input.sampleRate * frameBytes;
+    capacity = (capacity + page - 1) / page * page;
+
+    fd = open(options.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1 || ftruncate(fd, capacity) != 0) {
+        error = "Could not create " + options.path + ": " + strerror(errno);
+        if(fd != -1) ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void* area = mmap(nullptr, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(area == MAP_FAILED) {
+        error = std::string("Could not reserve memory for the spool: ") + strerror(errno);
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    base = (char*) area;
+    if(mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        error = std::string("Could not map the spool: ") + strerror(errno);
+        munmap(base, capacity * 2);
+        base = nullptr;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    //Both mappings share the same pages, locking one of them is enough
+    input.threads.lock(base, capacity);
+    NativeMemory::add(capacity);
+    running = true;
+    thread = std::thread(&CaptureSpool::run, this);
+    return true;
+#endif
+}
+
+void CaptureSpool::stop() {
+    if(running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    pending.clear();
+}
+
+uint64_t CaptureSpool::windowFrames() const {
+    return capacity / frameBytes - (uint64_t) guardSeconds * input.sampleRate;
+}
+
+void CaptureSpool::getInfo(Info &info) {
+    uint64_t last = written;
+    uint64_t window = windowFrames();
+    info.lastSample = last;
+    info.firstSample = std::max<uint64_t>(firstWritten, last > window ? last - window : 0);
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    if(index.empty()) {
+        info.firstTime = info.lastTime = 0;
+    } else {
+        info.firstTime = index.front().time + (double) (info.firstSample - std::min(info.firstSample, index.front().sample)) * 1000.0 / input.sampleRate;
+        info.lastTime = index.back().time + (double) (last - index.back().sample) * 1000.0 / input.sampleRate;
+    }
+}
+
+const char* CaptureSpool::read(uint64_t sample, uint64_t frames) {
+    Info info;
+    getInfo(info);
+    if(base == nullptr || sample < info.firstSample || sample + frames > info.lastSample) {
+        return nullptr;
+    }
+    return base + (sample * frameBytes) % capacity;
+}
+
+int64_t CaptureSpool::sampleAt(double time) {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    if(index.empty() || time < index.front().time) return -1;
+
+    auto it = std::upper_bound(index.begin(), index.end(), time, [] (double t, const IndexEntry &e) {
+        return t < e.time;
+    });
+    const IndexEntry &entry = *(it - 1);
+    uint64_t sample = entry.sample + (uint64_t) ((time - entry.time) * input.sampleRate / 1000.0);
+    uint64_t last = written;
+    uint64_t window = windowFrames();
+    uint64_t first = std::max<uint64_t>(firstWritten, last > window ? last - window : 0);
+    return sample >= first && sample < last ? (int64_t) sample : -1;
+}
+
+//Chunks are placed at their sample, so a gap of the input leaves silence in the spool
+void CaptureSpool::push(const void* pcm, uint32_t size, uint64_t sample, bool) {
+    AudioBuffer::retain(pcm);
+    double time = clock->timeOf(sample);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back({ pcm, size, sample, time });
+    }
+    cond.notify_one();
+}
+
+void CaptureSpool::run() {
+    input.threads.applyToCurrentThread("spool");
+    TRACE_THREAD_NAME("spool");
+    std::unique_lock<std::mutex> lock(mutex);
+    while(running) {
+        if(pending.empty()) {
+            cond.wait(lock);
+            continue;
+        }
+
+        Chunk chunk = pending.front();
+        pending.pop_front();
+        lock.unlock();
+        write(chunk);
+        AudioBuffer::release(chunk.pcm);
+        lock.lock();
+    }
+}
+
+void CaptureSpool::write(const Chunk &chunk) {
+    TRACE_SCOPE("spool write", chunk.size);
+    uint64_t capacityFrames = capacity / frameBytes;
+    uint64_t sample = chunk.sample;
+    uint64_t frames = chunk.size / frameBytes;
+    const char* data = (const char*) chunk.pcm;
+    if(!started) {
+        started = true;
+        firstWritten = sample;
+        written = sample;
+    }
+
+    uint64_t end = written;
+    if(sample + frames <= end) return;
+    if(sample < end) {
+        //Already in the spool
+        data += (end - sample) * frameBytes;
+        frames -= end - sample;
+        sample = end;
+    } else if(sample > end) {
+        //Audio missing in the input, it is silence in the spool
+        uint64_t gap = std::min(sample - end, capacityFrames);
+        memset(base + ((sample - gap) * frameBytes) % capacity, 0, gap * frameBytes);
+    }
+    if(frames > capacityFrames) {
+        data += (frames - capacityFrames) * frameBytes;
+        sample += frames - capacityFrames;
+        frames = capacityFrames;
+    }
+
+    //Thanks to the double mapping, the copy never has to be split
+    memcpy(base + (sample * frameBytes) % capacity, data, frames * frameBytes);
+    {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        index.push_back({ sample, chunk.time + (sample - chunk.sample) * 1000.0 / input.sampleRate });
+        while(index.size() > 1 && sample + frames - index[1].sample > capacityFrames) {
+            index.pop_front();
+        }
+    }
+    written = sample + frames;
+}
@@ -0,0 +1,89 @@
+#ifndef CAPTURE_SPOOL_H
+#define CAPTURE_SPOOL_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "AudioInput.hpp"
+#include "SampleClock.hpp"
+
+//Keeps the last seconds of the capture in a circular file mapped in memory.
+//The file is mapped twice, one after the other, so any range of the window
+//is contiguous in memory and can be read without copying it. It is addressed
+//by the samples of the input clock, the audio missing in a gap is silence.
+class CaptureSpool: public AudioSink {
+public:
+    struct Options {
+        std::string path;
+        uint32_t seconds;
+    };
+
+    struct Info {
+        uint64_t firstSample;
+        uint64_t lastSample; //exclusive
+        double firstTime;    //wall-clock in ms
+        double lastTime;
+    };
+
+    CaptureSpool(const Options &opt, const AudioInput::Options &input, const SampleClock* clock);
+    ~CaptureSpool();
+
+    bool start(std::string &error);
+    //Stops feeding the spool, the mapping is kept until it is deleted
+    void stop();
+    void getInfo(Info &);
+    //Returns a pointer into the mapping, valid until the window moves past it (at least a second)
+    const char* read(uint64_t sample, uint64_t frames);
+    //Sample captured at the wall-clock time (in ms), or -1 if it is out of the window
+    int64_t sampleAt(double time);
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+        uint64_t sample;
+        double time; //Of the first sample, from the input clock
+    };
+
+    //Written beyond the window, so a read at its start is not overwritten by the next chunk
+    static const uint32_t guardSeconds = 1;
+
+    struct IndexEntry {
+        uint64_t sample;
+        double time;
+    };
+
+    void run();
+    void write(const Chunk &chunk);
+    uint64_t windowFrames() const;
+
+    const Options options;
+    const AudioInput::Options input;
+    const SampleClock* clock;
+    const size_t frameBytes;
+
+    int fd = -1;
+    char* base = nullptr;
+    size_t capacity = 0;
+    bool started = false;
+    std::atomic<uint64_t> firstWritten{0};
+    std::atomic<uint64_t> written{0};
+
+    std::mutex indexMutex;
+    std::deque<IndexEntry> index;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Chunk> pending;
+    bool running = false;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "Dispatcher.hpp"
+#include "Trace.hpp"
+
+Dispatcher& Dispatcher::get() {
+    static Dispatcher dispatcher;
+    return dispatcher;
+}
+
+void Dispatcher::attach(Client* client) {
+    (void) client;
+    if(!initialized) {
+        uv_async_init(uv_default_loop(), &async, &Dispatcher::onAsync);
+        async.data = this;
+        initialized = true;
+    }
+
+    //The handle only keeps the loop alive while there are open instances
+    if(clients++ == 0) {
+        uv_ref((uv_handle_t*) &async);
+    }
+}
+
+void Dispatcher::detach(Client* client) {
+    //Only the loop thread takes clients from the list, so it can be rebuilt without the detached one
+    Client* list = takeAll();
+    while(list != nullptr) {
+        Client* next = list->next;
+        if(list != client) {
+            push(list);
+        }
+        list = next;
+    }
+    client->scheduled = false;
+
+    //It can also be detached from a listener while the clients are being drained
+    for(Client** it = &current; *it != nullptr; it = &(*it)->next) {
+        if(*it == client) {
+            *it = client->next;
+            break;
+        }
+    }
+
+    if(clients > 0 && --clients == 0) {
+        uv_unref((uv_handle_t*) &async);
+    }
+}
+
+void Dispatcher::getStats(Stats &stats) {
+    stats.wakeups = wakeups;
+    stats.drains = drains;
+    stats.clients = clients;
+}
+
+void Dispatcher::schedule(Client* client) {
+    if(!client->scheduled.exchange(true, std::memory_order_acq_rel)) {
+        push(client);
+    }
+    TRACE_INSTANT("uv_async_send", 0);
+    uv_async_send(&async);
+}
+
+void Dispatcher::push(Client* client) {
+    Client* old = head.load(std::memory_order_relaxed);
+    do {
+        client->next = old;
+    } while(!head.compare_exchange_weak(old, client, std::memory_order_release, std::memory_order_relaxed));
+}
+
+Dispatcher::Client* Dispatcher::takeAll() {
+    Client* list = head.exchange(nullptr, std::memory_order_acquire);
+    //The list is LIFO, reverse it to drain in the order the clients were scheduled
+    Client* reversed = nullptr;
+    while(list != nullptr) {
+        Client* next = list->next;
+        list->next = reversed;
+        reversed = list;
+        list = next;
+    }
+    return reversed;
+}
+
+void Dispatcher::onAsync(uv_async_t* handle) {
+    Dispatcher* self = (Dispatcher*) handle->data;
+    TRACE_SCOPE("dispatch", 0);
+    self->wakeups++;
+
+    self->current = self->takeAll();
+    bool pending = false;
+    while(self->current != nullptr) {
+        Client* client = self->current;
+        self->current = client->next;
+        //Cleared before draining, so messages that arrive meanwhile schedule it again
+        client->scheduled = false;
+        self->drains++;
+        if(client->drain(self->batchSize)) {
+            if(!client->scheduled.exchange(true)) {
+                self->push(client);
+            }
+            pending = true;
+        }
+    }
+
+    //Clients with messages left are drained in the next iteration of the loop
+    if(pending) {
+        uv_async_send(&self->async);
+    }
+}
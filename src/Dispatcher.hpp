@@ -0,0 +1,62 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <uv.h>
+
+//Wakes up the event loop for all the AudioInput instances with only one async
+//handle. Instances with pending messages are pushed into a lock-free list from
+//any thread, and every wakeup drains all of them with a limited batch each,
+//so one busy instance does not delay the others.
+class Dispatcher {
+public:
+    class Client {
+    public:
+        virtual ~Client() {}
+
+    protected:
+        //Called in the loop thread, returns true if there are still messages to drain
+        virtual bool drain(size_t maxMessages) = 0;
+
+    private:
+        friend class Dispatcher;
+        std::atomic<bool> scheduled{false};
+        Client* next = nullptr;
+    };
+
+    struct Stats {
+        uint64_t wakeups;
+        uint64_t drains;
+        uint32_t clients;
+    };
+
+    static Dispatcher& get();
+
+    //Must be called from the loop thread
+    void attach(Client* client);
+    void detach(Client* client);
+    void getStats(Stats &);
+
+    //Can be called from any thread
+    void schedule(Client* client);
+
+    size_t batchSize = 32;
+
+private:
+    Dispatcher() {}
+    static void onAsync(uv_async_t* handle);
+    void push(Client* client);
+    Client* takeAll();
+
+    uv_async_t async;
+    bool initialized = false;
+    uint32_t clients = 0;
+    std::atomic<Client*> head{nullptr};
+    Client* current = nullptr; //Clients not drained yet in the current wakeup
+    std::atomic<uint64_t> wakeups{0};
+    uint64_t drains = 0;
+};
+
+#endif
@@ -0,0 +1,362 @@
+#include "FdSink.hpp"
+#include "AudioBuffer.hpp"
+#include "Trace.hpp"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#endif
+
+//Steps of the waits, the sink is removed within one of them
+static const int pollIntervalMs = 10;
+static const size_t maxIovecs = 64;
+
+#ifdef __linux__
+//Spliced chunks of the removed sinks, still referenced by their pipes. They are released
+//from a background thread as the readers consume them, so a removal does not wait for the reader.
+//A chunk is never released before it is read, the reader would get whatever is written there
+//next. If the reader is gone they are abandoned instead, at most the size of the pipe
+class SpliceReaper {
+public:
+    struct Entry {
+        int fd; //Duplicate of the descriptor of the sink, closed with the last chunk
+        uint64_t splicedTotal;
+        std::deque<std::pair<const void*, uint64_t>> chunks; //Chunk and bytes spliced up to its end
+    };
+
+    static SpliceReaper& get() {
+        //Never destroyed, like the worker pool
+        static SpliceReaper* reaper = new SpliceReaper();
+        return *reaper;
+    }
+
+    void add(Entry &&entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(std::move(entry));
+        if(!running) {
+            running = true;
+            std::thread(&SpliceReaper::run, this).detach();
+        }
+    }
+
+private:
+    void run() {
+        TRACE_THREAD_NAME("fd sink reaper");
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!entries.empty()) {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            lock.lock();
+
+            for(auto it = entries.begin(); it != entries.end();) {
+                int queued = 0;
+                bool known = ioctl(it->fd, FIONREAD, &queued) == 0;
+                if(known) {
+                    uint64_t consumed = it->splicedTotal - std::min<uint64_t>(queued, it->splicedTotal);
+                    while(!it->chunks.empty() && it->chunks.front().second <= consumed) {
+                        AudioBuffer::release(it->chunks.front().first);
+                        it->chunks.pop_front();
+                    }
+                }
+                struct pollfd p = { it->fd, POLLOUT, 0 };
+                bool readerGone = poll(&p, 1, 0) > 0 && (p.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+                if(!known || readerGone) {
+                    //Nobody reads them anymore, but the pipe still references their memory
+                    it->chunks.clear();
+                }
+                if(it->chunks.empty()) {
+                    close(it->fd);
+                    it = entries.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        running = false;
+    }
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    bool running = false;
+};
+#endif
+
+FdSink::FdSink(const Options &opt, const AudioInput::Options &input): options(opt), input(input) {
+    stats = Stats();
+}
+
+FdSink::~FdSink() {
+    if(running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+#ifndef _WIN32
+    if(originalFlags >= 0) {
+        fcntl(options.fd, F_SETFL, originalFlags);
+    }
+#endif
+}
+
+bool FdSink::start(std::string &error) {
+#ifdef _WIN32
+    if(_get_osfhandle(options.fd) == -1) {
+        error = "Invalid file descriptor";
+        return false;
+    }
+#else
+    struct stat st;
+    if(fstat(options.fd, &st) != 0) {
+        error = std::string("Invalid file descriptor: ") + strerror(errno);
+        return false;
+    }
+#ifdef __linux__
+    //vmsplice only works with pipes
+    splice = options.zeroCopy && S_ISFIFO(st.st_mode);
+#endif
+    //A reader that stops reading must not block the thread, it could not be stopped
+    int flags = fcntl(options.fd, F_GETFL);
+    if(flags >= 0 && !(flags & O_NONBLOCK) && fcntl(options.fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+        originalFlags = flags;
+    }
+#endif
+
+    stats.zeroCopy = splice;
+    running = true;
+    thread = std::thread(&FdSink::run, this);
+    return true;
+}
+
+void FdSink::getStats(Stats &s) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    s = stats;
+}
+
+void FdSink::push(const void* pcm, uint32_t size, uint64_t, bool discontinuity) {
+    bool wakeUp;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(discontinuity) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.discontinuities++;
+        }
+        if(closed || pendingBytes + size > maxPendingBytes) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.droppedChunks++;
+            return;
+        }
+        AudioBuffer::retain(pcm);
+        pending.push_back({ pcm, size, 0 });
+        pendingBytes += size;
+        wakeUp = pendingBytes >= options.batchBytes;
+    }
+
+    if(wakeUp) {
+        cond.notify_one();
+    }
+}
+
+void FdSink::run() {
+    input.threads.applyToCurrentThread("fd sink");
+    TRACE_THREAD_NAME("fd sink");
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        bool stopping = !running;
+        if(!stopping && pendingBytes < options.batchBytes) {
+            //Spliced chunks are checked often, so they are released soon after they are read
+            cond.wait_for(lock, std::chrono::milliseconds(inFlight.empty() ? 2 * pollIntervalMs : 5));
+            stopping = !running;
+        }
+
+        queue.insert(queue.end(), pending.begin(), pending.end());
+        pending.clear();
+        pendingBytes = 0;
+        bool isClosed = closed;
+        lock.unlock();
+
+        if(!isClosed && !queue.empty()) {
+            writeChunks();
+        }
+        releaseConsumed();
+
+        if(stopping) break;
+        lock.lock();
+    }
+
+    releaseLater();
+    for(auto &chunk: queue) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    queue.clear();
+}
+
+bool FdSink::writeChunks() {
+    TRACE_SCOPE("fd write", queue.size());
+    while(!queue.empty()) {
+        long n;
+#ifdef _WIN32
+        const Chunk &first = queue.front();
+        n = _write(options.fd, (const char*) first.pcm + offset, first.size - (unsigned int) offset);
+#else
+        struct iovec iov[maxIovecs];
+        size_t count = std::min(queue.size(), maxIovecs);
+        for(size_t i = 0; i < count; i++) {
+            iov[i].iov_base = (char*) queue[i].pcm + (i == 0 ? offset : 0);
+            iov[i].iov_len = queue[i].size - (i == 0 ? offset : 0);
+        }
+#ifdef __linux__
+        if(splice) {
+            n = vmsplice(options.fd, iov, count, SPLICE_F_NONBLOCK);
+            if(n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                //Not supported here, back to plain writes
+                splice = false;
+                std::lock_guard<std::mutex> statsLock(statsMutex);
+                stats.zeroCopy = false;
+                continue;
+            }
+        } else
+#endif
+        n = writev(options.fd, iov, (int) count);
+#endif
+
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if((errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable()) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return false;
+            fail(std::string("Write failed: ") + strerror(errno));
+            return false;
+        }
+
+        size_t written = (size_t) n;
+        {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.writes++;
+            stats.bytesWritten += written;
+            if(splice) stats.splicedBytes += written;
+        }
+
+        //Spliced chunks are still referenced by the pipe, they are kept until they are read
+        while(written > 0) {
+            Chunk &chunk = queue.front();
+            size_t left = chunk.size - offset;
+            if(written < left) {
+                offset += written;
+                splicedTotal += splice ? written : 0;
+                break;
+            }
+            written -= left;
+            offset = 0;
+            if(splice) {
+                splicedTotal += left;
+                chunk.end = splicedTotal;
+                inFlight.push_back(chunk);
+            } else {
+                AudioBuffer::release(chunk.pcm);
+            }
+            queue.pop_front();
+        }
+    }
+    return true;
+}
+
+void FdSink::releaseConsumed() {
+    if(inFlight.empty()) return;
+
+    //Chunks are only spliced on Linux. Without the count of the pipe they are all kept
+    uint64_t consumed = 0;
+#if defined(__linux__)
+    int queued = 0;
+    if(ioctl(options.fd, FIONREAD, &queued) == 0) {
+        consumed = splicedTotal - std::min<uint64_t>(queued, splicedTotal);
+    }
+#endif
+    while(!inFlight.empty() && inFlight.front().end <= consumed) {
+        AudioBuffer::release(inFlight.front().pcm);
+        inFlight.pop_front();
+    }
+
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    stats.inFlight = inFlight.size();
+}
+
+void FdSink::releaseLater() {
+#ifdef __linux__
+    if(inFlight.empty()) return;
+    //The sink keeps no reference to the descriptor after it is removed, the reaper has its own
+    int fd = fcntl(options.fd, F_DUPFD_CLOEXEC, 0);
+    if(fd < 0) {
+        //They cannot be tracked, they are abandoned to the pipe
+        inFlight.clear();
+        return;
+    }
+
+    SpliceReaper::Entry entry;
+    entry.fd = fd;
+    entry.splicedTotal = splicedTotal;
+    for(auto &chunk: inFlight) {
+        entry.chunks.push_back({ chunk.pcm, chunk.end });
+    }
+    inFlight.clear();
+    SpliceReaper::get().add(std::move(entry));
+#endif
+}
+
+bool FdSink::waitWritable() {
+#ifdef _WIN32
+    return false;
+#else
+    //The descriptor is non blocking, it is polled checking if the sink was removed
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!running) return false;
+        }
+        struct pollfd p = { options.fd, POLLOUT, 0 };
+        int r = poll(&p, 1, pollIntervalMs);
+        releaseConsumed();
+        if(r > 0) return (p.revents & POLLOUT) != 0;
+        if(r < 0 && errno != EINTR) return false;
+    }
+#endif
+}
+
+void FdSink::fail(const std::string &error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    if(splice && offset != 0) {
+        //Partially spliced, the pipe references its first bytes
+        Chunk chunk = queue.front();
+        chunk.end = splicedTotal;
+        inFlight.push_back(chunk);
+        queue.pop_front();
+    }
+    for(auto &chunk: queue) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    queue.clear();
+    offset = 0;
+
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    stats.closed = true;
+    stats.lastError = error;
+}
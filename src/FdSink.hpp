@@ -0,0 +1,82 @@
+#ifndef FD_SINK_H
+#define FD_SINK_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "AudioInput.hpp"
+
+//Writes the captured audio into a file descriptor (a pipe to a child process,
+//a socket...) from its own thread, with one writev for many chunks. On Linux
+//the chunks are spliced into pipes without copying them, and they are kept
+//alive until the reader has consumed them from the pipe.
+class FdSink: public AudioSink {
+public:
+    struct Options {
+        int fd;
+        uint32_t batchBytes;
+        bool zeroCopy;
+    };
+
+    struct Stats {
+        uint64_t bytesWritten;
+        uint64_t splicedBytes;
+        uint64_t writes;
+        uint64_t droppedChunks;
+        uint64_t discontinuities; //Stalls of the device, the stream has no audio for them
+        size_t inFlight; //Spliced chunks not read yet
+        bool zeroCopy;
+        bool closed;
+        std::string lastError;
+    };
+
+    FdSink(const Options &opt, const AudioInput::Options &input);
+    ~FdSink();
+
+    bool start(std::string &error);
+    void getStats(Stats &);
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+        uint64_t end; //For spliced chunks, bytes spliced up to the end of this one
+    };
+
+    static const size_t maxPendingBytes = 16 * 1024 * 1024;
+
+    void run();
+    bool writeChunks();
+    void releaseConsumed();
+    void releaseLater();
+    bool waitWritable();
+    void fail(const std::string &error);
+
+    const Options options;
+    const AudioInput::Options input;
+    int originalFlags = -1; //Restored when the sink is removed, if it was blocking
+    bool splice = false;
+    size_t offset = 0; //Bytes of the first chunk already written
+    uint64_t splicedTotal = 0;
+    std::deque<Chunk> queue;
+    std::deque<Chunk> inFlight;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Chunk> pending;
+    size_t pendingBytes = 0;
+    bool running = false;
+    bool closed = false;
+    std::thread thread;
+
+    std::mutex statsMutex;
+    Stats stats;
+};
+
+#endif
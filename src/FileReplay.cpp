@@ -0,0 +1,154 @@
+#include "FileReplay.hpp"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+//Buffers of the file when `timePerFrame` is not set
+static const uint32_t defaultBufferMs = 10;
+
+static inline uint64_t getLE(const unsigned char* p, int bytes) {
+    uint64_t value = 0;
+    for(int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+FileReplay::FileReplay(const Options &opt, const AudioInput::Options &input, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData):
+    ReplayInput(opt.speed, callback, onEnd, backlog, userData), options(opt), input(input) {
+    frameBytes = input.bitsPerSample / 8 * input.channels;
+    buffer.resize(input.sampleRate * (input.frameDuration != 0 ? input.frameDuration : defaultBufferMs) / 1000 * frameBytes);
+}
+
+FileReplay::~FileReplay() {
+    stop();
+    if(file != nullptr) {
+        fclose(file);
+    }
+}
+
+bool FileReplay::open(std::string &error) {
+    file = fopen(options.path.c_str(), "rb");
+    if(file == nullptr) {
+        error = "Could not open " + options.path + ": " + strerror(errno);
+        return false;
+    }
+
+    fseek64(file, 0, SEEK_END);
+    dataEnd = ftell64(file);
+    fseek64(file, 0, SEEK_SET);
+
+    char magic[12];
+    bool wav = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && (!memcmp(magic, "RIFF", 4) || !memcmp(magic, "RF64", 4)) && !memcmp(magic + 8, "WAVE", 4);
+    if(wav && !readWavHeader(error)) {
+        return false;
+    }
+
+    //Raw files have the format of the input
+    dataEnd = dataStart + (dataEnd - dataStart) / frameBytes * frameBytes;
+    position = dataStart;
+    fseek64(file, dataStart, SEEK_SET);
+    return true;
+}
+
+bool FileReplay::readWavHeader(std::string &error) {
+    uint64_t fileSize = dataEnd;
+    uint64_t ds64DataSize = 0;
+    bool hasFormat = false;
+    unsigned char h[40];
+    while(fread(h, 1, 8, file) == 8) {
+        uint64_t size = getLE(h + 4, 4);
+        uint64_t start = ftell64(file);
+
+        if(!memcmp(h, "ds64", 4) && size >= 16 && fread(h, 1, 16, file) == 16) {
+            ds64DataSize = getLE(h + 8, 8);
+        } else if(!memcmp(h, "fmt ", 4) && size >= 16) {
+            size_t n = fread(h, 1, std::min<uint64_t>(size, sizeof(h)), file);
+            uint16_t format = (uint16_t) getLE(h, 2);
+            //WAVE_FORMAT_EXTENSIBLE has the format at the beginning of the subformat GUID
+            if(format == 0xFFFE && n >= 26) {
+                format = (uint16_t) getLE(h + 24, 2);
+            }
+            uint32_t channels = (uint32_t) getLE(h + 2, 2);
+            uint32_t sampleRate = (uint32_t) getLE(h + 4, 4);
+            uint32_t bitsPerSample = (uint32_t) getLE(h + 14, 2);
+            //32 bit inputs are float, the others are integers
+            bool expectedFormat = input.bitsPerSample == 32 ? format == 3 : format == 1;
+            if(!expectedFormat || channels != input.channels || sampleRate != input.sampleRate || bitsPerSample != input.bitsPerSample) {
+                error = "The format of " + options.path + " (" + std::to_string(sampleRate) + " Hz, " + std::to_string(bitsPerSample)
+                    + (format == 3 ? " bits float, " : " bits, ") + std::to_string(channels) + " channels) is not the one of the input";
+                return false;
+            }
+            unsigned8 = bitsPerSample == 8;
+            hasFormat = true;
+        } else if(!memcmp(h, "data", 4)) {
+            if(!hasFormat) break;
+            dataStart = start;
+            //0 or 0xFFFFFFFF while it is being recorded, or the size is in the ds64 chunk
+            if(size == 0xFFFFFFFF && ds64DataSize != 0) {
+                size = ds64DataSize;
+            }
+            if(size != 0 && size != 0xFFFFFFFF) {
+                dataEnd = std::min(fileSize, dataStart + size);
+            }
+            return true;
+        }
+
+        //Chunks are aligned to 2 bytes
+        fseek64(file, start + size + (size & 1), SEEK_SET);
+    }
+
+    error = "Invalid WAV file " + options.path;
+    return false;
+}
+
+size_t FileReplay::read(char* buffer, size_t frames) {
+    size_t done = 0;
+    while(done < frames) {
+        if(position >= dataEnd) {
+            if(!options.loop || dataEnd <= dataStart) break;
+            fseek64(file, dataStart, SEEK_SET);
+            position = dataStart;
+        }
+
+        size_t wanted = (size_t) std::min<uint64_t>((frames - done) * frameBytes, dataEnd - position);
+        size_t n = fread(buffer + done * frameBytes, 1, wanted, file);
+        n -= n % frameBytes;
+        position += n;
+        done += n / frameBytes;
+        if(n < wanted) {
+            //Shorter than the header says
+            dataEnd = position;
+        }
+    }
+
+    if(unsigned8) {
+        for(size_t i = 0; i < done * frameBytes; i++) {
+            buffer[i] ^= (char) 0x80;
+        }
+    }
+    return done;
+}
+
+bool FileReplay::next(Buffer &next) {
+    size_t framesPerBuffer = buffer.size() / frameBytes;
+    size_t frames = read(buffer.data(), framesPerBuffer);
+    if(frames == 0) return false;
+
+    //Like a device, the audio of a buffer is delivered when it has been captured
+    framesRead += frames;
+    next.pcm = buffer.data();
+    next.frames = frames;
+    next.time = (double) framesRead / input.sampleRate;
+    next.latency = (double) frames / input.sampleRate;
+    return true;
+}
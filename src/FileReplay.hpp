@@ -0,0 +1,50 @@
+#ifndef FILE_REPLAY_H
+#define FILE_REPLAY_H
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "ReplayInput.hpp"
+
+//Input from a WAV or raw PCM file in place of a PortAudio device, to replay
+//recordings and to load the rest of the pipeline on machines without audio
+//hardware.
+class FileReplay: public ReplayInput {
+public:
+    struct Options {
+        std::string path;
+        double speed; //1 is real time, 0 as fast as possible
+        bool loop;
+    };
+
+    FileReplay(const Options &opt, const AudioInput::Options &input, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData);
+    ~FileReplay();
+
+    //Reads the header, the format of a WAV file must be the one of the input
+    bool open(std::string &error) override;
+
+protected:
+    bool next(Buffer &buffer) override;
+    bool isOpen() override { return file != nullptr; }
+
+private:
+    bool readWavHeader(std::string &error);
+    //Fills `frames` from the file, from the beginning again when looping
+    size_t read(char* buffer, size_t frames);
+
+    const Options options;
+    const AudioInput::Options input;
+
+    FILE* file = nullptr;
+    size_t frameBytes;
+    uint64_t dataStart = 0;
+    uint64_t dataEnd = 0;
+    uint64_t position = 0;
+    bool unsigned8 = false; //8 bit WAV samples are unsigned, the ones of the device are signed
+    std::vector<char> buffer;
+    uint64_t framesRead = 0;
+};
+
+#endif
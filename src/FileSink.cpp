@@ -0,0 +1,401 @@
+#include "FileSink.hpp"
+#include "AudioBuffer.hpp"
+#include "dl.hpp"
+#include "Trace.hpp"
+#include "NativeMemory.hpp"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+static const size_t wavHeaderSize = 80;
+
+//libFLAC is loaded when the first FLAC recording starts, like portaudio
+static Library* flacLibrary = nullptr;
+static struct {
+    void* (*encoderNew)(void);
+    int (*setChannels)(void*, unsigned);
+    int (*setBitsPerSample)(void*, unsigned);
+    int (*setSampleRate)(void*, unsigned);
+    int (*setCompressionLevel)(void*, unsigned);
+    int (*initFile)(void*, const char*, void*, void*);
+    int (*processInterleaved)(void*, const int32_t*, unsigned);
+    int (*finish)(void*);
+    void (*encoderDelete)(void*);
+} flacApi;
+
+static bool loadFlacLibrary(std::string &error) {
+    if(flacLibrary != nullptr) return true;
+
+    flacLibrary = Library::load("libFLAC");
+#ifndef WIN32
+    if(flacLibrary == nullptr) flacLibrary = Library::load("libFLAC", "so.12");
+    if(flacLibrary == nullptr) flacLibrary = Library::load("libFLAC", "so.8");
+#endif
+    if(flacLibrary == nullptr) {
+        error = "Could not load native library libFLAC";
+        return false;
+    }
+
+    const char* missing = nullptr;
+    if(!flacLibrary->getSymbol("FLAC__stream_encoder_new", flacApi.encoderNew, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_set_channels", flacApi.setChannels, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_set_bits_per_sample", flacApi.setBitsPerSample, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_set_sample_rate", flacApi.setSampleRate, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_set_compression_level", flacApi.setCompressionLevel, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_init_file", flacApi.initFile, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_process_interleaved", flacApi.processInterleaved, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_finish", flacApi.finish, missing)
+        || !flacLibrary->getSymbol("FLAC__stream_encoder_delete", flacApi.encoderDelete, missing)) {
+        error = std::string("Symbol ") + missing + " not found in libFLAC";
+        delete flacLibrary;
+        flacLibrary = nullptr;
+        return false;
+    }
+    return true;
+}
+
+struct FlacEncoder {
+    void* encoder;
+    std::vector<int32_t> samples;
+    TrackedCapacity trackedBytes;
+};
+
+static inline void putLE(char* p, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) {
+        p[i] = (char) (value >> (8 * i));
+    }
+}
+
+static size_t lcm(size_t a, size_t b) {
+    size_t x = a, y = b;
+    while(y != 0) {
+        size_t t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+
+FileSink::FileSink(const Options &opt, const AudioInput::Options &input): options(opt), input(input) {
+    stats = Stats();
+}
+
+FileSink::~FileSink() {
+    if(running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    input.threads.unlock(staging, batchBytes);
+    NativeMemory::sub(batchBytes);
+    delete[] staging;
+}
+
+bool FileSink::start(std::string &error) {
+    if(options.format == Flac) {
+        if(input.bitsPerSample == 32) {
+            error = "FLAC does not support float samples";
+            return false;
+        }
+        if(!loadFlacLibrary(error)) {
+            return false;
+        }
+    }
+
+    if(!openFile(error)) {
+        return false;
+    }
+
+    //Batches are multiple of the frame size, so a FLAC batch has whole frames, and of the page
+    //size, so the locked staging buffer has no partial page. The writes are not aligned in
+    //the file (the WAV header takes 80 bytes), they go through the page cache
+    size_t frameBytes = input.bitsPerSample / 8 * input.channels;
+    size_t align = lcm(4096, frameBytes);
+    batchBytes = (std::max<size_t>(options.batchBytes, 1) + align - 1) / align * align;
+    staging = new char[batchBytes];
+    NativeMemory::add(batchBytes);
+    input.threads.lock(staging, batchBytes);
+
+    running = true;
+    thread = std::thread(&FileSink::run, this);
+    return true;
+}
+
+void FileSink::getStats(Stats &s) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    s = stats;
+}
+
+void FileSink::push(const void* pcm, uint32_t size, uint64_t, bool discontinuity) {
+    bool wakeUp;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(discontinuity) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.discontinuities++;
+        }
+        if(pendingBytes + size > maxPendingBytes) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.droppedChunks++;
+            return;
+        }
+        AudioBuffer::retain(pcm);
+        pending.push_back({ pcm, size });
+        pendingBytes += size;
+        wakeUp = pendingBytes >= batchBytes;
+    }
+
+    if(wakeUp) {
+        cond.notify_one();
+    }
+}
+
+void FileSink::run() {
+    input.threads.applyToCurrentThread("file sink");
+    TRACE_THREAD_NAME("file sink");
+    uint64_t rotateSecondsBytes = (uint64_t) options.rotateSeconds * input.sampleRate * input.bitsPerSample / 8 * input.channels;
+    std::deque<Chunk> chunks;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        bool stopping = !running;
+        if(!stopping && pendingBytes < batchBytes) {
+            cond.wait_for(lock, std::chrono::seconds(1));
+            stopping = !running;
+        }
+
+        chunks.swap(pending);
+        pendingBytes = 0;
+        lock.unlock();
+
+        for(auto &chunk: chunks) {
+            uint64_t fileBytes = fileDataBytes + stagingBytes;
+            bool rotate = (options.rotateBytes != 0 && fileBytes + chunk.size > options.rotateBytes)
+                || (rotateSecondsBytes != 0 && fileBytes + chunk.size > rotateSecondsBytes);
+            if(rotate && fileBytes != 0) {
+                writeBatch(staging, stagingBytes);
+                stagingBytes = 0;
+                closeFile();
+                reopenFile();
+            } else if(file == nullptr && flac == nullptr && std::chrono::steady_clock::now() >= retryAt) {
+                reopenFile();
+            }
+
+            if(file == nullptr && flac == nullptr) {
+                std::lock_guard<std::mutex> statsLock(statsMutex);
+                stats.lostBytes += chunk.size;
+                AudioBuffer::release(chunk.pcm);
+                continue;
+            }
+
+            const char* data = (const char*) chunk.pcm;
+            size_t left = chunk.size;
+            while(left > 0) {
+                size_t n = std::min(left, batchBytes - stagingBytes);
+                memcpy(staging + stagingBytes, data, n);
+                stagingBytes += n;
+                data += n;
+                left -= n;
+                if(stagingBytes == batchBytes) {
+                    writeBatch(staging, stagingBytes);
+                    stagingBytes = 0;
+                }
+            }
+            AudioBuffer::release(chunk.pcm);
+        }
+        chunks.clear();
+
+        //Data that waited for a full second is written anyway
+        if(stagingBytes != 0) {
+            writeBatch(staging, stagingBytes);
+            stagingBytes = 0;
+        }
+
+        if(stopping) break;
+        lock.lock();
+    }
+
+    closeFile();
+}
+
+std::string FileSink::nextFileName() {
+    if(options.rotateBytes == 0 && options.rotateSeconds == 0) {
+        return options.path;
+    }
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "-%04llu", (unsigned long long) stats.files + 1);
+    size_t dot = options.path.find_last_of('.');
+    size_t slash = options.path.find_last_of("/\\");
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return options.path + suffix;
+    }
+    return options.path.substr(0, dot) + suffix + options.path.substr(dot);
+}
+
+bool FileSink::openFile(std::string &error) {
+    std::string path = nextFileName();
+    fileDataBytes = 0;
+
+    if(options.format == Flac) {
+        flac = new FlacEncoder;
+        flac->encoder = flacApi.encoderNew();
+        flacApi.setChannels(flac->encoder, input.channels);
+        flacApi.setBitsPerSample(flac->encoder, input.bitsPerSample);
+        flacApi.setSampleRate(flac->encoder, input.sampleRate);
+        flacApi.setCompressionLevel(flac->encoder, 5);
+        if(flacApi.initFile(flac->encoder, path.c_str(), nullptr, nullptr) != 0) {
+            flacApi.encoderDelete(flac->encoder);
+            delete flac;
+            flac = nullptr;
+            error = "Could not open " + path;
+            return false;
+        }
+    } else {
+        file = fopen(path.c_str(), "wb");
+        if(file == nullptr) {
+            error = "Could not open " + path + ": " + strerror(errno);
+            return false;
+        }
+        setvbuf(file, nullptr, _IONBF, 0);
+        if(options.format == Wav) {
+            writeWavHeader();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.files++;
+    stats.currentFile = path;
+    return true;
+}
+
+//Opens the next file after a rotation or a failure, the failures are retried with backoff
+bool FileSink::reopenFile() {
+    std::string error;
+    bool ok = openFile(error);
+    if(ok) {
+        retryMs = 0;
+    } else {
+        retryMs = retryMs == 0 ? minRetryMs : retryMs * 2;
+        if(retryMs > maxRetryMs) retryMs = maxRetryMs;
+        retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(retryMs);
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.failed = !ok;
+    if(!ok) {
+        stats.lastError = error;
+    }
+    return ok;
+}
+
+void FileSink::closeFile() {
+    if(flac != nullptr) {
+        flacApi.finish(flac->encoder);
+        flacApi.encoderDelete(flac->encoder);
+        delete flac;
+        flac = nullptr;
+    }
+
+    if(file != nullptr) {
+        if(options.format == Wav) {
+            writeWavHeader();
+        }
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+void FileSink::writeBatch(char* data, size_t size) {
+    if(size == 0 || (file == nullptr && flac == nullptr)) return;
+    TRACE_SCOPE("file write", size);
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok;
+    if(flac != nullptr) {
+        size_t bytesPerSample = input.bitsPerSample / 8;
+        size_t samples = size / bytesPerSample;
+        flac->samples.resize(samples);
+        flac->trackedBytes.update(flac->samples.capacity() * sizeof(int32_t));
+        const uint8_t* s = (const uint8_t*) data;
+        for(size_t i = 0; i < samples; i++, s += bytesPerSample) {
+            if(bytesPerSample == 1) flac->samples[i] = (int8_t) s[0];
+            else if(bytesPerSample == 2) flac->samples[i] = (int16_t) (s[0] | s[1] << 8);
+            else flac->samples[i] = (int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16 | (uint32_t) s[2] << 24) >> 8;
+        }
+        ok = flacApi.processInterleaved(flac->encoder, flac->samples.data(), (unsigned) (samples / input.channels)) != 0;
+        fileDataBytes += size;
+    } else {
+        if(options.format == Wav && input.bitsPerSample == 8) {
+            //8 bit WAV is unsigned
+            for(size_t i = 0; i < size; i++) data[i] ^= (char) 0x80;
+        }
+        ok = fwrite(data, 1, size, file) == size;
+        fileDataBytes += size;
+        if(options.format == Wav) {
+            writeWavHeader();
+        }
+    }
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if(ok) {
+        stats.bytesWritten += size;
+    } else {
+        stats.lostBytes += size;
+        stats.lastError = std::string("Write failed: ") + strerror(errno);
+    }
+    stats.writes++;
+    totalWriteLatency += latency;
+    stats.avgWriteLatency = totalWriteLatency / stats.writes;
+    stats.maxWriteLatency = std::max(stats.maxWriteLatency, latency);
+}
+
+void FileSink::writeWavHeader() {
+    char h[wavHeaderSize];
+    uint64_t riffSize = wavHeaderSize - 8 + fileDataBytes;
+    uint16_t blockAlign = input.bitsPerSample / 8 * input.channels;
+    //The JUNK chunk reserves the space for the ds64 chunk in case the file grows beyond 4GB (RF64)
+    bool rf64 = riffSize > 0xFFFFFFFFull;
+
+    memset(h, 0, sizeof(h));
+    memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+    putLE(h + 4, rf64 ? 0xFFFFFFFF : riffSize, 4);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+    putLE(h + 16, 28, 4);
+    if(rf64) {
+        putLE(h + 20, riffSize, 8);
+        putLE(h + 28, fileDataBytes, 8);
+        putLE(h + 36, fileDataBytes / blockAlign, 8);
+    }
+    memcpy(h + 48, "fmt ", 4);
+    putLE(h + 52, 16, 4);
+    putLE(h + 56, input.bitsPerSample == 32 ? 3 : 1, 2);
+    putLE(h + 58, input.channels, 2);
+    putLE(h + 60, input.sampleRate, 4);
+    putLE(h + 64, input.sampleRate * blockAlign, 4);
+    putLE(h + 68, blockAlign, 2);
+    putLE(h + 70, input.bitsPerSample, 2);
+    memcpy(h + 72, "data", 4);
+    putLE(h + 76, rf64 ? 0xFFFFFFFF : fileDataBytes, 4);
+
+    fseek64(file, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), file);
+    fseek64(file, 0, SEEK_END);
+}
@@ -0,0 +1,96 @@
+#ifndef FILE_SINK_H
+#define FILE_SINK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+#include "AudioInput.hpp"
+
+//Records the captured audio into files from its own writer thread. Chunks
+//are written in big batches and the WAV header is updated after every batch,
+//so the file is valid even if the process dies.
+class FileSink: public AudioSink {
+public:
+    enum Format { Raw, Wav, Flac };
+
+    struct Options {
+        std::string path;
+        Format format;
+        uint64_t rotateBytes;   //0 disables size based rotation
+        uint32_t rotateSeconds; //0 disables time based rotation
+        uint32_t batchBytes;
+    };
+
+    struct Stats {
+        uint64_t bytesWritten;
+        uint64_t writes;
+        uint64_t files;
+        uint64_t droppedChunks;
+        uint64_t discontinuities; //Stalls of the device, the file has no audio for them
+        uint64_t lostBytes;       //Audio that could not be written, or arrived while no file could be opened
+        bool failed;              //The next file could not be opened, it is retried with backoff
+        double avgWriteLatency; //milliseconds
+        double maxWriteLatency;
+        std::string currentFile;
+        std::string lastError;
+    };
+
+    FileSink(const Options &opt, const AudioInput::Options &input);
+    ~FileSink();
+
+    //Opens the first file, it must be called before adding the sink to the input
+    bool start(std::string &error);
+    void getStats(Stats &);
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+    };
+
+    static const size_t maxPendingBytes = 64 * 1024 * 1024;
+    static const uint32_t minRetryMs = 100;
+    static const uint32_t maxRetryMs = 10000;
+
+    void run();
+    bool openFile(std::string &error);
+    bool reopenFile();
+    void closeFile();
+    void writeBatch(char* data, size_t size);
+    void writeWavHeader();
+    std::string nextFileName();
+
+    const Options options;
+    const AudioInput::Options input;
+
+    FILE* file = nullptr;
+    struct FlacEncoder* flac = nullptr;
+    uint64_t fileDataBytes = 0;
+    char* staging = nullptr;
+    size_t stagingBytes = 0;
+    size_t batchBytes = 0;
+    //Backoff of the retries after a file could not be opened
+    uint32_t retryMs = 0;
+    std::chrono::steady_clock::time_point retryAt;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Chunk> pending;
+    size_t pendingBytes = 0;
+    bool running = false;
+    std::thread thread;
+
+    std::mutex statsMutex;
+    Stats stats;
+    double totalWriteLatency = 0.0;
+};
+
+#endif
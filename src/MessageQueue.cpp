@@ -0,0 +1,45 @@
+#include "MessageQueue.hpp"
+#include "AudioBuffer.hpp"
+#include "NativeMemory.hpp"
+#include "Trace.hpp"
+
+MessageQueue::~MessageQueue() {
+    clear();
+}
+
+uint64_t MessageQueue::push(const Message &message) {
+    TRACE_INSTANT("enqueue", message.size);
+    NativeMemory::add(sizeof(Message));
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(message);
+    pendingFrames += message.size / frameBytes;
+    TRACE_COUNTER("message_queue", queue.size());
+    return pendingFrames;
+}
+
+bool MessageQueue::pop(Message &message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(queue.empty()) return false;
+        message = queue.front();
+        queue.pop_front();
+        pendingFrames -= message.size / frameBytes;
+    }
+    NativeMemory::sub(sizeof(Message));
+    return true;
+}
+
+void MessageQueue::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto &message: queue) {
+        AudioBuffer::release(message.pcm);
+        NativeMemory::sub(sizeof(Message));
+    }
+    queue.clear();
+    pendingFrames = 0;
+}
+
+size_t MessageQueue::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
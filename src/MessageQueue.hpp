@@ -0,0 +1,47 @@
+#ifndef MESSAGE_QUEUE_H
+#define MESSAGE_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <mutex>
+
+//Chunks captured for the 'data' event, from the capture thread to the event
+//loop. It owns the chunks until they are popped. It does not depend on Node,
+//so it can be measured by the benchmarks.
+class MessageQueue {
+public:
+    //Events of the input are queued in order with the chunks, without audio
+    enum Type { Data, End, Stall, Recovered };
+
+    struct Message {
+        Message(): Message(nullptr, 0, 0, 0) {}
+        Message(const void* pcm, uint32_t size, uint64_t sample, double pts, Type type = Data, double gap = 0):
+            pcm(pcm), size(size), sample(sample), pts(pts), type(type), gap(gap), discontinuity(false) {}
+
+        const void* pcm;
+        uint32_t size;
+        uint64_t sample;
+        double pts; //ms since the epoch
+        Type type;
+        double gap; //ms without callbacks, for Stall and Recovered
+        bool discontinuity; //Audio is missing before this chunk
+    };
+
+    MessageQueue(uint32_t frameBytes): frameBytes(frameBytes) {}
+    ~MessageQueue();
+
+    //Returns the frames in the queue after adding this chunk
+    uint64_t push(const Message &message);
+    bool pop(Message &message);
+    void clear();
+    size_t size();
+
+private:
+    const uint32_t frameBytes;
+    std::mutex mutex;
+    std::deque<Message> queue;
+    uint64_t pendingFrames = 0;
+};
+
+#endif
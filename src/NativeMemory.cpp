@@ -0,0 +1,4 @@
+#include "NativeMemory.hpp"
+
+std::atomic<int64_t> NativeMemory::allocated{0};
+int64_t NativeMemory::reportedBytes = 0;
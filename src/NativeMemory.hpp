@@ -0,0 +1,47 @@
+#ifndef NATIVE_MEMORY_H
+#define NATIVE_MEMORY_H
+
+#include <stdint.h>
+#include <atomic>
+
+//Counts the memory allocated for audio in native code (chunks, pools, queues,
+//rings...) so it can be reported to V8, which cannot see it otherwise.
+class NativeMemory {
+public:
+    static void add(int64_t bytes) { allocated.fetch_add(bytes, std::memory_order_relaxed); }
+    static void sub(int64_t bytes) { allocated.fetch_sub(bytes, std::memory_order_relaxed); }
+    static int64_t current() { return allocated.load(std::memory_order_relaxed); }
+    static int64_t reported() { return reportedBytes; }
+
+    //Returns the bytes not reported yet, if they are more than `threshold`. Only from the JS thread
+    static int64_t takeDelta(int64_t threshold = 0) {
+        int64_t delta = current() - reportedBytes;
+        if(delta > threshold || delta < -threshold) {
+            reportedBytes += delta;
+            return delta;
+        }
+        return 0;
+    }
+
+private:
+    static std::atomic<int64_t> allocated;
+    static int64_t reportedBytes;
+};
+
+//Keeps track of the capacity of a buffer that grows on demand
+class TrackedCapacity {
+public:
+    ~TrackedCapacity() { NativeMemory::sub(bytes); }
+
+    void update(int64_t capacity) {
+        if(capacity != bytes) {
+            NativeMemory::add(capacity - bytes);
+            bytes = capacity;
+        }
+    }
+
+private:
+    int64_t bytes = 0;
+};
+
+#endif
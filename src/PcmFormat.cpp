@@ -0,0 +1,99 @@
+#include "PcmFormat.hpp"
+#include "PcmKernels.hpp"
+#include <cstring>
+#include <cmath>
+
+static inline float clampSample(float v) {
+    return v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v);
+}
+
+void PcmFormat::toFloat(const void* in, uint8_t bitsPerSample, float* out, size_t samples) {
+    switch(bitsPerSample) {
+        case 8: {
+            const int8_t* s = (const int8_t*) in;
+            for(size_t i = 0; i < samples; i++) out[i] = s[i] / 128.0f;
+            break;
+        }
+        case 16:
+            PcmKernels::get().int16ToFloat((const int16_t*) in, out, samples);
+            break;
+        case 24: {
+            const uint8_t* s = (const uint8_t*) in;
+            for(size_t i = 0; i < samples; i++, s += 3) {
+                int32_t v = (int32_t) ((uint32_t) s[0] << 8 | (uint32_t) s[1] << 16 | (uint32_t) s[2] << 24) >> 8;
+                out[i] = v / 8388608.0f;
+            }
+            break;
+        }
+        case 32:
+            memcpy(out, in, samples * sizeof(float));
+            break;
+    }
+}
+
+void PcmFormat::fromFloat(const float* in, uint8_t bitsPerSample, void* out, size_t samples) {
+    switch(bitsPerSample) {
+        case 8: {
+            int8_t* d = (int8_t*) out;
+            for(size_t i = 0; i < samples; i++) d[i] = (int8_t) lrintf(clampSample(in[i]) * 127.0f);
+            break;
+        }
+        case 16:
+            PcmKernels::get().floatToInt16(in, (int16_t*) out, samples);
+            break;
+        case 24: {
+            uint8_t* d = (uint8_t*) out;
+            for(size_t i = 0; i < samples; i++, d += 3) {
+                int32_t v = (int32_t) lrintf(clampSample(in[i]) * 8388607.0f);
+                d[0] = (uint8_t) v;
+                d[1] = (uint8_t) (v >> 8);
+                d[2] = (uint8_t) (v >> 16);
+            }
+            break;
+        }
+        case 32:
+            memcpy(out, in, samples * sizeof(float));
+            break;
+    }
+}
+
+void PcmFormat::mapChannels(const float* in, uint8_t inChannels, float* out, const std::vector<int> &map, size_t frames) {
+    size_t outChannels = map.size();
+    for(size_t f = 0; f < frames; f++) {
+        for(size_t c = 0; c < outChannels; c++) {
+            int src = map[c];
+            out[f * outChannels + c] = src >= 0 && src < inChannels ? in[f * inChannels + src] : 0.0f;
+        }
+    }
+}
+
+
+Resampler::Resampler(uint32_t inRate, uint32_t outRate, uint8_t channels):
+    inRate(inRate), outRate(outRate), channels(channels), last(channels, 0.0f) {
+    setRatio(1.0);
+}
+
+void Resampler::setRatio(double ratio) {
+    step = (double) inRate / outRate * ratio;
+}
+
+void Resampler::process(const float* in, size_t frames, std::vector<float> &out) {
+    if(frames == 0) return;
+
+    //Positions in [-1, 0) interpolate between the last frame of the previous chunk and the first one
+    while(pos < (double) frames - 1) {
+        long i = (long) std::floor(pos);
+        float frac = (float) (pos - i);
+        const float* a = i < 0 ? last.data() : in + i * channels;
+        const float* b = in + (i + 1) * channels;
+        if(i < 0 && !hasLast) a = b;
+        for(uint8_t c = 0; c < channels; c++) {
+            out.push_back(a[c] + (b[c] - a[c]) * frac);
+        }
+        pos += step;
+    }
+
+    pos -= frames;
+    memcpy(last.data(), in + (frames - 1) * channels, channels * sizeof(float));
+    hasLast = true;
+}
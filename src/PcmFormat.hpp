@@ -0,0 +1,39 @@
+#ifndef PCM_FORMAT_H
+#define PCM_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//Conversions between the interleaved sample formats used by AudioInput
+//(8, 16 and 24 bits signed integer, 32 bits float) and float samples.
+class PcmFormat {
+public:
+    static size_t bytesPerSample(uint8_t bitsPerSample) { return bitsPerSample / 8; }
+    static void toFloat(const void* in, uint8_t bitsPerSample, float* out, size_t samples);
+    static void fromFloat(const float* in, uint8_t bitsPerSample, void* out, size_t samples);
+    //Builds every output channel from the input channel in `map` (-1 means silence)
+    static void mapChannels(const float* in, uint8_t inChannels, float* out, const std::vector<int> &map, size_t frames);
+};
+
+//Linear interpolating sample rate converter that keeps its phase between chunks
+class Resampler {
+public:
+    Resampler(uint32_t inRate, uint32_t outRate, uint8_t channels);
+
+    bool isPassthrough() const { return inRate == outRate && step == 1.0; }
+    void setRatio(double ratio);
+    void process(const float* in, size_t frames, std::vector<float> &out);
+    //Forgets the previous chunk, for input that does not follow it
+    void reset() { pos = 0.0; hasLast = false; }
+
+private:
+    uint32_t inRate, outRate;
+    uint8_t channels;
+    double step;
+    double pos = 0.0;
+    bool hasLast = false;
+    std::vector<float> last;
+};
+
+#endif
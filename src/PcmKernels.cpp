@@ -0,0 +1,76 @@
+#include "PcmKernels.hpp"
+#include <atomic>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+    bool cpuSupports(const PcmKernelSet* kernels) {
+        if(kernels == nullptr) return false;
+        std::string level = kernels->level;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool sse2 = (info[3] & (1 << 26)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        //The OS has to save the extended registers on context switches
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        bool avx2 = false, avx512 = false;
+        if(maxLeaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+            avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+        }
+        if(level == "sse2") return sse2;
+        if(level == "avx2") return avx2;
+        if(level == "avx512") return avx512;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+        if(level == "sse2") return __builtin_cpu_supports("sse2");
+        if(level == "avx2") return __builtin_cpu_supports("avx2");
+        if(level == "avx512") return __builtin_cpu_supports("avx512f");
+#endif
+        //NEON is part of the base aarch64 instruction set
+        if(level == "neon") return true;
+        return false;
+    }
+
+    //From the best to the worst
+    std::vector<const PcmKernelSet*> supported() {
+        std::vector<const PcmKernelSet*> result;
+        for(const PcmKernelSet* kernels: { pcmKernelsAvx512, pcmKernelsAvx2, pcmKernelsSse2, pcmKernelsNeon }) {
+            if(cpuSupports(kernels)) result.push_back(kernels);
+        }
+        result.push_back(&pcmKernelsScalar);
+        return result;
+    }
+
+    std::atomic<const PcmKernelSet*>& current() {
+        static std::atomic<const PcmKernelSet*> kernels(supported().front());
+        return kernels;
+    }
+}
+
+const PcmKernelSet& PcmKernels::get() {
+    return *current().load(std::memory_order_relaxed);
+}
+
+std::vector<std::string> PcmKernels::available() {
+    std::vector<std::string> result;
+    for(const PcmKernelSet* kernels: supported()) result.push_back(kernels->level);
+    return result;
+}
+
+bool PcmKernels::setLevel(const std::string &level) {
+    for(const PcmKernelSet* kernels: supported()) {
+        if(level == kernels->level) {
+            current().store(kernels, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,41 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+//Hot loops of the sample conversion, gain and metering. Every instruction
+//set has its own implementation in src/kernels, all of them are compiled in
+//the same binary and the best one supported by the CPU is chosen at load.
+struct PcmKernelSet {
+    const char* level;
+    void (*int16ToFloat)(const int16_t* in, float* out, size_t samples);
+    void (*floatToInt16)(const float* in, int16_t* out, size_t samples);
+    void (*scale)(float* data, float gain, size_t samples);
+    float (*peak)(const float* data, size_t samples);
+};
+
+class PcmKernels {
+public:
+    static const PcmKernelSet& get();
+    static std::vector<std::string> available();
+    //Forces an instruction set (for benchmarks), returns false if it is not supported
+    static bool setLevel(const std::string &level);
+};
+
+//Implementations, they are null if they are not supported in the platform
+extern const PcmKernelSet pcmKernelsScalar;
+extern const PcmKernelSet* pcmKernelsSse2;
+extern const PcmKernelSet* pcmKernelsAvx2;
+extern const PcmKernelSet* pcmKernelsAvx512;
+extern const PcmKernelSet* pcmKernelsNeon;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+#endif
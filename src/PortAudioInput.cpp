@@ -1,21 +1,164 @@
 #include "AudioInput.hpp"
 #include "portaudio.h"
-#include <nan.h>
 #include "dl.hpp"
+#include "AudioBuffer.hpp"
+#include "Trace.hpp"
+#include "SampleClock.hpp"
+#include "FileReplay.hpp"
+#include "CallbackTrace.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
 
 #ifdef _WIN32
 extern "C" int PaWasapi_IsLoopback(PaDeviceIndex deviceId);
 #endif
 
 struct private_data {
+    private_data(uint32_t sampleRate): clock(sampleRate) {}
+
     PaStream* stream = nullptr;
+    ReplayInput* replay = nullptr;
+    PaDeviceIndex device = -1;
+    std::atomic<bool> isOpened{false};
     bool isPaused = false;
+    //Soft pause keeps the stream running and drops the audio in the callback
+    std::atomic<bool> isSoftPaused{false};
+    bool droppingSoftPause = false; //Only used by the callback
+
+    std::mutex sinksMutex;
+    std::vector<AudioSink*> sinks;
+
+    std::atomic<uint64_t> callbacks{0};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> inputOverflows{0};
+    std::atomic<uint64_t> inputUnderflows{0};
+    std::atomic<uint64_t> maxCallbackNs{0};
+    std::atomic<uint64_t> droppedFrames{0};
+
+    //Reblocking into chunks of exactly `framesPerChunk` frames
+    BufferPool* pool = nullptr;
+    char* partial = nullptr;
+    size_t partialBytes = 0;
+    uint64_t partialSample = 0;
+
+    SampleClock clock;
+    //Set by the first callback after a stall, until the next chunk reaches the sinks
+    bool discontinuity = false;
+
+    //The callback reads the writer without locking, it is deleted once no callback is using it
+    std::mutex callbackTraceMutex; //Start and stop
+    std::atomic<CallbackTraceWriter*> callbackTrace{nullptr};
+    std::atomic<int> callbacksTracing{0};
+
+    //Watchdog of the callbacks. The stream is opened and closed under `streamMutex`,
+    //by the JS thread or by the watchdog when the device stalls
+    std::mutex streamMutex;
+    std::atomic<double> lastCallback{0};
+    std::atomic<bool> stalled{false};    //Until the first callback of the reopened stream
+    std::atomic<bool> recovering{false}; //A reopened stream has not called back yet
+    double stalledAt = 0;                //Time of the last callback before the stall
+    size_t deviceIndex = 0;              //In the device and then the fallbacks
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> recoveries{0};
+    std::mutex watchdogMutex;
+    std::condition_variable watchdogCond;
+    bool watchdogRunning = false;
+    bool watchdogDone = false;
+    bool watchdogOrphaned = false;
+    std::thread watchdog;
+    //Stalled streams still being closed, their callback can still come until then
+    std::atomic<int> closingStreams{0};
+
+    //Snapshot of the stream for getStreamInfo(), updated when it is (re)opened
+    std::mutex infoMutex;
+    AudioInput::StreamInfo info;
+    bool hasInfo = false;
 };
 
+//The watchdog checks the callbacks 4 times per timeout, within these bounds
+static const uint32_t minWatchdogIntervalMs = 5;
+static const uint32_t maxWatchdogIntervalMs = 100;
+//close() waits this long for the watchdog, which can be stuck in a driver call that does not return
+static const int watchdogStopTimeoutMs = 1000;
+//The chunks of `framesPerChunk` are preallocated for this much audio, JS and the sinks hold
+//them until they are done. The callback drops audio when all of them are in use
+static const uint32_t chunkPoolSeconds = 4;
+static const size_t minChunkPoolSize = 16;
+
 static Library* portaudio = nullptr;
+static AudioInput::ErrorHandler errorHandler = nullptr;
+
+//PortAudio is not thread safe: streams are opened, started and closed from the
+//JS thread and from the watchdogs, and the devices can be rescanned meanwhile
+static std::recursive_mutex portaudioMutex;
+//Inputs with a PortAudio stream, the devices are rescanned when there are none
+static int openInputs = 0;
+//Stalled streams being closed by a detached thread, which does not hold `portaudioMutex`
+static int closingStreams = 0;
+static bool refreshPending = false;
+static AudioInput::DevicesChangedCallback devicesChangedCbk = nullptr;
 static bool loadLibrary(std::string path = "");
 static void unloadLibrary();
 
+static void reportError(const char* error) {
+    if(errorHandler != nullptr) {
+        errorHandler(error);
+    } else {
+        fprintf(stderr, "[PortAudio]: %s\n", error);
+    }
+}
+
+static void reblock(AudioInput* self, const char* input, size_t bytes, uint64_t sample) {
+    private_data* data = self->self;
+    size_t chunkBytes = data->pool->bufferSize();
+    size_t frameBytes = self->options.bitsPerSample / 8 * self->options.channels;
+    size_t consumed = 0;
+    if(data->partial != nullptr && sample != data->partialSample + data->partialBytes / frameBytes) {
+        //Audio is missing, the chunk is not completed with the audio after the gap
+        AudioBuffer::release(data->partial);
+        data->partial = nullptr;
+        data->discontinuity = true;
+    }
+    while(bytes > 0) {
+        if(data->partial == nullptr) {
+            data->partial = data->pool->acquire();
+            if(data->partial == nullptr && data->replay != nullptr) {
+                //Not the audio callback, a replay does not lose audio
+                data->partial = AudioBuffer::alloc(chunkBytes);
+            }
+            if(data->partial == nullptr) {
+                //Nothing is allocated in the audio callback, the next chunk starts after the gap
+                data->droppedFrames += bytes / frameBytes;
+                data->discontinuity = true;
+                return;
+            }
+            data->partialBytes = 0;
+            data->partialSample = sample + consumed / frameBytes;
+        }
+
+        size_t n = std::min(bytes, chunkBytes - data->partialBytes);
+        memcpy(data->partial + data->partialBytes, input, n);
+        data->partialBytes += n;
+        input += n;
+        bytes -= n;
+        consumed += n;
+
+        if(data->partialBytes == chunkBytes) {
+            char* chunk = data->partial;
+            data->partial = nullptr;
+            self->callCallback(chunkBytes, chunk, data->partialSample);
+        }
+    }
+}
+
 int stream_cbk(const void *input,
                void *output,
                unsigned long frameCount,
@@ -24,25 +167,28 @@ int stream_cbk(const void *input,
                void *userData);
 
 void AudioInput::staticInit(std::string path) {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
     if(portaudio == nullptr) {
         if(loadLibrary(path)) {
             int err = Pa_Initialize();
             if(err != paNoError) {
-                Nan::ThrowError(Pa_GetErrorText(err));
+                reportError(Pa_GetErrorText(err));
             }
         } else if(!path.empty()) {
             auto errStr = "Could not load native library: " + Library::getLastError() + " - " + path;
-            Nan::ThrowError(errStr.c_str());
+            reportError(errStr.c_str());
         }
     } else {
-        Nan::ThrowError("Library 'portaudio' has already been loaded");
+        reportError("Library 'portaudio' has already been loaded");
     }
 }
 
 void AudioInput::staticDeinit() {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+    if(portaudio == nullptr) return;
     int err = Pa_Terminate();
     if(err != paNoError) {
-        Nan::ThrowError(Pa_GetErrorText(err));
+        reportError(Pa_GetErrorText(err));
     }
     unloadLibrary();
 }
@@ -51,10 +197,15 @@ bool AudioInput::isLoaded() {
     return portaudio != nullptr;
 }
 
+void AudioInput::setErrorHandler(ErrorHandler handler) {
+    errorHandler = handler;
+}
+
 void AudioInput::getInputDevices(std::vector<std::string> &list) {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
     int numDevices = Pa_GetDeviceCount();
     if(numDevices < 0) {
-        Nan::ThrowError(Pa_GetErrorText(numDevices));
+        reportError(Pa_GetErrorText(numDevices));
         return;
     }
 
@@ -72,25 +223,133 @@ void AudioInput::getInputDevices(std::vector<std::string> &list) {
     }
 }
 
+void AudioInput::setDevicesChangedCallback(DevicesChangedCallback cbk) {
+    devicesChangedCbk = cbk;
+}
+
+//Called with `portaudioMutex` locked and no stream open
+static bool rescanDevices(std::vector<std::string> &added, std::vector<std::string> &removed) {
+    std::vector<std::string> before, after;
+    AudioInput::getInputDevices(before);
+    int err = Pa_Terminate();
+    if(err == paNoError) {
+        err = Pa_Initialize();
+    }
+    if(err != paNoError) {
+        reportError(Pa_GetErrorText(err));
+        return false;
+    }
+    AudioInput::getInputDevices(after);
+
+    //Several devices can have the same name, they are compared as multisets
+    std::sort(before.begin(), before.end());
+    std::sort(after.begin(), after.end());
+    std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(added));
+    std::set_difference(before.begin(), before.end(), after.begin(), after.end(), std::back_inserter(removed));
+    return !added.empty() || !removed.empty();
+}
+
+bool AudioInput::refreshDevices() {
+    if(portaudio == nullptr) {
+        reportError("Native library is not loaded");
+        return false;
+    }
+
+    std::vector<std::string> added, removed;
+    {
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        if(openInputs > 0 || closingStreams > 0) {
+            refreshPending = true;
+            return false;
+        }
+        refreshPending = false;
+        if(!rescanDevices(added, removed)) return true;
+    }
+    if(devicesChangedCbk) {
+        devicesChangedCbk(added, removed);
+    }
+    return true;
+}
+
+void AudioInput::cancelRefreshDevices() {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+    refreshPending = false;
+}
+
+//A PortAudio input was closed, a deferred refresh is done after the last one
+static void releaseDevices() {
+    std::vector<std::string> added, removed;
+    {
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        openInputs--;
+        if(openInputs > 0 || closingStreams > 0 || !refreshPending) return;
+        refreshPending = false;
+        if(!rescanDevices(added, removed)) return;
+    }
+    if(devicesChangedCbk) {
+        devicesChangedCbk(added, removed);
+    }
+}
+
 const char* AudioInput::errorCodeToString(int code) {
+    //Inputs that replay a file work without the library
+    if(portaudio == nullptr) return code == paNoError ? "Success" : "Native library is not loaded";
     return Pa_GetErrorText(code);
 }
 
-static inline int searchDeviceId(const char* devName) {
+static bool containsNoCase(const std::string &text, const std::string &part) {
+    auto it = std::search(text.begin(), text.end(), part.begin(), part.end(), [](char a, char b) {
+        return tolower((unsigned char) a) == tolower((unsigned char) b);
+    });
+    return it != text.end();
+}
+
+//Position of the host API in the preferences, the others go after all of them
+static size_t hostApiRank(PaHostApiIndex index, const std::vector<std::string> &hostApis) {
+    const PaHostApiInfo* hostApi = Pa_GetHostApiInfo(index);
+    for(size_t i = 0; hostApi != nullptr && i < hostApis.size(); i++) {
+        if(containsNoCase(hostApi->name, hostApis[i])) {
+            return i;
+        }
+    }
+    return hostApis.size();
+}
+
+int AudioInput::findDevice(const char* devName, const std::vector<std::string> &hostApis) {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
     if(devName != nullptr) {
         int numDevices = Pa_GetDeviceCount();
         std::string name = devName;
+        int found = -1;
+        size_t foundRank = 0;
         for(int i = 0; i < numDevices; i++) {
             const PaDeviceInfo* device = Pa_GetDeviceInfo(i);
             if(device->maxInputChannels > 0) {
                 if(name.find(device->name) != std::string::npos) {
-                    return i;
+                    if(hostApis.empty()) {
+                        return i;
+                    }
+                    size_t rank = hostApiRank(device->hostApi, hostApis);
+                    if(found < 0 || rank < foundRank) {
+                        found = i;
+                        foundRank = rank;
+                    }
                 }
             }
         }
 
-        return -1;
+        return found;
     } else {
+        //The default device of the first preferred host API that has one
+        PaHostApiIndex count = hostApis.empty() ? 0 : Pa_GetHostApiCount();
+        for(size_t rank = 0; rank < hostApis.size(); rank++) {
+            for(PaHostApiIndex i = 0; i < count; i++) {
+                const PaHostApiInfo* hostApi = Pa_GetHostApiInfo(i);
+                if(hostApi != nullptr && hostApi->defaultInputDevice >= 0 && hostApiRank(i, hostApis) == rank) {
+                    return hostApi->defaultInputDevice;
+                }
+            }
+        }
         return Pa_GetDefaultInputDevice();
     }
 }
@@ -105,90 +364,514 @@ static inline int bitsPerSampleToSampleFormat(int bitsPerSample) {
     }
 }
 
-void AudioInput::selfInit() {
-    if(portaudio == nullptr) {
-        Nan::ThrowError("Native library is not loaded. Load it using AudioInput.loadNativeLibrary(\"pathToLibrary\");");
-        return;
+static void replayEnded(void* userData) {
+    AudioInput* self = (AudioInput*) userData;
+    if(self->endCbk) {
+        self->endCbk(self->userData);
     }
+}
 
-    self = new private_data;
+static size_t replayBacklog(void* userData) {
+    AudioInput* self = (AudioInput*) userData;
+    return self->backlogCbk ? self->backlogCbk(self->userData) : 0;
+}
 
+//Opens a stream of `input` on `devName`, without starting it
+static bool openStream(AudioInput* input, const char* devName, PaStream** stream, PaDeviceIndex &deviceIndex, std::string &error) {
+    const AudioInput::Options &options = input->options;
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
     PaStreamParameters params;
     memset(&params, 0, sizeof(params));
 
     params.channelCount = options.channels;
-    params.device = searchDeviceId(options.devName);
+    params.device = AudioInput::findDevice(devName, options.hostApis);
+    if(params.device < 0) {
+        error = "Device not found";
+        return false;
+    }
+    const PaDeviceInfo* device = Pa_GetDeviceInfo(params.device);
     params.sampleFormat = bitsPerSampleToSampleFormat(options.bitsPerSample);
-    params.suggestedLatency = Pa_GetDeviceInfo(params.device)->defaultLowInputLatency;
+    if(options.latency > 0) {
+        params.suggestedLatency = options.latency / 1000;
+    } else {
+        params.suggestedLatency = options.latency < 0 ? device->defaultHighInputLatency : device->defaultLowInputLatency;
+    }
+    PaStreamFlags flags = paNoFlag;
+    if(options.clipOff) flags |= paClipOff;
+    if(options.ditherOff) flags |= paDitherOff;
 
     if(Pa_IsFormatSupported(&params, nullptr, options.sampleRate) != paNoError) {
-        Nan::ThrowError("Unsupported audio format");
-        return;
+        error = "Unsupported audio format";
+        return false;
     }
 
     int err = Pa_OpenStream(
-        &self->stream,
+        stream,
         &params,
         nullptr,
         options.sampleRate,
         options.frameDuration != 0 ? options.sampleRate * options.frameDuration / 1000 : paFramesPerBufferUnspecified,
-        paNoFlag,
+        flags,
         stream_cbk,
-        (void*) this
+        (void*) input
     );
     if(err != paNoError) {
-        Nan::ThrowError(Pa_GetErrorText(err));
+        *stream = nullptr;
+        error = Pa_GetErrorText(err);
+        return false;
+    }
+    deviceIndex = params.device;
+    return true;
+}
+
+//Kept for getStreamInfo(), which must not wait for the PortAudio calls of the watchdog
+static void updateStreamInfo(private_data* data, PaStream* stream, PaDeviceIndex deviceIndex) {
+    AudioInput::StreamInfo info;
+    bool valid = false;
+    if(stream != nullptr) {
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        const PaStreamInfo* streamInfo = Pa_GetStreamInfo(stream);
+        const PaDeviceInfo* device = Pa_GetDeviceInfo(deviceIndex);
+        if(streamInfo != nullptr && device != nullptr) {
+            const PaHostApiInfo* hostApi = Pa_GetHostApiInfo(device->hostApi);
+            info.device = device->name;
+            info.hostApi = hostApi != nullptr ? hostApi->name : "";
+            info.inputLatency = streamInfo->inputLatency * 1000;
+            info.sampleRate = streamInfo->sampleRate;
+            valid = true;
+        }
     }
+
+    std::lock_guard<std::mutex> lock(data->infoMutex);
+    data->info = info;
+    data->hasInfo = valid;
+}
+
+static void closeStream(PaStream* stream) {
+    std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+    Pa_AbortStream(stream);
+    Pa_CloseStream(stream);
+}
+
+//The driver of a stalled stream can hang in the abort or the close: they are done by a detached
+//thread without `portaudioMutex`, so the JS thread and the other inputs do not wait for them
+static void closeStalledStream(private_data* data, PaStream* stream) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        closingStreams++;
+    }
+    data->closingStreams++;
+    std::thread([data, stream] {
+        Pa_AbortStream(stream);
+        Pa_CloseStream(stream);
+        //Last use of `data`, the input can be freed after it
+        data->closingStreams--;
+        //A refresh deferred meanwhile waits for the next refreshDevices() or close(), in the JS thread
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        closingStreams--;
+    }).detach();
+}
+
+static bool watchdogStopping(private_data* data) {
+    std::lock_guard<std::mutex> lock(data->watchdogMutex);
+    return !data->watchdogRunning;
+}
+
+//Called by the watchdog, the stream is reopened if there was no callback for the timeout: on the same
+//device, then on the fallbacks, and its first callback reports the recovery. The stream is taken out
+//of `streamMutex` and closed by closeStalledStream, so the JS thread does not wait for a driver that hangs
+static void recoverStream(AudioInput* input, double timeout) {
+    private_data* data = input->self;
+    PaStream* stalledStream;
+    size_t first;
+    {
+        std::lock_guard<std::mutex> lock(data->streamMutex);
+        double now = SampleClock::now();
+        double last = data->lastCallback;
+        if(data->isPaused || !data->isOpened || now - last < timeout) return;
+
+        if(!data->stalled) {
+            data->stalled = true;
+            data->stalledAt = last;
+            data->stalls++;
+            TRACE_INSTANT("stall", (int64_t) ((now - last) * 1000));
+            if(input->stallCbk) {
+                input->stallCbk(false, (now - last) * 1000, 0, input->userData);
+            }
+        }
+        //A reopened stream that never called back, the next device is tried first
+        first = data->recovering.exchange(false) ? data->deviceIndex + 1 : data->deviceIndex;
+        stalledStream = data->stream;
+        data->stream = nullptr;
+    }
+    updateStreamInfo(data, nullptr, -1);
+    if(stalledStream != nullptr) {
+        closeStalledStream(data, stalledStream);
+    }
+
+    std::vector<const char*> devices(1, input->options.devName);
+    for(auto &name: input->options.fallbackDevices) {
+        devices.push_back(name.c_str());
+    }
+    for(size_t i = 0; i < devices.size(); i++) {
+        //close() could have stopped waiting for a call that hung, `input` may be gone
+        if(watchdogStopping(data)) return;
+        size_t index = (first + i) % devices.size();
+        PaStream* stream;
+        PaDeviceIndex device;
+        std::string error;
+        if(!openStream(input, devices[index], &stream, device, error)) continue;
+        if(watchdogStopping(data)) {
+            closeStream(stream);
+            return;
+        }
+
+        data->recovering = true;
+        data->lastCallback = SampleClock::now();
+        int err;
+        {
+            std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+            err = Pa_StartStream(stream);
+        }
+        if(err != paNoError) {
+            data->recovering = false;
+            closeStream(stream);
+            continue;
+        }
+        updateStreamInfo(data, stream, device);
+
+        std::lock_guard<std::mutex> lock(data->streamMutex);
+        if(!data->isOpened) {
+            //Closed meanwhile
+            data->recovering = false;
+            closeStream(stream);
+            return;
+        }
+        data->stream = stream;
+        data->device = device;
+        data->deviceIndex = index;
+        if(data->isPaused) {
+            std::lock_guard<std::recursive_mutex> paLock(portaudioMutex);
+            Pa_StopStream(stream);
+        }
+        return;
+    }
+    //None could be opened, they are tried again after another timeout
+    data->lastCallback = SampleClock::now();
+}
+
+static void runWatchdog(AudioInput* input) {
+    TRACE_THREAD_NAME("watchdog");
+    private_data* data = input->self;
+    double timeout = input->options.stallTimeout / 1000.0;
+    uint32_t intervalMs = std::max(minWatchdogIntervalMs, std::min(maxWatchdogIntervalMs, input->options.stallTimeout / 4));
+    std::unique_lock<std::mutex> lock(data->watchdogMutex);
+    while(data->watchdogRunning) {
+        data->watchdogCond.wait_for(lock, std::chrono::milliseconds(intervalMs));
+        if(!data->watchdogRunning) break;
+        lock.unlock();
+        recoverStream(input, timeout);
+        lock.lock();
+    }
+    data->watchdogDone = true;
+    data->watchdogCond.notify_all();
+}
+
+//Returns false if the watchdog is stuck in a driver, then it is left running and `self` must not be freed
+static bool stopWatchdog(private_data* data) {
+    if(!data->watchdog.joinable()) return true;
+    std::unique_lock<std::mutex> lock(data->watchdogMutex);
+    data->watchdogRunning = false;
+    data->watchdogCond.notify_all();
+    if(!data->watchdogCond.wait_for(lock, std::chrono::milliseconds(watchdogStopTimeoutMs), [data] { return data->watchdogDone; })) {
+        lock.unlock();
+        data->watchdog.detach();
+        data->watchdogOrphaned = true;
+        reportError("The watchdog is stuck in the driver, the input is not freed");
+        return false;
+    }
+    lock.unlock();
+    data->watchdog.join();
+    return true;
+}
+
+void AudioInput::selfInit() {
+    bool isReplay = options.inputFile != nullptr || options.callbackTrace != nullptr;
+    if(portaudio == nullptr && !isReplay) {
+        reportError("Native library is not loaded. Load it using AudioInput.loadNativeLibrary(\"pathToLibrary\");");
+        return;
+    }
+
+    uint64_t chunkBytes = (uint64_t) options.framesPerChunk * (options.bitsPerSample / 8) * options.channels;
+    if(chunkBytes > maxChunkBytes) {
+        reportError("framesPerChunk is too large, chunks are limited to 16 MiB");
+        return;
+    }
+
+    self = new private_data(options.sampleRate);
+    if(options.framesPerChunk != 0) {
+        size_t count = std::max(minChunkPoolSize, (size_t) ((uint64_t) options.sampleRate * chunkPoolSeconds / options.framesPerChunk + 1));
+        self->pool = BufferPool::create((size_t) chunkBytes, count);
+    }
+
+    if(isReplay) {
+        std::string error;
+        if(options.inputFile != nullptr) {
+            FileReplay::Options replayOptions = { options.inputFile, options.inputSpeed, options.inputLoop };
+            self->replay = new FileReplay(replayOptions, options, stream_cbk, replayEnded, replayBacklog, this);
+        } else {
+            CallbackTraceReplay::Options replayOptions = { options.callbackTrace, options.inputSpeed, options.inputLoop };
+            self->replay = new CallbackTraceReplay(replayOptions, options, stream_cbk, replayEnded, replayBacklog, this);
+        }
+        if(!self->replay->open(error)) {
+            delete self->replay;
+            self->replay = nullptr;
+            reportError(error.c_str());
+            return;
+        }
+        self->isOpened = true;
+        return;
+    }
+
+    std::string error;
+    {
+        std::lock_guard<std::recursive_mutex> lock(portaudioMutex);
+        if(!openStream(this, options.devName, &self->stream, self->device, error)) {
+            reportError(error.c_str());
+            return;
+        }
+        openInputs++;
+    }
+    updateStreamInfo(self, self->stream, self->device);
+    self->isOpened = true;
 }
 
 int AudioInput::open() {
-    return Pa_StartStream(self->stream);
+    if(options.inputFile != nullptr || options.callbackTrace != nullptr) {
+        std::string error;
+        if(self->replay == nullptr || !self->replay->start(error)) {
+            return paBadStreamPtr;
+        }
+        return paNoError;
+    }
+
+    std::lock_guard<std::mutex> lock(self->streamMutex);
+    self->lastCallback = SampleClock::now();
+    int err;
+    {
+        std::lock_guard<std::recursive_mutex> paLock(portaudioMutex);
+        err = Pa_StartStream(self->stream);
+    }
+    if(err == paNoError && options.stallTimeout != 0 && !self->watchdog.joinable() && !self->watchdogOrphaned) {
+        self->watchdogRunning = true;
+        self->watchdogDone = false;
+        self->watchdog = std::thread(runWatchdog, this);
+    }
+    return err;
 }
 
-void AudioInput::pause() {
+void AudioInput::pause(bool soft) {
+    if(self->isSoftPaused) {
+        self->isSoftPaused = false;
+        return;
+    } else if(soft && !self->isPaused) {
+        self->isSoftPaused = true;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(self->streamMutex);
     int err;
-    if(self->isPaused) {
+    if(self->replay != nullptr) {
+        std::string error;
+        err = paNoError;
+        if(self->isPaused) {
+            self->replay->start(error);
+        } else {
+            self->replay->stop();
+        }
+    } else if(self->stream == nullptr) {
+        //Stalled and not reopened yet, the watchdog keeps trying after the pause
+        err = paNoError;
+    } else if(self->isPaused) {
+        std::lock_guard<std::recursive_mutex> paLock(portaudioMutex);
         err = Pa_StartStream(self->stream);
     } else {
+        std::lock_guard<std::recursive_mutex> paLock(portaudioMutex);
         err = Pa_StopStream(self->stream);
     }
+    //The first callback after a restart can take a while
+    self->lastCallback = SampleClock::now();
 
     if(err != paNoError) {
-        Nan::ThrowError(Pa_GetErrorText(err));
+        reportError(Pa_GetErrorText(err));
     } else {
         self->isPaused = !self->isPaused;
     }
 }
 
 void AudioInput::close() {
-    int err = Pa_AbortStream(self->stream);
-    if(err != paNoError) {
-        Nan::ThrowError(Pa_GetErrorText(err));
+    if(self == nullptr) return;
+    if(self->replay != nullptr) {
+        delete self->replay;
+        self->replay = nullptr;
+        self->isOpened = false;
         return;
     }
-    err = Pa_CloseStream(self->stream);
-    if(err != paNoError) {
-        Nan::ThrowError(Pa_GetErrorText(err));
-        return;
+
+    stopWatchdog(self);
+    {
+        std::lock_guard<std::mutex> lock(self->streamMutex);
+        if(!self->isOpened.exchange(false)) return;
+        bool stalled = self->stalled.exchange(false);
+        self->recovering = false;
+        if(self->stream != nullptr && stalled) {
+            //Reopened after a stall and never called back, it can hang like the stalled one
+            closeStalledStream(self, self->stream);
+            self->stream = nullptr;
+        } else if(self->stream != nullptr) {
+            std::lock_guard<std::recursive_mutex> paLock(portaudioMutex);
+            int err = Pa_AbortStream(self->stream);
+            if(err == paNoError) {
+                err = Pa_CloseStream(self->stream);
+            }
+            if(err != paNoError) {
+                reportError(Pa_GetErrorText(err));
+            } else {
+                self->stream = nullptr;
+            }
+        }
     }
-    self->stream = nullptr;
+    updateStreamInfo(self, nullptr, -1);
+    releaseDevices();
 }
 
 bool AudioInput::isOpen() {
-    return self->stream != nullptr;
+    //Also while the watchdog reopens a stalled stream
+    return self != nullptr && self->isOpened;
 }
 
 bool AudioInput::isPaused() {
-    return self->isPaused;
+    if(self == nullptr) return false;
+    return self->isPaused || self->isSoftPaused;
+}
+
+void AudioInput::getStats(Stats &stats) {
+    stats.callbacks = self->callbacks;
+    stats.frames = self->frames;
+    stats.inputOverflows = self->inputOverflows;
+    stats.inputUnderflows = self->inputUnderflows;
+    stats.maxCallbackTime = self->maxCallbackNs / 1000.0;
+    stats.droppedFrames = self->droppedFrames;
+    stats.stalls = self->stalls;
+    stats.recoveries = self->recoveries;
+}
+
+SampleClock& AudioInput::getClock() {
+    return self->clock;
+}
+
+bool AudioInput::getStreamInfo(StreamInfo &info) {
+    std::lock_guard<std::mutex> lock(self->infoMutex);
+    if(!self->hasInfo) return false;
+    info = self->info;
+    return true;
+}
+
+bool AudioInput::startCallbackTrace(const std::string &path, std::string &error) {
+    std::lock_guard<std::mutex> lock(self->callbackTraceMutex);
+    if(self->callbackTrace != nullptr) {
+        error = "The callbacks are already being recorded";
+        return false;
+    }
+
+    CallbackTraceWriter* writer = new CallbackTraceWriter(options);
+    if(!writer->start(path, error)) {
+        delete writer;
+        return false;
+    }
+    self->callbackTrace = writer;
+    return true;
+}
+
+bool AudioInput::stopCallbackTrace(uint64_t &recorded, uint64_t &dropped) {
+    CallbackTraceWriter* writer;
+    {
+        std::lock_guard<std::mutex> lock(self->callbackTraceMutex);
+        writer = self->callbackTrace.exchange(nullptr);
+    }
+    if(writer == nullptr) return false;
+    //A callback that loaded the writer before the exchange is still recording
+    while(self->callbacksTracing.load() != 0) {
+        std::this_thread::yield();
+    }
+
+    writer->finish();
+    recorded = writer->recorded();
+    dropped = writer->dropped();
+    delete writer;
+    return true;
+}
+
+void AudioInput::addSink(AudioSink* sink) {
+    std::lock_guard<std::mutex> lock(self->sinksMutex);
+    self->sinks.push_back(sink);
+}
+
+void AudioInput::removeSink(AudioSink* sink) {
+    std::lock_guard<std::mutex> lock(self->sinksMutex);
+    auto pos = std::find(self->sinks.begin(), self->sinks.end(), sink);
+    if(pos != self->sinks.end()) {
+        self->sinks.erase(pos);
+    }
+}
+
+void AudioInput::callCallback(uint32_t size, const void* pcm, uint64_t sample) {
+    bool discontinuity = self->discontinuity;
+    self->discontinuity = false;
+    {
+        //Sinks retain the chunk before the callback takes ownership of it
+        std::lock_guard<std::mutex> lock(self->sinksMutex);
+        for(AudioSink* sink: self->sinks) {
+            sink->push(pcm, size, sample, discontinuity);
+        }
+    }
+
+    if(cbk) {
+        cbk(size, pcm, sample, discontinuity, userData);
+    } else {
+        AudioBuffer::release(pcm);
+    }
 }
 
 AudioInput::~AudioInput() {
+    if(self == nullptr) return;
     if(isOpen()) close();
+    //The watchdog or the callback of a stream being closed still use it
+    if(self->watchdogOrphaned || self->closingStreams > 0) return;
+    delete self->callbackTrace.load();
+    if(self->pool) {
+        AudioBuffer::release(self->partial);
+        self->pool->destroy();
+    }
     delete self;
 }
 
 
 
+//Keeps the longest time spent in the callback, measured until it returns
+struct CallbackTimer {
+    CallbackTimer(std::atomic<uint64_t> &max): max(max), start(std::chrono::steady_clock::now()) {}
+    ~CallbackTimer() {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if(ns > max.load(std::memory_order_relaxed)) {
+            max.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> &max;
+    std::chrono::steady_clock::time_point start;
+};
+
 int stream_cbk(const void *input,
                void *output,
                unsigned long frameCount,
@@ -196,18 +879,66 @@ int stream_cbk(const void *input,
                PaStreamCallbackFlags statusFlags,
                void *userData) {
     AudioInput* self = (AudioInput*) userData;
-    if(statusFlags) {
-        printf("[PortAudio]: PaStreamCallbackFlag set:");
-        if(statusFlags & paInputOverflow) printf(" InputOverflow");
-        if(statusFlags & paInputUnderflow) printf(" InputUnderflow");
-        printf("\n");
+    TRACE_THREAD_NAME("PortAudio callback");
+    TRACE_SCOPE("stream_cbk", frameCount);
+    CallbackTimer timer(self->self->maxCallbackNs);
+    double now = SampleClock::now();
+    self->self->lastCallback.store(now, std::memory_order_relaxed);
+    //First callback of a stream reopened by the watchdog
+    bool recovered = self->self->recovering.load(std::memory_order_acquire) && self->self->recovering.exchange(false);
+    if(recovered) {
+        self->self->clock.resync();
+        //The samples of the stall are not counted, the chunk started before it is dropped
+        AudioBuffer::release(self->self->partial);
+        self->self->partial = nullptr;
+        self->self->discontinuity = true;
+        self->self->stalled = false;
+        self->self->recoveries++;
+    }
+    self->self->callbacksTracing++;
+    CallbackTraceWriter* writer = self->self->callbackTrace.load();
+    if(writer != nullptr) {
+        writer->record(frameCount, timeInfo, statusFlags);
     }
+    self->self->callbacksTracing--;
+    //The clock counts every frame of the device, also the ones dropped by the soft pause
+    double latency = (double) frameCount / self->options.sampleRate;
+    if(timeInfo != nullptr && timeInfo->inputBufferAdcTime > 0 && timeInfo->currentTime >= timeInfo->inputBufferAdcTime
+        && timeInfo->currentTime - timeInfo->inputBufferAdcTime < 1.0) {
+        latency = timeInfo->currentTime - timeInfo->inputBufferAdcTime;
+    }
+    uint64_t sample = self->self->clock.update(now - latency, frameCount);
+    if(recovered && self->stallCbk) {
+        self->stallCbk(true, (now - self->self->stalledAt) * 1000, sample, self->userData);
+    }
+    if(self->self->isSoftPaused.load(std::memory_order_relaxed)) {
+        self->self->droppingSoftPause = true;
+        return paContinue;
+    }
+    if(self->self->droppingSoftPause) {
+        //The audio of the pause is missing, the chunk started before it is dropped
+        self->self->droppingSoftPause = false;
+        AudioBuffer::release(self->self->partial);
+        self->self->partial = nullptr;
+        self->self->discontinuity = true;
+    }
+    self->self->callbacks++;
+    self->self->frames += frameCount;
+    //Counted in the stats, nothing is printed: stdout can be the audio (capture --output -)
+    if(statusFlags & paInputOverflow) self->self->inputOverflows++;
+    if(statusFlags & paInputUnderflow) self->self->inputUnderflows++;
     size_t bytes = frameCount * self->options.bitsPerSample / 8 * self->options.channels;
-    void* pcm = (void*) new char[bytes];
+    if(self->self->pool != nullptr) {
+        reblock(self, (const char*) input, bytes, sample);
+        return paContinue;
+    }
+
+    void* pcm = (void*) AudioBuffer::alloc(bytes);
     memcpy(pcm, input, bytes);
     self->callCallback(
         bytes,
-        pcm
+        pcm,
+        sample
     );
     return paContinue;
 }
@@ -245,6 +976,7 @@ static bool loadLibrary(std::string path) {
 
 static void unloadLibrary() {
     delete portaudio;
+    portaudio = nullptr;
 }
 
 extern "C" PaError Pa_Initialize(void) {
@@ -283,6 +1015,12 @@ extern "C" const PaHostApiInfo* Pa_GetHostApiInfo(PaHostApiIndex index) {
     return func(index);
 }
 
+extern "C" PaHostApiIndex Pa_GetHostApiCount(void) {
+    static PaHostApiIndex(*func)(void) = nullptr;
+    if(func == nullptr) func = portaudio->getSymbolAddress<decltype(func)>("Pa_GetHostApiCount");
+    return func();
+}
+
 extern "C" PaDeviceIndex Pa_GetDefaultInputDevice(void) {
     static PaDeviceIndex(*func)(void) = nullptr;
     if(func == nullptr) func = portaudio->getSymbolAddress<decltype(func)>("Pa_GetDefaultInputDevice");
@@ -340,6 +1078,12 @@ extern "C" PaError Pa_CloseStream(PaStream* stream) {
     return func(stream);
 }
 
+extern "C" const PaStreamInfo* Pa_GetStreamInfo(PaStream* stream) {
+    static const PaStreamInfo*(*func)(PaStream*) = nullptr;
+    if(func == nullptr) func = portaudio->getSymbolAddress<decltype(func)>("Pa_GetStreamInfo");
+    return func(stream);
+}
+
 extern "C" int PaWasapi_IsLoopback(PaDeviceIndex deviceId) {
     //Avoid crashes when portaudio dll has not the Audacity patch
     static bool loaded = false;
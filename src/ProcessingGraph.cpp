@@ -0,0 +1,354 @@
+#include "ProcessingGraph.hpp"
+#include "AudioBuffer.hpp"
+#include "PcmKernels.hpp"
+#include "Trace.hpp"
+#include <chrono>
+#include <algorithm>
+
+ProcessingGraph::ProcessingGraph(const AudioInput::Options &input, const SampleClock* clock, NotifyCallback notify, void* userData):
+    input(input), clock(clock), notify(notify), userData(userData) {}
+
+ProcessingGraph::~ProcessingGraph() {
+    //Waits for the chunk being processed
+    strand.reset();
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    for(auto &node: nodes) {
+        for(auto &chunk: node->queue) {
+            AudioBuffer::release(chunk.pcm);
+        }
+        if(node->pool) {
+            node->pool->destroy();
+        }
+    }
+}
+
+bool ProcessingGraph::start(const std::vector<NodeOptions> &options, std::string &error) {
+    for(auto &opt: options) {
+        std::unique_ptr<Node> node(new Node);
+        node->options = opt;
+
+        if(opt.id.empty() || opt.id == "source") {
+            error = "Every node needs an id other than 'source'";
+            return false;
+        }
+        for(auto &other: nodes) {
+            if(other->options.id == opt.id) {
+                error = "Duplicated node '" + opt.id + "'";
+                return false;
+            }
+        }
+
+        //Format of the input of this node
+        uint32_t sampleRate = input.sampleRate;
+        uint8_t channels = input.channels;
+        uint8_t bitsPerSample = input.bitsPerSample;
+        if(!opt.input.empty() && opt.input != "source") {
+            for(size_t i = 0; i < nodes.size(); i++) {
+                if(nodes[i]->options.id == opt.input) {
+                    node->parent = (int) i;
+                }
+            }
+            if(node->parent < 0) {
+                error = "Input '" + opt.input + "' of node '" + opt.id + "' must be declared before it";
+                return false;
+            }
+            Node &parent = *nodes[node->parent];
+            if(parent.options.type >= FileOutput) {
+                error = "Node '" + opt.input + "' is an output, it cannot be the input of '" + opt.id + "'";
+                return false;
+            }
+            sampleRate = parent.sampleRate;
+            channels = parent.channels;
+            bitsPerSample = parent.bitsPerSample;
+        }
+
+        node->sampleRate = sampleRate;
+        node->channels = channels;
+        node->bitsPerSample = bitsPerSample;
+        switch(opt.type) {
+            case Convert:
+                node->bitsPerSample = opt.bitsPerSample;
+                break;
+            case Resample:
+                node->sampleRate = opt.sampleRate;
+                node->resampler.reset(new Resampler(sampleRate, opt.sampleRate, channels));
+                break;
+            case Map:
+                if(opt.channelMap.empty() || opt.channelMap.size() > 255) {
+                    error = "Node '" + opt.id + "' needs a channel map";
+                    return false;
+                }
+                node->channels = (uint8_t) opt.channelMap.size();
+                break;
+            default:
+                break;
+        }
+
+        if(opt.type >= FileOutput) {
+            for(size_t i = 0; i < nodes.size(); i++) {
+                Node &other = *nodes[i];
+                if(other.options.type >= FileOutput && other.convertedBy < 0
+                    && other.parent == node->parent && other.bitsPerSample == node->bitsPerSample) {
+                    node->convertedBy = (int) i;
+                    break;
+                }
+            }
+        }
+
+        //Outputs see the format of their input as the format of the capture
+        AudioInput::Options format = input;
+        format.sampleRate = node->sampleRate;
+        format.channels = node->channels;
+        format.bitsPerSample = node->bitsPerSample;
+        bool ok = true;
+        if(opt.type == FileOutput) {
+            node->fileSink.reset(new FileSink(opt.file, format));
+            ok = node->fileSink->start(error);
+        } else if(opt.type == FdOutput) {
+            node->fdSink.reset(new FdSink(opt.fd, format));
+            ok = node->fdSink->start(error);
+        } else if(opt.type == RtpOutput) {
+            node->rtpSink.reset(new RtpSink(opt.rtp, format, clock));
+            ok = node->rtpSink->start(error);
+        }
+        if(!ok) {
+            error = "Node '" + opt.id + "': " + error;
+            return false;
+        }
+
+        nodes.push_back(std::move(node));
+    }
+
+    strand.reset(new WorkerPool::Strand(input.threads.lowPriority ? WorkerPool::Low : WorkerPool::High, &ProcessingGraph::runJob, this));
+    return true;
+}
+
+void ProcessingGraph::getStats(std::vector<NodeStats> &stats, size_t &queued, uint64_t &dropped) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued = pending.size();
+        dropped = droppedInput;
+    }
+
+    std::lock_guard<std::mutex> lock(outputMutex);
+    for(auto &node: nodes) {
+        NodeStats s;
+        s.id = node->options.id;
+        s.chunks = node->chunks;
+        s.avgTime = node->chunks != 0 ? node->totalTime / node->chunks : 0;
+        s.maxTime = node->maxTime;
+        s.queued = node->queue.size();
+        s.dropped = node->dropped;
+        if(node->fdSink) {
+            FdSink::Stats sinkStats;
+            node->fdSink->getStats(sinkStats);
+            s.queued = sinkStats.inFlight;
+            s.dropped += sinkStats.droppedChunks;
+        } else if(node->rtpSink) {
+            RtpSink::Stats sinkStats;
+            node->rtpSink->getStats(sinkStats);
+            s.queued = sinkStats.queued;
+            s.dropped += sinkStats.droppedChunks + sinkStats.droppedPackets;
+        } else if(node->fileSink) {
+            FileSink::Stats sinkStats;
+            node->fileSink->getStats(sinkStats);
+            s.dropped += sinkStats.droppedChunks;
+        }
+        stats.push_back(s);
+    }
+}
+
+bool ProcessingGraph::pop(Output &out) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    for(auto &node: nodes) {
+        if(node->queue.empty()) continue;
+        Chunk chunk = node->queue.front();
+        node->queue.pop_front();
+        out.node = node->options.id;
+        out.pcm = chunk.pcm;
+        out.size = chunk.size;
+        out.sample = chunk.sample;
+        out.discontinuity = chunk.discontinuity;
+        //The sample is counted at the rate of the node, the clock at the rate of the capture
+        out.pts = clock->timeOf((uint64_t) (chunk.sample * ((double) input.sampleRate / node->sampleRate)));
+        return true;
+    }
+    return false;
+}
+
+void ProcessingGraph::push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) {
+    AudioBuffer::retain(pcm);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.size() >= maxPendingInput) {
+            AudioBuffer::release(pending.front().pcm);
+            pending.pop_front();
+            droppedInput++;
+        }
+        pending.push_back({ pcm, size, sample, discontinuity });
+    }
+    strand->signal();
+}
+
+bool ProcessingGraph::runJob(void* userData) {
+    ProcessingGraph* self = (ProcessingGraph*) userData;
+    Chunk chunk;
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if(self->pending.empty()) return false;
+        chunk = self->pending.front();
+        self->pending.pop_front();
+    }
+
+    self->process(chunk);
+    AudioBuffer::release(chunk.pcm);
+
+    std::lock_guard<std::mutex> lock(self->mutex);
+    return !self->pending.empty();
+}
+
+void ProcessingGraph::process(const Chunk &chunk) {
+    TRACE_SCOPE("graph process", chunk.size);
+    size_t count = chunk.size / PcmFormat::bytesPerSample(input.bitsPerSample);
+    source.resize(count);
+    PcmFormat::toFloat(chunk.pcm, input.bitsPerSample, source.data(), count);
+
+    bool hasOutput = false;
+    for(auto &ptr: nodes) {
+        Node &node = *ptr;
+        const float* in = source.data();
+        size_t frames = count / input.channels;
+        uint64_t sample = chunk.sample;
+        bool discontinuity = chunk.discontinuity;
+        if(node.parent >= 0) {
+            Node &parent = *nodes[node.parent];
+            in = parent.data;
+            frames = parent.frames;
+            sample = parent.sample;
+            discontinuity = parent.discontinuity;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        node.data = in;
+        node.frames = frames;
+        node.sample = sample;
+        node.discontinuity = discontinuity;
+        runNode(node);
+        double time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        node.chunks++;
+        node.totalTime += time;
+        node.maxTime = std::max(node.maxTime, time);
+        hasOutput |= node.options.type == JsOutput && !node.queue.empty();
+    }
+
+    for(auto &node: nodes) {
+        if(node->converted) {
+            AudioBuffer::release(node->converted);
+            node->converted = nullptr;
+        }
+    }
+
+    if(hasOutput) {
+        notify(userData);
+    }
+}
+
+void ProcessingGraph::runNode(Node &node) {
+    uint8_t inChannels = node.parent >= 0 ? nodes[node.parent]->channels : input.channels;
+    switch(node.options.type) {
+        case Gain:
+            //Branches share the input, so the gain is applied on a copy
+            node.buffer.assign(node.data, node.data + node.frames * node.channels);
+            PcmKernels::get().scale(node.buffer.data(), node.options.gain, node.buffer.size());
+            node.data = node.buffer.data();
+            break;
+
+        case Convert:
+            //Only the format of the outputs below this node changes
+            break;
+
+        case Resample: {
+            //Output samples are counted from the first input, a gap restarts the count
+            uint64_t inSample = node.sample;
+            if(!node.started || inSample != node.expectedInput || node.discontinuity) {
+                uint32_t inRate = node.parent >= 0 ? nodes[node.parent]->sampleRate : input.sampleRate;
+                node.nextOutput = (uint64_t) (inSample * ((double) node.sampleRate / inRate));
+                node.started = true;
+                //Not interpolated across a stall of the device
+                if(node.discontinuity) node.resampler->reset();
+            }
+            node.expectedInput = inSample + node.frames;
+            if(node.options.clockCorrection) {
+                node.resampler->setRatio(clock->correctionRatio());
+            }
+            node.buffer.clear();
+            node.resampler->process(node.data, node.frames, node.buffer);
+            node.data = node.buffer.data();
+            node.frames = node.buffer.size() / node.channels;
+            node.sample = node.nextOutput;
+            node.nextOutput += node.frames;
+            break;
+        }
+
+        case Map:
+            node.buffer.resize(node.frames * node.channels);
+            PcmFormat::mapChannels(node.data, inChannels, node.buffer.data(), node.options.channelMap, node.frames);
+            node.data = node.buffer.data();
+            break;
+
+        default:
+            output(node);
+            break;
+    }
+}
+
+void ProcessingGraph::output(Node &node) {
+    if(node.frames == 0) return;
+
+    Node &owner = node.convertedBy >= 0 ? *nodes[node.convertedBy] : node;
+    if(owner.converted == nullptr) {
+        size_t samples = node.frames * node.channels;
+        uint32_t size = (uint32_t) (samples * PcmFormat::bytesPerSample(node.bitsPerSample));
+        //Sized for the largest chunk so far, the chunks of the device can vary
+        if(owner.pool == nullptr || owner.pool->bufferSize() < size) {
+            if(owner.pool) owner.pool->destroy();
+            owner.pool = BufferPool::create((size + 4095) / 4096 * 4096, outputPoolSize);
+        }
+        char* converted = owner.pool->acquire();
+        if(converted == nullptr) {
+            //Every chunk of the pool is still held by the sinks or JS
+            converted = AudioBuffer::alloc(size);
+        }
+        PcmFormat::fromFloat(node.data, node.bitsPerSample, converted, samples);
+        owner.converted = converted;
+        owner.convertedSize = size;
+    }
+    const void* pcm = owner.converted;
+    uint32_t size = owner.convertedSize;
+    AudioBuffer::retain(pcm);
+
+    if(node.options.type != JsOutput) {
+        sinkOf(node)->push(pcm, size, node.sample, node.discontinuity);
+        AudioBuffer::release(pcm);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(outputMutex);
+    if(node.options.maxQueue != 0 && node.queue.size() >= node.options.maxQueue) {
+        AudioBuffer::release(node.queue.front().pcm);
+        node.queue.pop_front();
+        node.dropped++;
+    }
+    node.queue.push_back({ pcm, size, node.sample, node.discontinuity });
+}
+
+AudioSink* ProcessingGraph::sinkOf(Node &node) {
+    if(node.fileSink) return node.fileSink.get();
+    if(node.fdSink) return node.fdSink.get();
+    return node.rtpSink.get();
+}
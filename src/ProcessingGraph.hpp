@@ -0,0 +1,147 @@
+#ifndef PROCESSING_GRAPH_H
+#define PROCESSING_GRAPH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "AudioInput.hpp"
+#include "PcmFormat.hpp"
+#include "FileSink.hpp"
+#include "FdSink.hpp"
+#include "RtpSink.hpp"
+#include "WorkerPool.hpp"
+
+class BufferPool;
+
+//Pipeline described once from JS and run on the shared worker pool: the
+//captured audio goes through DSP nodes (in float) and ends in sinks. Every node
+//reads the output of its input node, so branches share the work done before
+//them. The existing sinks are used as the outputs, with their own threads.
+//Outputs of the same node and format share one converted chunk.
+class ProcessingGraph: public AudioSink {
+public:
+    //Chunks kept by a JS output that is not read
+    static const uint32_t defaultMaxQueue = 64;
+
+    enum NodeType { Gain, Convert, Resample, Map, FileOutput, FdOutput, RtpOutput, JsOutput };
+
+    struct NodeOptions {
+        std::string id;
+        std::string input; //Empty for the source
+        NodeType type;
+        float gain;
+        uint32_t sampleRate;
+        uint8_t bitsPerSample;
+        std::vector<int> channelMap;
+        bool clockCorrection;
+        uint32_t maxQueue; //0 means unbounded
+        FileSink::Options file;
+        FdSink::Options fd;
+        RtpSink::Options rtp;
+    };
+
+    struct NodeStats {
+        std::string id;
+        uint64_t chunks;
+        double avgTime; //us
+        double maxTime;
+        size_t queued;
+        uint64_t dropped;
+    };
+
+    struct Output {
+        std::string node;
+        const void* pcm;
+        uint32_t size;
+        uint64_t sample;
+        double pts;
+        bool discontinuity; //First chunk after a stall of the device
+    };
+
+    typedef void (*NotifyCallback)(void*);
+
+    ProcessingGraph(const AudioInput::Options &input, const SampleClock* clock, NotifyCallback notify, void* userData);
+    ~ProcessingGraph();
+
+    //Builds the nodes, every node must come after its input
+    bool start(const std::vector<NodeOptions> &nodes, std::string &error);
+    void getStats(std::vector<NodeStats> &stats, size_t &queued, uint64_t &droppedInput);
+    //Next chunk of the JS outputs, the caller owns the chunk
+    bool pop(Output &output);
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+        uint64_t sample;
+        bool discontinuity;
+    };
+
+    struct Node {
+        NodeOptions options;
+        int parent = -1;
+        //Format of the output
+        uint32_t sampleRate = 0;
+        uint8_t channels = 0;
+        uint8_t bitsPerSample = 0;
+
+        std::vector<float> buffer;
+        const float* data = nullptr;
+        size_t frames = 0;
+        uint64_t sample = 0;
+        bool discontinuity = false;
+        uint64_t expectedInput = 0;
+        uint64_t nextOutput = 0;
+        bool started = false;
+        std::unique_ptr<Resampler> resampler;
+
+        std::unique_ptr<FileSink> fileSink;
+        std::unique_ptr<FdSink> fdSink;
+        std::unique_ptr<RtpSink> rtpSink;
+        std::deque<Chunk> queue;
+
+        //Earlier output with the same input and format, which converts the chunk for both
+        int convertedBy = -1;
+        //Chunk converted by this output, until the end of process
+        const void* converted = nullptr;
+        uint32_t convertedSize = 0;
+        BufferPool* pool = nullptr;
+
+        uint64_t chunks = 0;
+        uint64_t dropped = 0;
+        double totalTime = 0;
+        double maxTime = 0;
+    };
+
+    static const size_t maxPendingInput = 256;
+    static const size_t outputPoolSize = 64;
+
+    static bool runJob(void* userData);
+    void process(const Chunk &chunk);
+    void runNode(Node &node);
+    void output(Node &node);
+    AudioSink* sinkOf(Node &node);
+
+    const AudioInput::Options input;
+    const SampleClock* clock;
+    NotifyCallback notify;
+    void* userData;
+
+    std::vector<float> source;
+    //Nodes are only changed in start, the worker and pop use the output queues
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::mutex outputMutex;
+
+    std::mutex mutex;
+    std::deque<Chunk> pending;
+    uint64_t droppedInput = 0;
+    std::unique_ptr<WorkerPool::Strand> strand;
+};
+
+#endif
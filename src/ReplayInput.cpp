@@ -0,0 +1,82 @@
+#include "ReplayInput.hpp"
+#include "SampleClock.hpp"
+#include "Trace.hpp"
+#include <chrono>
+
+//A replay this late (the process was stopped...) starts pacing again from now
+static const double maxLateness = 1.0;
+//Chunks waiting in the consumer above which the replay waits, and how often it checks them
+static const size_t maxBacklog = 64;
+static const int backlogPollMs = 2;
+
+ReplayInput::ReplayInput(double speed, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData):
+    speed(speed), callback(callback), onEnd(onEnd), backlog(backlog), userData(userData) {}
+
+bool ReplayInput::start(std::string &error) {
+    if(!isOpen()) {
+        error = "The replay is not open";
+        return false;
+    }
+    if(running || finished) return true;
+
+    //Stopped or ended on its own
+    if(thread.joinable()) {
+        thread.join();
+    }
+    running = true;
+    thread = std::thread(&ReplayInput::run, this);
+    return true;
+}
+
+void ReplayInput::stop() {
+    running = false;
+    if(thread.joinable()) {
+        thread.join();
+    }
+}
+
+void ReplayInput::run() {
+    TRACE_THREAD_NAME("replay");
+    typedef std::chrono::steady_clock::duration Duration;
+    //After a pause it continues from the last buffer delivered
+    auto base = std::chrono::steady_clock::now() - std::chrono::duration_cast<Duration>(std::chrono::duration<double>(speed > 0 ? lastTime / speed : 0));
+
+    Buffer buffer;
+    while(running) {
+        //A consumer that falls behind slows the replay down, instead of queueing the whole file
+        if(backlog != nullptr && backlog(userData) > maxBacklog) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(backlogPollMs));
+            continue;
+        }
+        buffer.flags = 0;
+        if(!next(buffer)) {
+            finished = true;
+            break;
+        }
+
+        double latency = 0;
+        if(speed > 0) {
+            latency = buffer.latency / speed;
+            auto due = base + std::chrono::duration_cast<Duration>(std::chrono::duration<double>(buffer.time / speed));
+            auto now = std::chrono::steady_clock::now();
+            if(now - due > std::chrono::duration<double>(maxLateness)) {
+                base += now - due;
+                buffer.flags |= paInputOverflow;
+            } else {
+                std::this_thread::sleep_until(due);
+            }
+        }
+        lastTime = buffer.time;
+
+        PaStreamCallbackTimeInfo timeInfo;
+        timeInfo.currentTime = SampleClock::now();
+        timeInfo.inputBufferAdcTime = timeInfo.currentTime - latency;
+        timeInfo.outputBufferDacTime = 0;
+        callback(buffer.pcm, nullptr, buffer.frames, &timeInfo, buffer.flags, userData);
+    }
+
+    running = false;
+    if(finished && onEnd != nullptr) {
+        onEnd(userData);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef REPLAY_INPUT_H
+#define REPLAY_INPUT_H
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "portaudio.h"
+#include "AudioInput.hpp"
+
+//Base of the inputs that replace the PortAudio device: a thread that calls
+//the callback of the stream with the buffers of `next`, paced like a device
+//(speed 1), faster, or as fast as possible (speed 0). It waits while the
+//consumer has a backlog, so a fast or looped replay does not fill the memory.
+class ReplayInput {
+public:
+    typedef void (*EndCallback)(void*);
+    //Chunks not consumed yet
+    typedef size_t (*BacklogCallback)(void*);
+
+    ReplayInput(double speed, PaStreamCallback* callback, EndCallback onEnd, BacklogCallback backlog, void* userData);
+    //Subclasses must call stop() in their destructor
+    virtual ~ReplayInput() {}
+
+    virtual bool open(std::string &error) = 0;
+    //Continues from where it was stopped
+    bool start(std::string &error);
+    void stop();
+
+protected:
+    struct Buffer {
+        const void* pcm;
+        unsigned long frames;
+        double time;    //s since the beginning of the replay when it is delivered
+        double latency; //s since it was captured
+        PaStreamCallbackFlags flags;
+    };
+
+    //Called from the replay thread, returns false at the end
+    virtual bool next(Buffer &buffer) = 0;
+    virtual bool isOpen() = 0;
+
+private:
+    void run();
+
+    const double speed;
+    PaStreamCallback* callback;
+    EndCallback onEnd;
+    BacklogCallback backlog;
+    void* userData;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+    double lastTime = 0;
+};
+
+#endif
@@ -0,0 +1,591 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#include "RtpSink.hpp"
+#include "AudioBuffer.hpp"
+#include "PcmFormat.hpp"
+#include "dl.hpp"
+#include "Trace.hpp"
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#ifdef _WIN32
+#define closeSocket closesocket
+typedef SOCKET socket_t;
+#else
+#define closeSocket close
+typedef int socket_t;
+#endif
+
+//Seconds between 1900 (NTP) and 1970 (Unix)
+static const uint64_t ntpEpochOffset = 2208988800ull;
+//Packets waiting to be sent, older ones are dropped if the network does not keep up
+static const size_t maxQueuedPackets = 400;
+
+//libopus is loaded when the first Opus sink starts, like libFLAC
+static Library* opusLibrary = nullptr;
+static struct {
+    void* (*encoderCreate)(int32_t, int, int, int*);
+    int32_t (*encodeFloat)(void*, const float*, int, unsigned char*, int32_t);
+    int (*encoderCtl)(void*, int, ...);
+    void (*encoderDestroy)(void*);
+} opusApi;
+
+static const int opusApplicationAudio = 2049;
+static const int opusSetBitrateRequest = 4002;
+
+static bool loadOpusLibrary(std::string &error) {
+    if(opusLibrary != nullptr) return true;
+
+    opusLibrary = Library::load("libopus");
+#ifndef WIN32
+    if(opusLibrary == nullptr) opusLibrary = Library::load("libopus", "so.0");
+#endif
+    if(opusLibrary == nullptr) {
+        error = "Could not load native library libopus";
+        return false;
+    }
+
+    const char* missing = nullptr;
+    if(!opusLibrary->getSymbol("opus_encoder_create", opusApi.encoderCreate, missing)
+        || !opusLibrary->getSymbol("opus_encode_float", opusApi.encodeFloat, missing)
+        || !opusLibrary->getSymbol("opus_encoder_ctl", opusApi.encoderCtl, missing)
+        || !opusLibrary->getSymbol("opus_encoder_destroy", opusApi.encoderDestroy, missing)) {
+        error = std::string("Symbol ") + missing + " not found in libopus";
+        delete opusLibrary;
+        opusLibrary = nullptr;
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+//Winsock is started once and never cleaned up, the sockets can be used until the process exits
+static bool startSockets(std::string &error) {
+    static int result = [] {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data);
+    }();
+    if(result != 0) {
+        error = "Could not start Winsock: " + std::to_string(result);
+        return false;
+    }
+    return true;
+}
+
+static int lastSocketError() {
+    return WSAGetLastError();
+}
+
+static std::string socketErrorText(int err) {
+    char text[256] = "";
+    FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, (DWORD) err,
+        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), text, sizeof(text), NULL);
+    return text[0] != 0 ? std::string(text) : "error " + std::to_string(err);
+}
+#else
+static bool startSockets(std::string &) {
+    return true;
+}
+
+static int lastSocketError() {
+    return errno;
+}
+
+static std::string socketErrorText(int err) {
+    return strerror(err);
+}
+#endif
+
+struct OpusEncoder {
+    void* encoder;
+};
+
+static inline void putBE(char* p, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; i++) {
+        p[i] = (char) (value >> (8 * (bytes - 1 - i)));
+    }
+}
+
+RtpSink::RtpSink(const Options &opt, const AudioInput::Options &input, const SampleClock* clock):
+    options(opt), input(input), clock(clock) {
+    stats = Stats();
+    payloadType = options.payloadType;
+    if(payloadType == 0) {
+        //Static payload types of RFC 3551 for L16 at 44100, dynamic for the rest
+        if(options.encoding == L16 && input.sampleRate == 44100 && input.channels <= 2) {
+            payloadType = input.channels == 2 ? 10 : 11;
+        } else {
+            payloadType = 96;
+        }
+    }
+}
+
+RtpSink::~RtpSink() {
+    if(running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_one();
+        thread.join();
+    }
+
+    for(auto &chunk: pending) {
+        AudioBuffer::release(chunk.pcm);
+    }
+    if(opus != nullptr) {
+        opusApi.encoderDestroy(opus->encoder);
+        delete opus;
+    }
+    if(socket != -1) {
+        closeSocket((socket_t) socket);
+    }
+}
+
+bool RtpSink::start(std::string &error) {
+    uint32_t frames = (uint32_t) std::lround(options.packetTime * input.sampleRate / 1000);
+    if(options.encoding == Opus) {
+        if(input.sampleRate != 48000) {
+            error = "Opus needs a sample rate of 48000";
+            return false;
+        }
+        //2.5, 5, 10, 20, 40 or 60 ms
+        if(frames != 120 && frames != 240 && frames != 480 && frames != 960 && frames != 1920 && frames != 2880) {
+            error = "Opus packet time must be 2.5, 5, 10, 20, 40 or 60 ms";
+            return false;
+        }
+        if(!loadOpusLibrary(error)) {
+            return false;
+        }
+
+        int err = 0;
+        void* encoder = opusApi.encoderCreate(48000, input.channels, opusApplicationAudio, &err);
+        if(encoder == nullptr || err != 0) {
+            error = "Could not create the Opus encoder";
+            return false;
+        }
+        if(options.bitrate != 0) {
+            opusApi.encoderCtl(encoder, opusSetBitrateRequest, (int32_t) options.bitrate);
+        }
+        opus = new OpusEncoder{ encoder };
+        packetFrames = frames;
+    } else {
+        if(options.encoding == L24 && input.bitsPerSample == 8) {
+            error = "L24 needs an input of at least 16 bits";
+            return false;
+        }
+        size_t frameBytes = (options.encoding == L16 ? 2 : 3) * input.channels;
+        packetFrames = std::max<uint32_t>(1, std::min<uint32_t>(frames, maxPayload / frameBytes));
+    }
+    stats.packetTime = packetFrames * 1000.0 / input.sampleRate;
+
+    if(!startSockets(error)) {
+        return false;
+    }
+
+    struct addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    std::string port = std::to_string(options.port);
+    int err = getaddrinfo(options.host.c_str(), port.c_str(), &hints, &result);
+    if(err != 0 || result == nullptr) {
+        error = "Could not resolve " + options.host + ": " + gai_strerror(err);
+        return false;
+    }
+
+    socket_t s = ::socket(result->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(s == (socket_t) -1) {
+        freeaddrinfo(result);
+        error = "Could not create the socket: " + socketErrorText(lastSocketError());
+        return false;
+    }
+    socket = (intptr_t) s;
+
+    int ttl = options.ttl;
+    if(result->ai_family == AF_INET6) {
+        setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, (const char*) &ttl, sizeof(ttl));
+    } else {
+        setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, (const char*) &ttl, sizeof(ttl));
+    }
+
+    //The SDP announces the resolved address, in the family of the socket
+    char numeric[NI_MAXHOST];
+    if(getnameinfo(result->ai_addr, (socklen_t) result->ai_addrlen, numeric, sizeof(numeric), nullptr, 0, NI_NUMERICHOST) == 0) {
+        numericHost = numeric;
+    } else {
+        numericHost = options.host;
+    }
+    ipv6 = result->ai_family == AF_INET6;
+
+    //RTCP goes to the next port
+    address.assign((char*) result->ai_addr, (char*) result->ai_addr + result->ai_addrlen);
+    rtcpAddress = address;
+    uint16_t rtcpPort = htons(options.port + 1);
+    if(result->ai_family == AF_INET6) {
+        ((struct sockaddr_in6*) rtcpAddress.data())->sin6_port = rtcpPort;
+    } else {
+        ((struct sockaddr_in*) rtcpAddress.data())->sin_port = rtcpPort;
+    }
+    freeaddrinfo(result);
+
+    std::random_device random;
+    ssrc = random();
+    sequence = (uint16_t) random();
+    timestampOffset = random();
+
+    running = true;
+    thread = std::thread(&RtpSink::run, this);
+    return true;
+}
+
+void RtpSink::getStats(Stats &s) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    s = stats;
+}
+
+std::string RtpSink::sdp() const {
+    std::string encoding;
+    if(options.encoding == Opus) {
+        //Opus is always announced as 48000/2, the real channels go in the fmtp
+        encoding = "opus/48000/2";
+    } else {
+        encoding = std::string(options.encoding == L16 ? "L16/" : "L24/") + std::to_string(input.sampleRate) + "/" + std::to_string(input.channels);
+    }
+
+    char ptime[32];
+    snprintf(ptime, sizeof(ptime), "%g", packetFrames * 1000.0 / input.sampleRate);
+
+    std::string result = "v=0\r\n";
+    result += "o=- " + std::to_string(ssrc) + " 0 IN " + (ipv6 ? "IP6 " : "IP4 ") + numericHost + "\r\n";
+    result += "s=AudioInput\r\n";
+    result += std::string("c=IN ") + (ipv6 ? "IP6 " : "IP4 ") + numericHost + "\r\n";
+    result += "t=0 0\r\n";
+    result += "m=audio " + std::to_string(options.port) + " RTP/AVP " + std::to_string(payloadType) + "\r\n";
+    result += "a=rtpmap:" + std::to_string(payloadType) + " " + encoding + "\r\n";
+    if(options.encoding == Opus) {
+        result += "a=fmtp:" + std::to_string(payloadType) + " stereo=" + (input.channels == 2 ? "1" : "0") + "\r\n";
+    }
+    result += std::string("a=ptime:") + ptime + "\r\n";
+    result += "a=sendonly\r\n";
+    return result;
+}
+
+void RtpSink::push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(pending.size() >= maxPendingChunks) {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.droppedChunks++;
+            return;
+        }
+        AudioBuffer::retain(pcm);
+        pending.push_back({ pcm, size, sample, discontinuity });
+    }
+    cond.notify_one();
+}
+
+void RtpSink::run() {
+    input.threads.applyToCurrentThread("rtp sink");
+    TRACE_THREAD_NAME("rtp sink");
+    std::deque<Chunk> chunks;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(running) {
+        if(pending.empty()) {
+            if(packets.empty()) {
+                cond.wait(lock);
+            } else {
+                double wait = nextSend - SampleClock::now();
+                if(wait > 0) {
+                    cond.wait_for(lock, std::chrono::duration<double>(wait));
+                }
+            }
+        }
+
+        chunks.swap(pending);
+        lock.unlock();
+
+        for(auto &chunk: chunks) {
+            packetize(chunk);
+            AudioBuffer::release(chunk.pcm);
+        }
+        chunks.clear();
+
+        sendDuePackets();
+        if(options.rtcpInterval != 0 && sentAny && SampleClock::now() >= nextReport) {
+            sendReport();
+            nextReport = SampleClock::now() + options.rtcpInterval;
+        }
+
+        {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.queued = packets.size();
+        }
+        lock.lock();
+    }
+}
+
+void RtpSink::packetize(const Chunk &chunk) {
+    TRACE_SCOPE("rtp packetize", chunk.size);
+    size_t inBytes = PcmFormat::bytesPerSample(input.bitsPerSample);
+    size_t inFrameBytes = inBytes * input.channels;
+    uint32_t frames = (uint32_t) (chunk.size / inFrameBytes);
+    const char* in = (const char*) chunk.pcm;
+
+    //A gap in the samples (soft pause) ends the packet, the receiver sees the jump in the timestamps
+    if(partialFrames != 0 && chunk.sample != nextSample) {
+        flushPartial();
+    }
+    //After a stall the audio does not follow the previous packet, the marker bit lets the receiver resync its playout
+    if(chunk.discontinuity) {
+        flushPartial();
+        marker = true;
+    }
+    nextSample = chunk.sample + frames;
+
+    uint32_t done = 0;
+    while(done < frames) {
+        if(partialFrames == 0) {
+            partialSample = chunk.sample + done;
+        }
+        uint32_t n = std::min(frames - done, packetFrames - partialFrames);
+        size_t samples = (size_t) n * input.channels;
+        const char* src = in + (size_t) done * inFrameBytes;
+
+        if(options.encoding == Opus) {
+            size_t offset = (size_t) partialFrames * input.channels;
+            partialFloat.resize(offset + samples);
+            PcmFormat::toFloat(src, input.bitsPerSample, partialFloat.data() + offset, samples);
+        } else {
+            //Network byte order, converting the bit depth only when it is different
+            size_t outBytes = options.encoding == L16 ? 2 : 3;
+            size_t offset = (size_t) partialFrames * input.channels * outBytes;
+            partial.resize(offset + samples * outBytes);
+            char* dst = partial.data() + offset;
+            if(input.bitsPerSample == outBytes * 8) {
+                for(size_t i = 0; i < samples; i++, src += inBytes, dst += outBytes) {
+                    for(size_t b = 0; b < outBytes; b++) dst[b] = src[outBytes - 1 - b];
+                }
+            } else if(input.bitsPerSample == 24 && outBytes == 2) {
+                for(size_t i = 0; i < samples; i++, src += inBytes, dst += outBytes) {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                }
+            } else if(input.bitsPerSample == 16 && outBytes == 3) {
+                for(size_t i = 0; i < samples; i++, src += inBytes, dst += outBytes) {
+                    dst[0] = src[1];
+                    dst[1] = src[0];
+                    dst[2] = 0;
+                }
+            } else {
+                converted.resize(samples);
+                PcmFormat::toFloat(src, input.bitsPerSample, converted.data(), samples);
+                PcmFormat::fromFloat(converted.data(), (uint8_t) (outBytes * 8), dst, samples);
+                for(size_t i = 0; i < samples; i++, dst += outBytes) {
+                    std::swap(dst[0], dst[outBytes - 1]);
+                }
+            }
+        }
+
+        partialFrames += n;
+        done += n;
+        if(partialFrames == packetFrames) {
+            finishPacket();
+        }
+    }
+}
+
+void RtpSink::flushPartial() {
+    if(partialFrames == 0) return;
+    if(options.encoding == Opus) {
+        //Opus frames have a fixed duration, the rest is silence
+        partialFloat.resize((size_t) packetFrames * input.channels, 0.0f);
+        partialFrames = packetFrames;
+    }
+    finishPacket();
+}
+
+void RtpSink::finishPacket() {
+    Packet packet;
+    if(!spare.empty()) {
+        packet = std::move(spare.back());
+        spare.pop_back();
+    }
+    packet.sample = partialSample;
+    packet.data.resize(12 + maxPayload);
+
+    size_t payload;
+    if(options.encoding == Opus) {
+        int32_t n = opusApi.encodeFloat(opus->encoder, partialFloat.data(), (int) packetFrames,
+            (unsigned char*) packet.data.data() + 12, (int32_t) maxPayload);
+        if(n < 0) {
+            setError("Opus encoding failed");
+            partialFrames = 0;
+            spare.push_back(std::move(packet));
+            return;
+        }
+        payload = (size_t) n;
+    } else {
+        payload = partial.size();
+        memcpy(packet.data.data() + 12, partial.data(), payload);
+    }
+    packet.data.resize(12 + payload);
+    partialFrames = 0;
+    partial.clear();
+    partialFloat.clear();
+
+    packet.marker = marker;
+    marker = false;
+
+    if(packets.size() >= maxQueuedPackets) {
+        spare.push_back(std::move(packets.front()));
+        packets.pop_front();
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        stats.droppedPackets++;
+    }
+    packets.push_back(std::move(packet));
+}
+
+void RtpSink::sendDuePackets() {
+    if(packets.empty()) return;
+
+    double now = SampleClock::now();
+    //The first packet and the ones after a stall are sent right away
+    if(nextSend == 0 || now - nextSend > 0.2) {
+        nextSend = now;
+    }
+
+    //The stream can have another rate than the capture (i.e. resampled in a graph)
+    SampleClock::Info info;
+    clock->getInfo(info);
+    double scale = (double) input.sampleRate / clock->nominalRate();
+    double rate = info.locked ? info.rate * scale : input.sampleRate;
+    double interval = packetFrames / rate;
+
+    size_t due = 0;
+    while(due < packets.size() && due < maxBatch && nextSend <= now) {
+        Packet &packet = packets[due];
+        char* h = packet.data.data();
+        h[0] = (char) 0x80;
+        h[1] = (char) (payloadType | (packet.marker ? 0x80 : 0));
+        putBE(h + 2, sequence++, 2);
+        putBE(h + 4, (uint32_t) (timestampOffset + packet.sample), 4);
+        putBE(h + 8, ssrc, 4);
+        nextSend += interval;
+        due++;
+    }
+    if(due == 0) return;
+
+    TRACE_SCOPE("rtp send", due);
+    size_t sent = 0, bytes = 0, calls = 0;
+    int lastError = 0;
+#ifdef __linux__
+    struct mmsghdr msgs[maxBatch];
+    struct iovec iovs[maxBatch];
+    memset(msgs, 0, sizeof(msgs));
+    for(size_t i = 0; i < due; i++) {
+        iovs[i].iov_base = packets[i].data.data();
+        iovs[i].iov_len = packets[i].data.size();
+        msgs[i].msg_hdr.msg_name = address.data();
+        msgs[i].msg_hdr.msg_namelen = (socklen_t) address.size();
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while(sent < due) {
+        int n = sendmmsg((int) socket, msgs + sent, (unsigned int) (due - sent), 0);
+        calls++;
+        if(n <= 0) {
+            lastError = lastSocketError();
+            break;
+        }
+        for(int i = 0; i < n; i++) bytes += packets[sent + i].data.size() - 12;
+        sent += n;
+    }
+#else
+    for(size_t i = 0; i < due; i++) {
+        calls++;
+        if(sendto((socket_t) socket, packets[i].data.data(), (int) packets[i].data.size(), 0,
+            (const struct sockaddr*) address.data(), (int) address.size()) < 0) {
+            lastError = lastSocketError();
+            continue;
+        }
+        bytes += packets[i].data.size() - 12;
+        sent++;
+    }
+#endif
+
+    lastSentSample = packets[due - 1].sample;
+    sentAny = true;
+    for(size_t i = 0; i < due; i++) {
+        spare.push_back(std::move(packets.front()));
+        packets.pop_front();
+    }
+
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    stats.packets += sent;
+    stats.bytes += bytes;
+    stats.sendCalls += calls;
+    if(sent < due) {
+        stats.sendErrors += due - sent;
+        stats.lastError = "Send failed: " + socketErrorText(lastError);
+    }
+}
+
+void RtpSink::sendReport() {
+    uint64_t packetCount, octetCount;
+    {
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        packetCount = stats.packets;
+        octetCount = stats.bytes;
+    }
+
+    //Sender report with the wall clock time of the last packet sent, followed by the SDES CNAME
+    char r[28 + 24];
+    memset(r, 0, sizeof(r));
+    double ms = clock->timeOf((uint64_t) (lastSentSample * ((double) clock->nominalRate() / input.sampleRate)));
+    double seconds = std::floor(ms / 1000);
+    uint64_t ntp = ((uint64_t) seconds + ntpEpochOffset) << 32 | (uint64_t) ((ms / 1000 - seconds) * 4294967296.0);
+    r[0] = (char) 0x80;
+    r[1] = (char) 200;
+    putBE(r + 2, 6, 2);
+    putBE(r + 4, ssrc, 4);
+    putBE(r + 8, ntp, 8);
+    putBE(r + 16, (uint32_t) (timestampOffset + lastSentSample), 4);
+    putBE(r + 20, (uint32_t) packetCount, 4);
+    putBE(r + 24, (uint32_t) octetCount, 4);
+
+    const char cname[] = "audio-input";
+    char* sdes = r + 28;
+    sdes[0] = (char) 0x81;
+    sdes[1] = (char) 202;
+    putBE(sdes + 2, 5, 2);
+    putBE(sdes + 4, ssrc, 4);
+    sdes[8] = 1;
+    sdes[9] = (char) (sizeof(cname) - 1);
+    memcpy(sdes + 10, cname, sizeof(cname) - 1);
+
+    if(sendto((socket_t) socket, r, (int) sizeof(r), 0, (const struct sockaddr*) rtcpAddress.data(), (int) rtcpAddress.size()) < 0) {
+        setError("RTCP send failed: " + socketErrorText(lastSocketError()));
+        return;
+    }
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    stats.reports++;
+}
+
+void RtpSink::setError(const std::string &error) {
+    std::lock_guard<std::mutex> statsLock(statsMutex);
+    stats.lastError = error;
+}
@@ -0,0 +1,127 @@
+#ifndef RTP_SINK_H
+#define RTP_SINK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "AudioInput.hpp"
+#include "SampleClock.hpp"
+
+//Sends the captured audio as RTP over UDP. The packets are built and sent
+//from its own thread, paced at the measured rate of the device so they
+//leave at a steady rate instead of in bursts of one callback. RTCP sender
+//reports map the RTP timestamps to the capture clock.
+class RtpSink: public AudioSink {
+public:
+    enum Encoding { L16, L24, Opus };
+
+    struct Options {
+        std::string host;
+        uint16_t port;
+        Encoding encoding;
+        uint8_t payloadType;   //0 chooses one
+        double packetTime;     //ms
+        uint8_t ttl;           //For multicast destinations
+        uint32_t rtcpInterval; //seconds, 0 disables the reports
+        uint32_t bitrate;      //Opus only, 0 is the default of the encoder
+    };
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t reports;
+        uint64_t sendCalls;
+        uint64_t droppedChunks;  //Captured audio that could not be queued for packetizing
+        uint64_t droppedPackets; //Packets that could not be sent in time
+        uint64_t sendErrors;
+        size_t queued;
+        double packetTime; //ms, after fitting the packets in the MTU
+        std::string lastError;
+    };
+
+    RtpSink(const Options &opt, const AudioInput::Options &input, const SampleClock* clock);
+    ~RtpSink();
+
+    //Resolves the destination and opens the socket, it must be called before adding the sink to the input
+    bool start(std::string &error);
+    void getStats(Stats &);
+    //Session description for the receivers (ffplay, VLC, gstreamer...)
+    std::string sdp() const;
+
+    void push(const void* pcm, uint32_t size, uint64_t sample, bool discontinuity) override;
+
+private:
+    struct Chunk {
+        const void* pcm;
+        uint32_t size;
+        uint64_t sample;
+        bool discontinuity;
+    };
+
+    struct Packet {
+        uint64_t sample;
+        bool marker; //First packet after a stall of the device
+        std::vector<char> data;
+    };
+
+    static const size_t maxPayload = 1400;
+    static const size_t maxBatch = 32;
+    static const size_t maxPendingChunks = 256;
+
+    void run();
+    void packetize(const Chunk &chunk);
+    void flushPartial();
+    void finishPacket();
+    void sendDuePackets();
+    void sendReport();
+    void setError(const std::string &error);
+
+    const Options options;
+    const AudioInput::Options input;
+    const SampleClock* clock;
+
+    uint8_t payloadType;
+    uint32_t packetFrames = 0;
+    uint32_t ssrc = 0;
+    uint16_t sequence = 0;
+    uint32_t timestampOffset = 0;
+    std::string numericHost; //Resolved destination, for the SDP
+    bool ipv6 = false;
+
+    intptr_t socket = -1;
+    std::vector<char> address;
+    std::vector<char> rtcpAddress;
+    struct OpusEncoder* opus = nullptr;
+
+    //Packet being filled, in network format (or float samples for Opus)
+    std::vector<char> partial;
+    std::vector<float> partialFloat;
+    std::vector<float> converted;
+    uint32_t partialFrames = 0;
+    uint64_t partialSample = 0;
+    uint64_t nextSample = 0;
+    bool marker = false;
+
+    std::deque<Packet> packets;
+    std::vector<Packet> spare;
+    double nextSend = 0;
+    double nextReport = 0;
+    uint64_t lastSentSample = 0;
+    bool sentAny = false;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Chunk> pending;
+    bool running = false;
+    std::thread thread;
+
+    std::mutex statsMutex;
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "SampleClock.hpp"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+//Callbacks needed before the estimated rate is used
+static const uint32_t lockUpdates = 50;
+//Max correction applied to the resamplers
+static const double maxCorrection = 0.001;
+static const double pi = 3.14159265358979323846;
+
+SampleClock::SampleClock(uint32_t sampleRate, double bandwidth): sampleRate(sampleRate), bandwidth(bandwidth) {
+    reset();
+}
+
+double SampleClock::now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SampleClock::publish() {
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    published.samples.store(state.samples, std::memory_order_relaxed);
+    published.baseSample.store(state.baseSample, std::memory_order_relaxed);
+    published.baseTime.store(state.baseTime, std::memory_order_relaxed);
+    published.period.store(state.period, std::memory_order_relaxed);
+    published.jitter.store(state.jitter, std::memory_order_relaxed);
+    published.epochOffset.store(state.epochOffset, std::memory_order_relaxed);
+    published.updates.store(state.updates, std::memory_order_relaxed);
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+SampleClock::State SampleClock::read() const {
+    State s;
+    while(true) {
+        uint32_t seq = sequence.load(std::memory_order_acquire);
+        if(seq & 1) continue;
+        s.samples = published.samples.load(std::memory_order_relaxed);
+        s.baseSample = published.baseSample.load(std::memory_order_relaxed);
+        s.baseTime = published.baseTime.load(std::memory_order_relaxed);
+        s.period = published.period.load(std::memory_order_relaxed);
+        s.jitter = published.jitter.load(std::memory_order_relaxed);
+        s.epochOffset = published.epochOffset.load(std::memory_order_relaxed);
+        s.updates = published.updates.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(sequence.load(std::memory_order_relaxed) == seq) return s;
+    }
+}
+
+void SampleClock::reset() {
+    state = State();
+    state.period = 1.0 / sampleRate;
+    double system = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    state.epochOffset = system - now();
+    publish();
+}
+
+void SampleClock::resync() {
+    state.updates = 0;
+    publish();
+}
+
+uint64_t SampleClock::update(double time, uint32_t frames) {
+    State &s = state;
+    uint64_t first = s.samples;
+    if(s.updates == 0) {
+        s.baseSample = s.samples;
+        s.baseTime = time;
+    } else {
+        //Second order DLL, the coefficients depend on the duration of this callback
+        double predicted = s.baseTime + (s.samples - s.baseSample) * s.period;
+        double error = time - predicted;
+        //A big jump (a stall of the device, suspend...) restarts the loop
+        if(std::fabs(error) > 0.5) {
+            s.updates = 0;
+            s.baseSample = s.samples;
+            s.baseTime = time;
+            s.samples += frames;
+            publish();
+            return first;
+        }
+        double omega = 2 * pi * bandwidth * (s.samples - s.baseSample) * s.period;
+        s.baseTime = predicted + std::sqrt(2.0) * omega * error;
+        s.period += omega * omega * error / (s.samples - s.baseSample);
+        s.baseSample = s.samples;
+        s.jitter = s.jitter * 0.99 + std::fabs(error) * 1000 * 0.01;
+    }
+    s.updates++;
+    s.samples += frames;
+    publish();
+    return first;
+}
+
+double SampleClock::timeOf(uint64_t sample) const {
+    State s = read();
+    if(s.updates == 0) return (now() + s.epochOffset) * 1000;
+    double time = s.baseTime + ((double) sample - (double) s.baseSample) * s.period;
+    return (time + s.epochOffset) * 1000;
+}
+
+double SampleClock::correctionRatio() const {
+    State s = read();
+    if(s.updates < lockUpdates) return 1.0;
+    //A device faster than the system clock gives more samples per second, they are consumed faster
+    double ratio = 1.0 / (s.period * sampleRate);
+    return std::max(1.0 - maxCorrection, std::min(1.0 + maxCorrection, ratio));
+}
+
+void SampleClock::getInfo(Info &info) const {
+    State s = read();
+    info.samples = s.samples;
+    info.rate = 1.0 / s.period;
+    info.driftPpm = (1.0 / (s.period * sampleRate) - 1.0) * 1e6;
+    info.jitter = s.jitter;
+    info.locked = s.updates >= lockUpdates;
+}
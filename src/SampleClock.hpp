@@ -0,0 +1,77 @@
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+//Maps the samples of the device to the system clock. The time of every
+//callback is filtered with a delay locked loop, which follows the real rate
+//of the device (its drift against the system clock) without the jitter of
+//the callbacks. The capture thread is the only writer and never waits: the
+//state is published with a sequence lock, and the readers retry if it
+//changed while they read it.
+class SampleClock {
+public:
+    struct Info {
+        uint64_t samples;   //Samples counted since the stream was opened
+        double rate;        //Measured sample rate in Hz
+        double driftPpm;    //Device rate against the nominal one
+        double jitter;      //Filtered callback time error, in ms
+        bool locked;
+    };
+
+    SampleClock(uint32_t sampleRate, double bandwidth = 0.1);
+
+    //Called from the capture thread, `time` is the monotonic time of the first sample in
+    //seconds. Returns the index of that sample
+    uint64_t update(double time, uint32_t frames);
+    //Before the capture starts
+    void reset();
+    //Restarts the loop from the next update, keeping the count of samples. For
+    //a stream that was reopened, whose time does not follow the previous one.
+    //Called from the capture thread
+    void resync();
+
+    //Wall clock time of `sample` in ms since the epoch, like Date.now()
+    double timeOf(uint64_t sample) const;
+    //Ratio to feed a resampler so its output follows the system clock
+    double correctionRatio() const;
+    void getInfo(Info &) const;
+    uint32_t nominalRate() const { return sampleRate; }
+
+    //Monotonic time in seconds
+    static double now();
+
+private:
+    struct State {
+        uint64_t samples = 0;
+        uint64_t baseSample = 0;
+        double baseTime = 0;    //Filtered time of `baseSample`
+        double period = 0;      //Filtered seconds per sample
+        double jitter = 0;
+        double epochOffset = 0; //System clock - monotonic clock, in s
+        uint32_t updates = 0;
+    };
+
+    //Copy of the state for the readers, every field is atomic so a torn read is only discarded
+    struct Published {
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> baseSample{0};
+        std::atomic<double> baseTime{0};
+        std::atomic<double> period{0};
+        std::atomic<double> jitter{0};
+        std::atomic<double> epochOffset{0};
+        std::atomic<uint32_t> updates{0};
+    };
+
+    void publish();
+    State read() const;
+
+    const uint32_t sampleRate;
+    const double bandwidth;
+    State state; //Only used by the writer
+    Published published;
+    std::atomic<uint32_t> sequence{0}; //Odd while the writer publishes
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "ThreadConfig.hpp"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+//Every thread of an input reports the same failures, only the distinct ones are kept, up to this number
+static const size_t maxErrors = 32;
+
+void ThreadConfig::applyToCurrentThread(const char* name) const {
+    status->threads++;
+
+#ifdef _WIN32
+    if(policy != Normal && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        addError(std::string(name) + ": could not set the thread priority");
+    }
+
+    if(!cpus.empty()) {
+        DWORD_PTR mask = 0;
+        for(int cpu: cpus) {
+            if(cpu < 0 || cpu >= (int) (sizeof(DWORD_PTR) * 8)) {
+                addError(std::string(name) + ": CPU " + std::to_string(cpu) + " is out of range");
+                continue;
+            }
+            mask |= (DWORD_PTR) 1 << cpu;
+        }
+        if(mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+            addError(std::string(name) + ": could not set the CPU affinity");
+        }
+    }
+#else
+    if(policy != Normal) {
+        int sched = policy == Fifo ? SCHED_FIFO : SCHED_RR;
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = std::max(sched_get_priority_min(sched), std::min(priority, sched_get_priority_max(sched)));
+        int err = pthread_setschedparam(pthread_self(), sched, &param);
+        if(err != 0) {
+            addError(std::string(name) + ": could not set the real-time priority: " + strerror(err));
+        }
+    }
+
+    if(!cpus.empty()) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        int count = 0;
+        for(int cpu: cpus) {
+            if(cpu < 0 || cpu >= CPU_SETSIZE) {
+                addError(std::string(name) + ": CPU " + std::to_string(cpu) + " is out of range");
+                continue;
+            }
+            CPU_SET(cpu, &set);
+            count++;
+        }
+        int err = count != 0 ? pthread_setaffinity_np(pthread_self(), sizeof(set), &set) : 0;
+        if(err != 0) {
+            addError(std::string(name) + ": could not set the CPU affinity: " + strerror(err));
+        }
+#else
+        addError(std::string(name) + ": CPU affinity is not supported in this platform");
+#endif
+    }
+#endif
+}
+
+void ThreadConfig::lock(const void* data, size_t size) const {
+    if(!lockMemory || data == nullptr || size == 0) return;
+
+#ifdef _WIN32
+    bool ok = VirtualLock((LPVOID) data, size) != 0;
+#else
+    bool ok = mlock(data, size) == 0;
+#endif
+    if(ok) {
+        status->lockedBytes += size;
+    } else {
+        addError("Could not lock " + std::to_string(size) + " bytes of memory");
+    }
+}
+
+void ThreadConfig::unlock(const void* data, size_t size) const {
+    if(!lockMemory || data == nullptr || size == 0) return;
+
+#ifdef _WIN32
+    bool ok = VirtualUnlock((LPVOID) data, size) != 0;
+#else
+    bool ok = munlock(data, size) == 0;
+#endif
+    if(ok) {
+        status->lockedBytes -= size;
+    }
+}
+
+void ThreadConfig::addError(const std::string &error) const {
+    std::lock_guard<std::mutex> lock(status->mutex);
+    std::vector<std::string> &errors = status->errors;
+    if(errors.size() >= maxErrors || std::find(errors.begin(), errors.end(), error) != errors.end()) return;
+    errors.push_back(error);
+}
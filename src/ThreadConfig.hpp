@@ -0,0 +1,40 @@
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+//Scheduling of the native threads of an AudioInput (not the PortAudio one).
+//Failures are not fatal, they are collected and shown in the stats.
+struct ThreadConfig {
+    enum Policy { Normal, Fifo, RoundRobin };
+
+    struct Status {
+        std::atomic<uint32_t> threads{0};
+        std::atomic<uint64_t> lockedBytes{0};
+        std::mutex mutex;
+        std::vector<std::string> errors; //Without repetitions, the first ones only
+    };
+
+    Policy policy = Normal;
+    int priority = 0;
+    std::vector<int> cpus;
+    bool lockMemory = false;
+    bool lowPriority = false; //Jobs on the shared worker pool yield to the ones of other inputs
+    std::shared_ptr<Status> status = std::make_shared<Status>();
+
+    //Must be called from the thread to configure
+    void applyToCurrentThread(const char* name) const;
+    void lock(const void* data, size_t size) const;
+    void unlock(const void* data, size_t size) const;
+
+private:
+    void addError(const std::string &error) const;
+};
+
+#endif
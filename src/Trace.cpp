@@ -0,0 +1,191 @@
+#include "Trace.hpp"
+#include "NativeMemory.hpp"
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+namespace {
+
+    struct Event {
+        uint64_t time; //ns since the trace epoch
+        const char* name;
+        int64_t arg;
+        char phase;
+    };
+
+    //Single producer ring, only the owner thread writes into it
+    struct Ring {
+        static const uint32_t capacity = 8192;
+
+        Event events[capacity];
+        std::atomic<uint64_t> head{0};
+        //Set by the owner while it writes an event, stop() waits for it
+        std::atomic<bool> writing{false};
+        std::atomic<bool> inUse{true};
+        uint32_t tid;
+        std::atomic<const char*> threadName{nullptr};
+    };
+
+    //Free rings kept by start() for the threads that did not record yet
+    const size_t spareRings = 16;
+
+    std::mutex ringsMutex;
+    std::vector<Ring*> rings;
+    uint32_t nextTid = 1;
+    const auto epoch = std::chrono::steady_clock::now();
+
+    //Gives the ring back when the thread exits, so it can be reused by a new thread
+    struct RingOwner {
+        Ring* ring = nullptr;
+        const char* name = nullptr;
+        ~RingOwner() {
+            if(ring) ring->inUse = false;
+        }
+    };
+
+    thread_local RingOwner owner;
+
+    //Called from the capture callback, so it neither waits for the lock nor allocates
+    Ring* currentRing() {
+        if(owner.ring == nullptr) {
+            std::unique_lock<std::mutex> lock(ringsMutex, std::try_to_lock);
+            if(!lock.owns_lock()) return nullptr;
+            //Rings of finished threads keep their events until the next start(), so they can be dumped
+            for(Ring* ring: rings) {
+                if(!ring->inUse && ring->head == 0) {
+                    ring->inUse = true;
+                    ring->head = 0;
+                    ring->tid = nextTid++;
+                    ring->threadName = owner.name;
+                    owner.ring = ring;
+                    break;
+                }
+            }
+        }
+        return owner.ring;
+    }
+
+    //Called with the trace disabled, the events being written are finished when it returns
+    void waitForWriters() {
+        for(Ring* ring: rings) {
+            while(ring->writing.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void appendEscaped(std::string &out, const char* str) {
+        for(; *str; str++) {
+            char c = *str;
+            if(c == '"' || c == '\\') out += '\\';
+            if((unsigned char) c >= 0x20) out += c;
+        }
+    }
+
+}
+
+std::atomic<bool> Trace::enabled{false};
+
+bool Trace::isAvailable() {
+#ifdef AUDIO_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Trace::start() {
+    if(!isAvailable()) return;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        enabled = false;
+        waitForWriters();
+        size_t free = 0;
+        for(Ring* ring: rings) {
+            ring->head = 0;
+            if(!ring->inUse) free++;
+        }
+        for(; free < spareRings; free++) {
+            Ring* ring = new Ring;
+            ring->inUse = false;
+            rings.push_back(ring);
+            NativeMemory::add(sizeof(Ring));
+        }
+    }
+    enabled = true;
+}
+
+void Trace::stop() {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    enabled = false;
+    waitForWriters();
+}
+
+void Trace::record(Phase phase, const char* name, int64_t arg) {
+    Ring* ring = currentRing();
+    if(ring == nullptr) return;
+    //Checked again after flagging the ring, so stop() either sees the flag or this sees it disabled
+    ring->writing.store(true);
+    if(!enabled.load()) {
+        ring->writing.store(false, std::memory_order_release);
+        return;
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event &e = ring->events[head % Ring::capacity];
+    e.time = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    e.name = name;
+    e.arg = arg;
+    e.phase = phase;
+    ring->head.store(head + 1, std::memory_order_release);
+    ring->writing.store(false, std::memory_order_release);
+}
+
+void Trace::setThreadName(const char* name) {
+    owner.name = name;
+    if(owner.ring) owner.ring->threadName = name;
+}
+
+std::string Trace::dump() {
+    std::string out = "{\"traceEvents\":[";
+    bool first = true;
+    char line[256];
+
+    //The rings are never deleted, they are formatted without holding the lock
+    std::vector<Ring*> snapshot;
+    bool wasEnabled;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        wasEnabled = enabled.exchange(false);
+        waitForWriters();
+        snapshot = rings;
+    }
+    for(Ring* ring: snapshot) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t start = head > Ring::capacity ? head - Ring::capacity : 0;
+        if(head == 0) continue;
+
+        const char* threadName = ring->threadName;
+        if(threadName != nullptr) {
+            out += first ? "" : ",";
+            out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(ring->tid) + ",\"args\":{\"name\":\"";
+            appendEscaped(out, threadName);
+            out += "\"}}";
+            first = false;
+        }
+
+        for(uint64_t i = start; i < head; i++) {
+            const Event &e = ring->events[i % Ring::capacity];
+            const char* argName = e.phase == Counter ? "value" : "arg";
+            snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u%s,\"args\":{\"%s\":%lld}}",
+                first ? "" : ",", e.name, e.phase, e.time / 1000.0, ring->tid,
+                e.phase == Instant ? ",\"s\":\"t\"" : "", argName, (long long) e.arg);
+            out += line;
+            first = false;
+        }
+    }
+    out += "],\"displayTimeUnit\":\"ms\"}";
+    enabled = wasEnabled;
+    return out;
+}
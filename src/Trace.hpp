@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+//Low overhead trace of the capture path. Every thread writes fixed size
+//events into its own ring, allocated by start() and taken without waiting
+//on a lock, and the rings are dumped as Chrome trace-event JSON (can be
+//opened in Perfetto or chrome://tracing).
+//Compiled only with AUDIO_TRACE defined, and recording only while enabled.
+class Trace {
+public:
+    enum Phase : char { Begin = 'B', End = 'E', Instant = 'i', Counter = 'C' };
+
+    static bool isAvailable();
+    //Allocates the rings of the threads that will record, the events of a thread without one are dropped
+    static void start();
+    //Returns once no thread is writing events
+    static void stop();
+    //Recording is paused meanwhile, the rings are not read while they are written
+    static std::string dump();
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void record(Phase phase, const char* name, int64_t arg);
+    //The name must be a static string
+    static void setThreadName(const char* name);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+//The end is only recorded if the begin was, a scope open across start() is left out
+class TraceScope {
+public:
+    TraceScope(const char* name, int64_t arg): name(name), active(Trace::isEnabled()) {
+        if(active) Trace::record(Trace::Begin, name, arg);
+    }
+    ~TraceScope() {
+        if(active) Trace::record(Trace::End, name, 0);
+    }
+
+private:
+    const char* name;
+    const bool active;
+};
+
+#ifdef AUDIO_TRACE
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name, arg) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, arg)
+#define TRACE_INSTANT(name, arg) do { if(Trace::isEnabled()) Trace::record(Trace::Instant, name, arg); } while(0)
+#define TRACE_COUNTER(name, value) do { if(Trace::isEnabled()) Trace::record(Trace::Counter, name, value); } while(0)
+#define TRACE_THREAD_NAME(name) Trace::setThreadName(name)
+#else
+#define TRACE_SCOPE(name, arg) do {} while(0)
+#define TRACE_INSTANT(name, arg) do {} while(0)
+#define TRACE_COUNTER(name, value) do {} while(0)
+#define TRACE_THREAD_NAME(name) do {} while(0)
+#endif
+
+#endif
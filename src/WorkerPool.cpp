@@ -0,0 +1,186 @@
+#include "WorkerPool.hpp"
+#include "Trace.hpp"
+#include <chrono>
+#include <algorithm>
+
+//Index of the worker running in this thread, -1 for the other threads
+static thread_local int currentWorker = -1;
+
+WorkerPool::Strand::Strand(Priority priority, Callback callback, void* userData):
+    priority(priority), callback(callback), userData(userData) {}
+
+WorkerPool::Strand::~Strand() {
+    //A queued strand is still referenced by the pool, the worker that takes it sees it closed
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    idle.wait(lock, [this]() { return state == Idle; });
+}
+
+void WorkerPool::Strand::signal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(closed) return;
+        if(state == Running) {
+            state = RunAgain;
+            return;
+        }
+        if(state != Idle) return;
+        state = Queued;
+        queuedAt = WorkerPool::now();
+    }
+    WorkerPool::get().push(this);
+}
+
+WorkerPool& WorkerPool::get() {
+    //Never destroyed, the workers are idle or gone when the process exits
+    static WorkerPool* pool = new WorkerPool();
+    return *pool;
+}
+
+WorkerPool::WorkerPool() {
+    size_t count = std::max(1u, std::thread::hardware_concurrency());
+    lastStats = now();
+    for(size_t i = 0; i < count; i++) {
+        workers.emplace_back(new Worker);
+    }
+    for(size_t i = 0; i < count; i++) {
+        workers[i]->thread = std::thread(&WorkerPool::run, this, i);
+        workers[i]->thread.detach();
+    }
+}
+
+uint64_t WorkerPool::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void WorkerPool::getStats(Stats &stats) {
+    uint64_t busy = 0;
+    for(auto &worker: workers) {
+        busy += worker->busyNs;
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    uint64_t time = now();
+    double elapsed = (double) (time - lastStats) * workers.size();
+    stats.workers = (uint32_t) workers.size();
+    stats.jobs = jobs;
+    stats.steals = steals;
+    stats.utilization = elapsed > 0 ? std::min(1.0, (busy - lastBusyNs) / elapsed) : 0;
+    for(int p = 0; p < 2; p++) {
+        stats.avgWait[p] = waits[p] != 0 ? waitNs[p] / 1e6 / waits[p] : 0;
+        stats.maxWait[p] = maxWaitNs[p] / 1e6;
+        waits[p] = waitNs[p] = maxWaitNs[p] = 0;
+    }
+    lastStats = time;
+    lastBusyNs = busy;
+}
+
+void WorkerPool::push(Strand* strand) {
+    //Strands queued from a worker stay in it, the others are spread over all the workers
+    size_t index = currentWorker >= 0 ? (size_t) currentWorker : nextWorker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->queues[strand->priority].push_back(strand);
+    }
+
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    queued++;
+    if(sleeping > 0) {
+        wakeUp.notify_one();
+    }
+}
+
+WorkerPool::Strand* WorkerPool::take(size_t index) {
+    //High priority strands of any worker go before the low priority ones of this worker.
+    //The owner takes the oldest strand, thieves take from the other end.
+    for(int p = 0; p < 2; p++) {
+        {
+            Worker &own = *workers[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.queues[p].empty()) {
+                Strand* strand = own.queues[p].front();
+                own.queues[p].pop_front();
+                return strand;
+            }
+        }
+
+        for(size_t i = 1; i < workers.size(); i++) {
+            Worker &victim = *workers[(index + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.queues[p].empty()) {
+                Strand* strand = victim.queues[p].back();
+                victim.queues[p].pop_back();
+                std::lock_guard<std::mutex> statsLock(statsMutex);
+                steals++;
+                return strand;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void WorkerPool::run(size_t index) {
+    currentWorker = (int) index;
+    TRACE_THREAD_NAME("worker");
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleeping++;
+            wakeUp.wait(lock, [this]() { return queued > 0; });
+            sleeping--;
+            queued--;
+        }
+
+        //The counter only says that a strand was queued, another worker may have stolen it
+        Strand* strand = take(index);
+        if(strand != nullptr) {
+            execute(strand, index);
+        }
+    }
+}
+
+void WorkerPool::execute(Strand* strand, size_t index) {
+    uint64_t start = now();
+    {
+        std::lock_guard<std::mutex> lock(strand->mutex);
+        if(strand->closed) {
+            strand->state = Strand::Idle;
+            strand->idle.notify_all();
+            return;
+        }
+        strand->state = Strand::Running;
+
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        uint64_t wait = start - strand->queuedAt;
+        int p = strand->priority;
+        jobs++;
+        waits[p]++;
+        waitNs[p] += wait;
+        maxWaitNs[p] = std::max(maxWaitNs[p], wait);
+    }
+
+    bool more;
+    {
+        TRACE_SCOPE("worker job", strand->priority);
+        more = strand->callback(strand->userData);
+    }
+    workers[index]->busyNs += now() - start;
+
+    bool requeue = false;
+    {
+        std::lock_guard<std::mutex> lock(strand->mutex);
+        if(!strand->closed && (more || strand->state == Strand::RunAgain)) {
+            strand->state = Strand::Queued;
+            strand->queuedAt = now();
+            requeue = true;
+        } else {
+            strand->state = Strand::Idle;
+            strand->idle.notify_all();
+        }
+    }
+
+    //Behind the other queued strands, so a busy stream does not starve them
+    if(requeue) {
+        push(strand);
+    }
+}
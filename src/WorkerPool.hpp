@@ -0,0 +1,95 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+//Worker threads shared by all the AudioInput instances, one per CPU, so many
+//inputs do not multiply the native threads. Every worker has its own queues
+//(one per priority) and idle workers steal from the others. The per-chunk jobs
+//of a stream are run through a Strand, which keeps them in order.
+class WorkerPool {
+public:
+    enum Priority { High, Low };
+
+    //Returns true if there is more work, the strand is queued again
+    typedef bool (*Callback)(void*);
+
+    //Runs its callback on any worker but never on two at the same time.
+    //Signals received while it runs make it run once more afterwards.
+    class Strand {
+    public:
+        Strand(Priority priority, Callback callback, void* userData);
+        //Waits for the callback if it is running, it must not be called from it
+        ~Strand();
+
+        //Can be called from any thread, it never blocks on the callback
+        void signal();
+
+    private:
+        friend class WorkerPool;
+        enum State { Idle, Queued, Running, RunAgain };
+
+        const Priority priority;
+        Callback callback;
+        void* userData;
+
+        std::mutex mutex;
+        std::condition_variable idle;
+        State state = Idle;
+        bool closed = false;
+        uint64_t queuedAt = 0;
+    };
+
+    struct Stats {
+        uint32_t workers;
+        uint64_t jobs;
+        uint64_t steals;
+        double utilization; //Busy time of the workers since the last call, from 0 to 1
+        double avgWait[2]; //ms in the queue since the last call, by priority
+        double maxWait[2];
+    };
+
+    static WorkerPool& get();
+    void getStats(Stats &);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Strand*> queues[2];
+        std::thread thread;
+        std::atomic<uint64_t> busyNs{0};
+    };
+
+    WorkerPool();
+    void push(Strand* strand);
+    Strand* take(size_t index);
+    void run(size_t index);
+    void execute(Strand* strand, size_t index);
+    static uint64_t now();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker{0};
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    size_t sleeping = 0;
+
+    std::mutex statsMutex;
+    uint64_t jobs = 0;
+    uint64_t steals = 0;
+    uint64_t waits[2] = { 0, 0 };
+    uint64_t waitNs[2] = { 0, 0 };
+    uint64_t maxWaitNs[2] = { 0, 0 };
+    uint64_t lastStats;
+    uint64_t lastBusyNs = 0;
+};
+
+#endif
@@ -2,7 +2,7 @@
 #define DL
 
 #ifdef WIN32
-#define WIN32_MEAN_AND_LEAN
+#define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #define LIBRARY_EXTENSION "dll"
 #else
@@ -40,9 +40,12 @@ public:
         return Library::load(filename, LIBRARY_EXTENSION);
     }
 
+    //Adds the extension to the names without one, so a relative path to a library is used as is
     static Library* load(const std::string &filename, const std::string &ext) {
         std::string f(filename);
-        if(f[0] != '/') {
+        size_t name = f.find_last_of("/\\");
+        bool hasExtension = f.find('.', name == std::string::npos ? 0 : name + 1) != std::string::npos;
+        if(f[0] != '/' && !hasExtension) {
             f += "." + ext;
         }
 
@@ -86,6 +89,14 @@ public:
         return reinterpret_cast<Type>(ptr);
     }
 
+    //Stores the address of `symbol`, or its name in `missing` if the library does not have it
+    template<typename Type>
+    bool getSymbol(const char* symbol, Type &address, const char* &missing) {
+        address = getSymbolAddress<Type>(symbol);
+        if(address == nullptr) missing = symbol;
+        return address != nullptr;
+    }
+
     static std::string getLastError() {
         std::string error;
 #ifdef WIN32
@@ -104,7 +115,8 @@ public:
         error = (char*) lpMsgBuf;
         LocalFree(lpMsgBuf);
 #else
-        error = dlerror();
+        const char* text = dlerror();
+        error = text != nullptr ? text : "";
 #endif
         return error;
     }
@@ -0,0 +1,63 @@
+#include "PcmKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+KERNEL_TARGET("avx2")
+static void int16ToFloat(const int16_t* in, float* out, size_t samples) {
+    const __m256 k = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+    }
+    pcmKernelsScalar.int16ToFloat(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("avx2")
+static void floatToInt16(const float* in, int16_t* out, size_t samples) {
+    const __m256 k = _mm256_set1_ps(32767.0f);
+    const __m256 one = _mm256_set1_ps(1.0f), minusOne = _mm256_set1_ps(-1.0f);
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), minusOne), one);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i + 8), minusOne), one);
+        __m256i ia = _mm256_cvtps_epi32(_mm256_mul_ps(a, k));
+        __m256i ib = _mm256_cvtps_epi32(_mm256_mul_ps(b, k));
+        //packs works in 128 bit lanes, the permutation puts the samples back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(ia, ib), 0xD8);
+        _mm256_storeu_si256((__m256i*) (out + i), packed);
+    }
+    pcmKernelsScalar.floatToInt16(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("avx2")
+static void scale(float* data, float gain, size_t samples) {
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), g));
+    }
+    pcmKernelsScalar.scale(data + i, gain, samples - i);
+}
+
+KERNEL_TARGET("avx2")
+static float peak(const float* data, size_t samples) {
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 max = _mm256_setzero_ps();
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        max = _mm256_max_ps(max, _mm256_and_ps(_mm256_loadu_ps(data + i), absMask));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, max);
+    float result = pcmKernelsScalar.peak(data + i, samples - i);
+    for(float v: lanes) if(v > result) result = v;
+    return result;
+}
+
+static const PcmKernelSet kernels = { "avx2", int16ToFloat, floatToInt16, scale, peak };
+const PcmKernelSet* pcmKernelsAvx2 = &kernels;
+#else
+const PcmKernelSet* pcmKernelsAvx2 = nullptr;
+#endif
@@ -0,0 +1,56 @@
+#include "PcmKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+KERNEL_TARGET("avx512f")
+static void int16ToFloat(const int16_t* in, float* out, size_t samples) {
+    const __m512 k = _mm512_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*) (in + i)));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), k));
+    }
+    pcmKernelsScalar.int16ToFloat(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("avx512f")
+static void floatToInt16(const float* in, int16_t* out, size_t samples) {
+    const __m512 k = _mm512_set1_ps(32767.0f);
+    const __m512 one = _mm512_set1_ps(1.0f), minusOne = _mm512_set1_ps(-1.0f);
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+        __m512 a = _mm512_min_ps(_mm512_max_ps(_mm512_loadu_ps(in + i), minusOne), one);
+        __m512i ia = _mm512_cvtps_epi32(_mm512_mul_ps(a, k));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm512_cvtsepi32_epi16(ia));
+    }
+    pcmKernelsScalar.floatToInt16(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("avx512f")
+static void scale(float* data, float gain, size_t samples) {
+    const __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+        _mm512_storeu_ps(data + i, _mm512_mul_ps(_mm512_loadu_ps(data + i), g));
+    }
+    pcmKernelsScalar.scale(data + i, gain, samples - i);
+}
+
+KERNEL_TARGET("avx512f")
+static float peak(const float* data, size_t samples) {
+    __m512 max = _mm512_setzero_ps();
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+        max = _mm512_max_ps(max, _mm512_abs_ps(_mm512_loadu_ps(data + i)));
+    }
+    float result = pcmKernelsScalar.peak(data + i, samples - i);
+    float lanes = _mm512_reduce_max_ps(max);
+    return lanes > result ? lanes : result;
+}
+
+static const PcmKernelSet kernels = { "avx512", int16ToFloat, floatToInt16, scale, peak };
+const PcmKernelSet* pcmKernelsAvx512 = &kernels;
+#else
+const PcmKernelSet* pcmKernelsAvx512 = nullptr;
+#endif
@@ -0,0 +1,54 @@
+#include "PcmKernels.hpp"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+
+static void int16ToFloat(const int16_t* in, float* out, size_t samples) {
+    const float32x4_t k = vdupq_n_f32(1.0f / 32768.0f);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        int16x8_t v = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), k));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), k));
+    }
+    pcmKernelsScalar.int16ToFloat(in + i, out + i, samples - i);
+}
+
+static void floatToInt16(const float* in, int16_t* out, size_t samples) {
+    const float32x4_t k = vdupq_n_f32(32767.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f), minusOne = vdupq_n_f32(-1.0f);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        float32x4_t a = vminq_f32(vmaxq_f32(vld1q_f32(in + i), minusOne), one);
+        float32x4_t b = vminq_f32(vmaxq_f32(vld1q_f32(in + i + 4), minusOne), one);
+        int16x4_t ia = vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(a, k)));
+        int16x4_t ib = vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(b, k)));
+        vst1q_s16(out + i, vcombine_s16(ia, ib));
+    }
+    pcmKernelsScalar.floatToInt16(in + i, out + i, samples - i);
+}
+
+static void scale(float* data, float gain, size_t samples) {
+    size_t i = 0;
+    for(; i + 4 <= samples; i += 4) {
+        vst1q_f32(data + i, vmulq_n_f32(vld1q_f32(data + i), gain));
+    }
+    pcmKernelsScalar.scale(data + i, gain, samples - i);
+}
+
+static float peak(const float* data, size_t samples) {
+    float32x4_t max = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for(; i + 4 <= samples; i += 4) {
+        max = vmaxq_f32(max, vabsq_f32(vld1q_f32(data + i)));
+    }
+    float result = pcmKernelsScalar.peak(data + i, samples - i);
+    float lanes = vmaxvq_f32(max);
+    return lanes > result ? lanes : result;
+}
+
+static const PcmKernelSet kernels = { "neon", int16ToFloat, floatToInt16, scale, peak };
+const PcmKernelSet* pcmKernelsNeon = &kernels;
+#else
+const PcmKernelSet* pcmKernelsNeon = nullptr;
+#endif
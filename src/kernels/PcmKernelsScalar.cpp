@@ -0,0 +1,28 @@
+#include "PcmKernels.hpp"
+#include <cmath>
+
+static void int16ToFloat(const int16_t* in, float* out, size_t samples) {
+    for(size_t i = 0; i < samples; i++) out[i] = in[i] / 32768.0f;
+}
+
+static void floatToInt16(const float* in, int16_t* out, size_t samples) {
+    for(size_t i = 0; i < samples; i++) {
+        float v = in[i] > 1.0f ? 1.0f : (in[i] < -1.0f ? -1.0f : in[i]);
+        out[i] = (int16_t) lrintf(v * 32767.0f);
+    }
+}
+
+static void scale(float* data, float gain, size_t samples) {
+    for(size_t i = 0; i < samples; i++) data[i] *= gain;
+}
+
+static float peak(const float* data, size_t samples) {
+    float max = 0.0f;
+    for(size_t i = 0; i < samples; i++) {
+        float v = std::fabs(data[i]);
+        if(v > max) max = v;
+    }
+    return max;
+}
+
+const PcmKernelSet pcmKernelsScalar = { "scalar", int16ToFloat, floatToInt16, scale, peak };
@@ -0,0 +1,64 @@
+#include "PcmKernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+
+KERNEL_TARGET("sse2")
+static void int16ToFloat(const int16_t* in, float* out, size_t samples) {
+    const __m128 k = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+    }
+    pcmKernelsScalar.int16ToFloat(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("sse2")
+static void floatToInt16(const float* in, int16_t* out, size_t samples) {
+    const __m128 k = _mm_set1_ps(32767.0f);
+    const __m128 one = _mm_set1_ps(1.0f), minusOne = _mm_set1_ps(-1.0f);
+    size_t i = 0;
+    for(; i + 8 <= samples; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), minusOne), one);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), minusOne), one);
+        __m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, k));
+        __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, k));
+        _mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(ia, ib));
+    }
+    pcmKernelsScalar.floatToInt16(in + i, out + i, samples - i);
+}
+
+KERNEL_TARGET("sse2")
+static void scale(float* data, float gain, size_t samples) {
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for(; i + 4 <= samples; i += 4) {
+        _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), g));
+    }
+    pcmKernelsScalar.scale(data + i, gain, samples - i);
+}
+
+KERNEL_TARGET("sse2")
+static float peak(const float* data, size_t samples) {
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 max = _mm_setzero_ps();
+    size_t i = 0;
+    for(; i + 4 <= samples; i += 4) {
+        max = _mm_max_ps(max, _mm_and_ps(_mm_loadu_ps(data + i), absMask));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, max);
+    float result = pcmKernelsScalar.peak(data + i, samples - i);
+    for(float v: lanes) if(v > result) result = v;
+    return result;
+}
+
+static const PcmKernelSet kernels = { "sse2", int16ToFloat, floatToInt16, scale, peak };
+const PcmKernelSet* pcmKernelsSse2 = &kernels;
+#else
+const PcmKernelSet* pcmKernelsSse2 = nullptr;
+#endif
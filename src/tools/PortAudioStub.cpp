@@ -0,0 +1,236 @@
+//Minimal PortAudio with one input device that produces a sine, paced by the
+//system clock. It is loaded like the real library (`--library` in the capture
+//tool or `AudioInput.loadNativeLibrary()`), so the capture path can be profiled
+//on machines without audio hardware. PA_STUB_FREQUENCY changes the tone (Hz)
+//and PA_STUB_DEVICES adds more devices, to measure the lookups by name. The
+//second device belongs to a second host API, "Stub JACK". PA_STUB_STALL_AFTER
+//stops the callbacks of the first device after that many seconds (once), and
+//with PA_STUB_UNPLUG=1 it cannot be opened again, like an unplugged device.
+//PA_STUB_HANG_ABORT=seconds makes the abort of that stalled stream hang too.
+//The devices are listed again by Pa_Initialize, to simulate hot-plugging.
+#include "portaudio.h"
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#define STUB_EXPORT extern "C" __declspec(dllexport)
+#else
+#define STUB_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+struct StubStream {
+    PaStreamParameters params;
+    PaStreamInfo info;
+    double sampleRate;
+    unsigned long framesPerBuffer;
+    PaStreamCallback* callback;
+    void* userData;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> hung{false};
+    double phase = 0;
+};
+
+static const PaDeviceInfo device = { 2, "Stub sine", 0, 2, 0, 0.01, 0.01, 0.1, 0.1, 48000 };
+
+static std::vector<std::string> names;
+static std::vector<PaDeviceInfo> list;
+
+//The first one is `device`, the others are copies named so that no name is
+//part of another, the lookups by name must go through all of them
+static void scanDevices() {
+    names.clear();
+    list.clear();
+    int count = getenv("PA_STUB_DEVICES") ? std::max(1, atoi(getenv("PA_STUB_DEVICES"))) : 1;
+    for(int i = 1; i < count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Stub input %03d", i);
+        names.push_back(name);
+    }
+    list.push_back(device);
+    for(auto &name: names) {
+        list.push_back(device);
+        list.back().name = name.c_str();
+    }
+    if(list.size() > 1) {
+        list[1].hostApi = 1;
+    }
+}
+
+static const std::vector<PaDeviceInfo>& devices() {
+    if(list.empty()) {
+        scanDevices();
+    }
+    return list;
+}
+
+static PaHostApiInfo hostApis[2] = {
+    { 1, paInDevelopment, "Stub", 1, 0, -1 },
+    { 1, paJACK, "Stub JACK", 1, 1, -1 }
+};
+
+static std::atomic<bool> stalled{false};
+static std::atomic<bool> unplugged{false};
+
+static double monotonicTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void fillSine(StubStream* s, std::vector<char> &buffer, unsigned long frames) {
+    static const double frequency = getenv("PA_STUB_FREQUENCY") ? atof(getenv("PA_STUB_FREQUENCY")) : 440.0;
+    int channels = s->params.channelCount;
+    double step = 2 * M_PI * frequency / s->sampleRate;
+    for(unsigned long i = 0; i < frames; i++) {
+        double value = 0.5 * sin(s->phase);
+        s->phase += step;
+        for(int c = 0; c < channels; c++) {
+            size_t n = i * channels + c;
+            switch(s->params.sampleFormat) {
+                case paInt8: ((int8_t*) buffer.data())[n] = (int8_t) (value * 127); break;
+                case paInt16: ((int16_t*) buffer.data())[n] = (int16_t) (value * 32767); break;
+                case paInt24: {
+                    int32_t v = (int32_t) (value * 8388607);
+                    memcpy(buffer.data() + n * 3, &v, 3); //Little endian
+                    break;
+                }
+                default: ((float*) buffer.data())[n] = (float) value; break;
+            }
+        }
+    }
+    s->phase = fmod(s->phase, 2 * M_PI);
+}
+
+static void run(StubStream* s) {
+    size_t sampleBytes = s->params.sampleFormat == paInt8 ? 1 : s->params.sampleFormat == paInt16 ? 2 : s->params.sampleFormat == paInt24 ? 3 : 4;
+    std::vector<char> buffer(s->framesPerBuffer * s->params.channelCount * sampleBytes);
+    auto period = std::chrono::duration<double>(s->framesPerBuffer / s->sampleRate);
+    static const double stallAfter = getenv("PA_STUB_STALL_AFTER") ? atof(getenv("PA_STUB_STALL_AFTER")) : 0;
+    double start = monotonicTime();
+    auto next = std::chrono::steady_clock::now();
+    while(s->running) {
+        //Like a device, the audio of a buffer is delivered when it has been captured
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        std::this_thread::sleep_until(next);
+        if(stallAfter > 0 && s->params.device == 0 && monotonicTime() - start >= stallAfter && !stalled.exchange(true)) {
+            unplugged = getenv("PA_STUB_UNPLUG") != nullptr && atoi(getenv("PA_STUB_UNPLUG")) != 0;
+            //Hung driver, until the stream is aborted
+            s->hung = true;
+            while(s->running) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            break;
+        }
+        fillSine(s, buffer, s->framesPerBuffer);
+
+        PaStreamCallbackTimeInfo timeInfo;
+        timeInfo.currentTime = monotonicTime();
+        timeInfo.inputBufferAdcTime = timeInfo.currentTime - period.count();
+        timeInfo.outputBufferDacTime = 0;
+        if(s->callback(buffer.data(), nullptr, s->framesPerBuffer, &timeInfo, 0, s->userData) != paContinue) {
+            break;
+        }
+    }
+}
+
+STUB_EXPORT PaError Pa_Initialize(void) {
+    scanDevices();
+    return paNoError;
+}
+
+STUB_EXPORT PaError Pa_Terminate(void) { return paNoError; }
+
+STUB_EXPORT const char* Pa_GetErrorText(PaError err) {
+    switch(err) {
+        case paNoError: return "Success";
+        case paInvalidDevice: return "Invalid device";
+        case paInvalidChannelCount: return "Invalid number of channels";
+        case paBadStreamPtr: return "Invalid stream pointer";
+        case paStreamIsNotStopped: return "Stream is not stopped";
+        case paDeviceUnavailable: return "Device unavailable";
+        default: return "Unknown error";
+    }
+}
+
+STUB_EXPORT PaDeviceIndex Pa_GetDeviceCount(void) { return (PaDeviceIndex) devices().size(); }
+STUB_EXPORT PaDeviceIndex Pa_GetDefaultInputDevice(void) { return 0; }
+
+STUB_EXPORT const PaDeviceInfo* Pa_GetDeviceInfo(PaDeviceIndex index) {
+    return index >= 0 && index < Pa_GetDeviceCount() ? &devices()[index] : nullptr;
+}
+
+STUB_EXPORT PaHostApiIndex Pa_GetHostApiCount(void) { return Pa_GetDeviceCount() > 1 ? 2 : 1; }
+
+STUB_EXPORT const PaHostApiInfo* Pa_GetHostApiInfo(PaHostApiIndex index) {
+    if(index < 0 || index >= Pa_GetHostApiCount()) return nullptr;
+    hostApis[0].deviceCount = Pa_GetDeviceCount() - (Pa_GetHostApiCount() - 1);
+    return &hostApis[index];
+}
+
+STUB_EXPORT PaError Pa_IsFormatSupported(const PaStreamParameters* in, const PaStreamParameters*, double) {
+    if(in == nullptr || in->device < 0 || in->device >= Pa_GetDeviceCount()) return paInvalidDevice;
+    if(in->channelCount < 1 || in->channelCount > device.maxInputChannels) return paInvalidChannelCount;
+    return paNoError;
+}
+
+STUB_EXPORT PaError Pa_OpenStream(PaStream** stream, const PaStreamParameters* in, const PaStreamParameters*,
+                                  double sampleRate, unsigned long framesPerBuffer, PaStreamFlags,
+                                  PaStreamCallback* callback, void* userData) {
+    PaError err = Pa_IsFormatSupported(in, nullptr, sampleRate);
+    if(err != paNoError) return err;
+    if(unplugged && in->device == 0) return paDeviceUnavailable;
+
+    StubStream* s = new StubStream;
+    s->params = *in;
+    s->sampleRate = sampleRate;
+    s->framesPerBuffer = framesPerBuffer != paFramesPerBufferUnspecified ? framesPerBuffer : 256;
+    s->callback = callback;
+    s->userData = userData;
+    //Like the drivers, the latency is at least one buffer
+    s->info = { 1, std::max(in->suggestedLatency, s->framesPerBuffer / sampleRate), 0, sampleRate };
+    *stream = s;
+    return paNoError;
+}
+
+STUB_EXPORT const PaStreamInfo* Pa_GetStreamInfo(PaStream* stream) {
+    return stream != nullptr ? &((StubStream*) stream)->info : nullptr;
+}
+
+STUB_EXPORT PaError Pa_StartStream(PaStream* stream) {
+    StubStream* s = (StubStream*) stream;
+    if(s == nullptr) return paBadStreamPtr;
+    if(s->running) return paStreamIsNotStopped;
+    s->running = true;
+    s->thread = std::thread(run, s);
+    return paNoError;
+}
+
+STUB_EXPORT PaError Pa_StopStream(PaStream* stream) {
+    StubStream* s = (StubStream*) stream;
+    if(s == nullptr) return paBadStreamPtr;
+    s->running = false;
+    if(s->thread.joinable()) s->thread.join();
+    return paNoError;
+}
+
+STUB_EXPORT PaError Pa_AbortStream(PaStream* stream) {
+    static const double hangAbort = getenv("PA_STUB_HANG_ABORT") ? atof(getenv("PA_STUB_HANG_ABORT")) : 0;
+    if(stream != nullptr && ((StubStream*) stream)->hung && hangAbort > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(hangAbort));
+    }
+    return Pa_StopStream(stream);
+}
+
+STUB_EXPORT PaError Pa_CloseStream(PaStream* stream) {
+    PaError err = Pa_StopStream(stream);
+    delete (StubStream*) stream;
+    return err;
+}
@@ -0,0 +1,232 @@
+//Benchmarks of the pieces of the capture path, each one alone and with the
+//sizes of real streams. The results are printed as JSON, to compare them
+//between versions.
+//
+//  bench [--library path] [--filter text] [--time ms]
+//
+//The Buffer created for every 'data' event is V8 work and is not measured
+//here, `drain` covers the native side of the emit.
+#include "AudioInput.hpp"
+#include "AudioBuffer.hpp"
+#include "MessageQueue.hpp"
+#include "PcmFormat.hpp"
+#include "PcmKernels.hpp"
+#include "portaudio.h"
+#include "dl.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+//The PortAudio callback of the core, called directly without a running stream
+int stream_cbk(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
+               PaStreamCallbackFlags statusFlags, void* userData);
+
+static std::string filter;
+static double batchTime = 20; //ms
+static std::vector<std::string> results;
+static std::string lastError;
+
+//Runs `batch(n)`, which does n operations and returns the ns spent in them
+static void measure(const std::string &name, const std::string &params, double bytesPerOp,
+                    std::function<uint64_t(uint64_t)> batch) {
+    std::string fullName = name + " " + params;
+    if(!filter.empty() && fullName.find(filter) == std::string::npos) return;
+
+    //Enough operations for a batch of about `batchTime`
+    uint64_t n = 1;
+    batch(n);
+    while(true) {
+        uint64_t ns = batch(n);
+        if(ns >= batchTime * 1e6 || n >= (1ull << 32)) break;
+        n = ns < 1000 ? n * 100 : std::max(n + 1, (uint64_t) (n * batchTime * 1e6 / ns));
+    }
+
+    std::vector<double> perOp;
+    for(int i = 0; i < 7; i++) {
+        perOp.push_back((double) batch(n) / n);
+    }
+    std::sort(perOp.begin(), perOp.end());
+    double median = perOp[perOp.size() / 2];
+
+    char json[512];
+    snprintf(json, sizeof(json),
+        "{\"name\": \"%s\", \"params\": {%s}, \"iterations\": %llu, \"ns\": %.2f, \"minNs\": %.2f, \"bytesPerSecond\": %.0f}",
+        name.c_str(), params.c_str(), (unsigned long long) n, median, perOp[0], bytesPerOp > 0 ? bytesPerOp * 1e9 / median : 0);
+    results.push_back(json);
+    fprintf(stderr, "%-24s %-48s %10.1f ns\n", name.c_str(), params.c_str(), median);
+}
+
+static uint64_t nsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void releaseChunk(uint32_t, const void* pcm, uint64_t, bool, void*) {
+    AudioBuffer::release(pcm);
+}
+
+static void benchCallback(uint32_t frames, uint32_t framesPerChunk) {
+    AudioInput::Options opt = AudioInput::Options();
+    opt.sampleRate = 48000;
+    opt.bitsPerSample = 16;
+    opt.channels = 2;
+    opt.framesPerChunk = framesPerChunk;
+    AudioInput input(opt);
+    if(!lastError.empty()) return;
+    input.setInputCallback(releaseChunk);
+
+    std::vector<int16_t> pcm(frames * 2, 1000);
+    PaStreamCallbackTimeInfo timeInfo = { 0, 0, 0 };
+    char params[128];
+    snprintf(params, sizeof(params), "\"frames\": %u, \"framesPerChunk\": %u, \"bitsPerSample\": 16, \"channels\": 2", frames, framesPerChunk);
+    measure("stream_cbk", params, pcm.size() * 2, [&](uint64_t n) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < n; i++) {
+            stream_cbk(pcm.data(), nullptr, frames, &timeInfo, 0, &input);
+        }
+        return nsSince(start);
+    });
+}
+
+static void benchQueue(uint32_t frames) {
+    uint32_t size = frames * 4;
+    SampleClock clock(48000);
+    clock.update(SampleClock::now(), frames);
+    MessageQueue queue(4);
+    std::vector<const void*> chunks;
+    char params[128];
+    snprintf(params, sizeof(params), "\"frames\": %u, \"bitsPerSample\": 16, \"channels\": 2", frames);
+
+    //Chunks are allocated and released out of the timed loops, in batches like the queue sees them
+    const uint64_t batch = 64;
+    measure("enqueue", params, size, [&](uint64_t n) {
+        uint64_t ns = 0;
+        for(uint64_t done = 0; done < n; done += batch) {
+            uint64_t count = std::min(batch, n - done);
+            for(uint64_t i = 0; i < count; i++) chunks.push_back(AudioBuffer::alloc(size));
+            auto start = std::chrono::steady_clock::now();
+            for(uint64_t i = 0; i < count; i++) {
+                queue.push({ chunks[i], size, i * frames, clock.timeOf(i * frames) });
+            }
+            ns += nsSince(start);
+            queue.clear();
+            chunks.clear();
+        }
+        return ns;
+    });
+
+    measure("drain", params, size, [&](uint64_t n) {
+        uint64_t ns = 0;
+        MessageQueue::Message message;
+        for(uint64_t done = 0; done < n; done += batch) {
+            uint64_t count = std::min(batch, n - done);
+            for(uint64_t i = 0; i < count; i++) {
+                queue.push({ AudioBuffer::alloc(size), size, i * frames, 0 });
+            }
+            auto start = std::chrono::steady_clock::now();
+            while(queue.pop(message)) {
+                AudioBuffer::release(message.pcm);
+            }
+            ns += nsSince(start);
+        }
+        return ns;
+    });
+}
+
+static void benchConversion(uint8_t bitsPerSample, size_t samples, const std::string &level) {
+    std::vector<char> pcm(samples * bitsPerSample / 8, 0x11);
+    std::vector<float> floats(samples, 0.25f);
+    char params[128];
+    snprintf(params, sizeof(params), "\"bitsPerSample\": %u, \"samples\": %zu, \"kernel\": \"%s\"", bitsPerSample, samples, level.c_str());
+    measure("toFloat", params, pcm.size(), [&](uint64_t n) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < n; i++) {
+            PcmFormat::toFloat(pcm.data(), bitsPerSample, floats.data(), samples);
+        }
+        return nsSince(start);
+    });
+    measure("fromFloat", params, pcm.size(), [&](uint64_t n) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < n; i++) {
+            PcmFormat::fromFloat(floats.data(), bitsPerSample, pcm.data(), samples);
+        }
+        return nsSince(start);
+    });
+}
+
+static void benchDeviceLookup(const char* name, const char* label) {
+    char params[128];
+    snprintf(params, sizeof(params), "\"device\": \"%s\", \"devices\": %d", label, Pa_GetDeviceCount());
+    volatile int found = 0;
+    measure("findDevice", params, 0, [&](uint64_t n) {
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < n; i++) {
+            found = AudioInput::findDevice(name);
+        }
+        return nsSince(start);
+    });
+    (void) found;
+}
+
+static void onError(const char* error) {
+    lastError = error;
+}
+
+int main(int argc, char** argv) {
+    std::string library;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if(arg == "--library") library = argv[i + 1];
+        else if(arg == "--filter") filter = argv[i + 1];
+        else if(arg == "--time") batchTime = atof(argv[i + 1]);
+    }
+
+    //More devices for the lookups when the stub library is used
+    setenv("PA_STUB_DEVICES", "64", 0);
+    AudioInput::setErrorHandler(onError);
+    AudioInput::staticInit(library);
+    if(!AudioInput::isLoaded() || !lastError.empty()) {
+        //Without --library the default names are tried without reporting, the reason is the error of the last one
+        fprintf(stderr, "Could not load PortAudio: %s\n", lastError.empty() ? Library::getLastError().c_str() : lastError.c_str());
+        return 1;
+    }
+
+    for(uint32_t frames: { 256u, 480u, 1024u }) {
+        benchCallback(frames, 0);
+    }
+    benchCallback(480, 1152);
+    for(uint32_t frames: { 480u, 4800u }) {
+        benchQueue(frames);
+    }
+
+    std::string defaultLevel = PcmKernels::get().level;
+    for(uint8_t bits: { 8, 16, 24, 32 }) {
+        benchConversion(bits, 960 * 2, defaultLevel);
+    }
+    for(auto &level: PcmKernels::available()) {
+        if(level == defaultLevel) continue;
+        PcmKernels::setLevel(level);
+        benchConversion(16, 960 * 2, level);
+    }
+    PcmKernels::setLevel(defaultLevel);
+
+    const PaDeviceInfo* last = Pa_GetDeviceInfo(Pa_GetDeviceCount() - 1);
+    benchDeviceLookup(nullptr, "default");
+    if(last != nullptr) {
+        benchDeviceLookup(last->name, "last");
+    }
+    benchDeviceLookup("No such device", "missing");
+
+    printf("{\n  \"kernel\": \"%s\",\n  \"benchmarks\": [\n", defaultLevel.c_str());
+    for(size_t i = 0; i < results.size(); i++) {
+        printf("    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    AudioInput::staticDeinit();
+    return 0;
+}
@@ -0,0 +1,247 @@
+//Headless capture with the native core of the addon and without Node, to
+//profile the capture path with perf, valgrind or heaptrack. The audio is
+//written to a file or stdout with the same sink used by `pipeToFd`.
+//
+//  capture [--library path] [--device name] [--rate 48000] [--bits 16] [--channels 2]
+//          [--frame-ms 0] [--chunk-frames 0] [--seconds 0] [--output path|-]
+//          [--file path] [--callback-trace path] [--speed 1] [--loop 0]
+//          [--record-callbacks path] [--host-api name,...] [--latency low|high|ms]
+//          [--stall-timeout 0] [--fallback name,...]
+#include "AudioInput.hpp"
+#include "AudioBuffer.hpp"
+#include "FdSink.hpp"
+#include "dl.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static std::atomic<bool> interrupted{false};
+static std::atomic<bool> ended{false};
+static std::atomic<uint64_t> deliveredBytes{0};
+static std::atomic<uint64_t> deliveredChunks{0};
+static std::string lastError;
+
+static void onSignal(int) {
+    interrupted = true;
+}
+
+static void onError(const char* error) {
+    lastError = error;
+}
+
+static void onData(uint32_t size, const void* pcm, uint64_t, bool, void*) {
+    deliveredBytes += size;
+    deliveredChunks++;
+    AudioBuffer::release(pcm);
+}
+
+static void onEnd(void*) {
+    ended = true;
+}
+
+static void onStall(bool recovered, double gap, uint64_t sample, void*) {
+    if(recovered) {
+        fprintf(stderr, "recovered after %.1f ms at sample %llu\n", gap, (unsigned long long) sample);
+    } else {
+        fprintf(stderr, "stall: no callback for %.1f ms\n", gap);
+    }
+}
+
+//Splits a list separated by commas
+static void split(const std::string &list, std::vector<std::string> &items) {
+    for(size_t start = 0, end; start <= list.size(); start = end + 1) {
+        end = std::min(list.find(',', start), list.size());
+        items.push_back(list.substr(start, end - start));
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: capture [--library path] [--device name] [--rate 48000] [--bits 16] [--channels 2]\n"
+        "               [--frame-ms 0] [--chunk-frames 0] [--seconds 0] [--output path|-]\n"
+        "               [--file path] [--callback-trace path] [--speed 1] [--loop 0]\n"
+        "               [--record-callbacks path] [--host-api name,...] [--latency low|high|ms]\n"
+        "               [--stall-timeout 0] [--fallback name,...]\n");
+}
+
+int main(int argc, char** argv) {
+    AudioInput::Options opt = AudioInput::Options();
+    opt.sampleRate = 48000;
+    opt.bitsPerSample = 16;
+    opt.channels = 2;
+    opt.inputSpeed = 1;
+    std::string library, device, output, file, callbackTrace, recordCallbacks;
+    double seconds = 0;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if(arg == "--library") library = value;
+        else if(arg == "--device") device = value;
+        else if(arg == "--rate") opt.sampleRate = (uint32_t) atoi(value);
+        else if(arg == "--bits") opt.bitsPerSample = (uint8_t) atoi(value);
+        else if(arg == "--channels") opt.channels = (uint8_t) atoi(value);
+        else if(arg == "--frame-ms") opt.frameDuration = (uint16_t) atoi(value);
+        else if(arg == "--chunk-frames") opt.framesPerChunk = (uint32_t) atoi(value);
+        else if(arg == "--seconds") seconds = atof(value);
+        else if(arg == "--output") output = value;
+        else if(arg == "--file") file = value;
+        else if(arg == "--callback-trace") callbackTrace = value;
+        else if(arg == "--record-callbacks") recordCallbacks = value;
+        else if(arg == "--speed") opt.inputSpeed = atof(value);
+        else if(arg == "--loop") opt.inputLoop = atoi(value) != 0;
+        else if(arg == "--latency") opt.latency = !strcmp(value, "high") ? -1 : !strcmp(value, "low") ? 0 : atof(value);
+        else if(arg == "--host-api") split(value, opt.hostApis);
+        else if(arg == "--stall-timeout") opt.stallTimeout = (uint32_t) atoi(value);
+        else if(arg == "--fallback") split(value, opt.fallbackDevices);
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if(!device.empty()) {
+        opt.devName = device.c_str();
+    }
+    if(!file.empty()) {
+        opt.inputFile = file.c_str();
+    }
+    if(!callbackTrace.empty()) {
+        opt.callbackTrace = callbackTrace.c_str();
+    }
+
+    AudioInput::setErrorHandler(onError);
+    //The replays do not need PortAudio
+    bool isReplay = !file.empty() || !callbackTrace.empty();
+    if(!isReplay || !library.empty()) {
+        AudioInput::staticInit(library);
+    }
+    if((!isReplay && !AudioInput::isLoaded()) || !lastError.empty()) {
+        //Without --library the default names are tried without reporting, the reason is the error of the last one
+        fprintf(stderr, "Could not load PortAudio: %s\n", lastError.empty() ? Library::getLastError().c_str() : lastError.c_str());
+        return 1;
+    }
+
+    int fd = -1;
+    if(output == "-") {
+        fd = 1;
+    } else if(!output.empty()) {
+        fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            fprintf(stderr, "Could not open %s: %s\n", output.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    int result = 0;
+    {
+        AudioInput input(opt);
+        if(!lastError.empty() || !input.isOpen()) {
+            fprintf(stderr, "Could not open the device: %s\n", lastError.c_str());
+            AudioInput::staticDeinit();
+            return 1;
+        }
+        input.setInputCallback(onData);
+        input.setEndCallback(onEnd);
+        input.setStallCallback(onStall);
+        AudioInput::StreamInfo streamInfo;
+        if(input.getStreamInfo(streamInfo)) {
+            fprintf(stderr, "device: [%s] %s, latency %.1f ms\n", streamInfo.hostApi.c_str(), streamInfo.device.c_str(), streamInfo.inputLatency);
+        }
+
+        FdSink* sink = nullptr;
+        if(fd >= 0) {
+            std::string error;
+            sink = new FdSink({ fd, 64 * 1024, true }, opt);
+            if(!sink->start(error)) {
+                fprintf(stderr, "Could not write the output: %s\n", error.c_str());
+                delete sink;
+                AudioInput::staticDeinit();
+                return 1;
+            }
+            input.addSink(sink);
+        }
+
+        if(!recordCallbacks.empty()) {
+            std::string error;
+            if(!input.startCallbackTrace(recordCallbacks, error)) {
+                fprintf(stderr, "Could not record the callbacks: %s\n", error.c_str());
+                AudioInput::staticDeinit();
+                return 1;
+            }
+        }
+
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        auto start = std::chrono::steady_clock::now();
+        int err = input.open();
+        if(err != 0) {
+            fprintf(stderr, "Could not start the stream: %s\n", AudioInput::errorCodeToString(err));
+            result = 1;
+        }
+
+        while(result == 0 && !interrupted && !ended) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(seconds > 0 && elapsed >= seconds) break;
+        }
+
+        input.close();
+        uint64_t recorded, dropped;
+        if(input.stopCallbackTrace(recorded, dropped)) {
+            fprintf(stderr, "callback trace: %llu callbacks, %llu dropped\n", (unsigned long long) recorded, (unsigned long long) dropped);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        AudioInput::Stats stats;
+        input.getStats(stats);
+        if(sink != nullptr) {
+            input.removeSink(sink);
+            FdSink::Stats sinkStats;
+            sink->getStats(sinkStats);
+            fprintf(stderr, "output: %llu dropped chunks%s%s\n", (unsigned long long) sinkStats.droppedChunks,
+                sinkStats.lastError.empty() ? "" : ", ", sinkStats.lastError.c_str());
+            //Writes what is still queued
+            delete sink;
+        }
+
+        SampleClock::Info clock;
+        input.getClock().getInfo(clock);
+        fprintf(stderr, "elapsed: %.3f s\n", elapsed);
+        fprintf(stderr, "callbacks: %llu (%.1f/s)\n", (unsigned long long) stats.callbacks, stats.callbacks / elapsed);
+        fprintf(stderr, "chunks: %llu, %.0f bytes/s\n", (unsigned long long) deliveredChunks.load(), deliveredBytes / elapsed);
+        fprintf(stderr, "xruns: %llu overflows, %llu underflows\n",
+            (unsigned long long) stats.inputOverflows, (unsigned long long) stats.inputUnderflows);
+        fprintf(stderr, "max callback: %.1f us\n", stats.maxCallbackTime);
+        if(stats.droppedFrames != 0) {
+            fprintf(stderr, "dropped: %llu frames, the chunk pool was empty\n", (unsigned long long) stats.droppedFrames);
+        }
+        if(opt.stallTimeout != 0) {
+            fprintf(stderr, "stalls: %llu, %llu recovered\n", (unsigned long long) stats.stalls, (unsigned long long) stats.recoveries);
+        }
+        fprintf(stderr, "device rate: %.2f Hz (%.1f ppm), jitter %.3f ms\n", clock.rate, clock.driftPpm, clock.jitter);
+    }
+
+    if(fd > 1) {
+        close(fd);
+    }
+    AudioInput::staticDeinit();
+    return result;
+}
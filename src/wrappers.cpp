@@ -1,11 +1,28 @@
 #include <nan.h>
 #include <vector>
-#include <queue>
 #include <string>
 #include <cstring>
+#include <climits>
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <deque>
 
 #include "AudioInput.hpp"
+#include "AudioBuffer.hpp"
+#include "AudioTap.hpp"
+#include "FileSink.hpp"
+#include "RtpSink.hpp"
+#include "FdSink.hpp"
+#include "ProcessingGraph.hpp"
+#include "CaptureSpool.hpp"
+#include "Trace.hpp"
+#include "Dispatcher.hpp"
+#include "NativeMemory.hpp"
+#include "PcmKernels.hpp"
+#include "WorkerPool.hpp"
+#include "MessageQueue.hpp"
 
 #ifdef _MSC_VER
 #define and &&
@@ -23,40 +40,179 @@ namespace demo {
     using v8::Value;
     using v8::Number;
 
-    class AudioInputWrapper: public Nan::ObjectWrap {
+    class AudioInputWrapper: public Nan::ObjectWrap, public Dispatcher::Client {
         public:
             static NAN_MODULE_INIT(Init);
 
-            struct Message {
-                const void* pcm;
-                uint32_t size;
+            //Emission of several chunks per wakeup, sized with the measured loop lag
+            struct AdaptiveEmit {
+                double minLatency = 0; //ms
+                double maxLatency = 0; //ms, 0 disables it
+                std::atomic<double> targetLatency{0};
+                double loopLag = 0;
+                std::atomic<uint64_t> scheduledAt{0};
+                //Audio queued without waking up the loop, the timer emits it if no batch completes
+                std::atomic<uint64_t> pendingSince{0};
+                uv_timer_t* timer = nullptr;
             };
 
         private:
             explicit AudioInputWrapper(const AudioInput::Options &opt);
             ~AudioInputWrapper();
 
-            static void cbk(uint32_t size, const void* pcm, void* userData);
+            static void cbk(uint32_t size, const void* pcm, uint64_t sample, bool discontinuity, void* userData);
+            static void endCbk(void* userData);
+            static size_t backlogCbk(void* userData);
+            static void stallCbk(bool recovered, double gap, uint64_t sample, void* userData);
+            static void emitTimerCbk(uv_timer_t* timer);
             static NAN_METHOD(New);
             static NAN_METHOD(open);
             static NAN_METHOD(pause);
             static NAN_METHOD(close);
             static NAN_METHOD(isOpen);
             static NAN_METHOD(isPaused);
+            static NAN_METHOD(getStats);
+            static NAN_METHOD(getStreamInfo);
+            static NAN_METHOD(addTap);
+            static NAN_METHOD(removeTap);
+            static NAN_METHOD(addFileSink);
+            static NAN_METHOD(removeFileSink);
+            static NAN_METHOD(addRtpSink);
+            static NAN_METHOD(removeRtpSink);
+            static NAN_METHOD(addFdSink);
+            static NAN_METHOD(removeFdSink);
+            static NAN_METHOD(addGraph);
+            static NAN_METHOD(removeGraph);
+            static NAN_METHOD(getGraphStats);
+            static NAN_METHOD(enableSpool);
+            static NAN_METHOD(disableSpool);
+            static NAN_METHOD(startCallbackTrace);
+            static NAN_METHOD(stopCallbackTrace);
+            static NAN_METHOD(getSpoolInfo);
+            static NAN_METHOD(readSpool);
+            static NAN_METHOD(getSpoolSampleAt);
             static NAN_METHOD(ErrorToString);
             static NAN_METHOD(GetDevices);
+            static NAN_METHOD(refreshDevices);
+            static NAN_METHOD(setDevicesChangedCallback);
+            static void devicesChangedCbk(const std::vector<std::string> &added, const std::vector<std::string> &removed);
             static NAN_METHOD(loadPortaudioLibrary);
             static NAN_METHOD(isNativeLibraryLoaded);
-            static void EmitMessage(uv_async_t *w);
+            static NAN_METHOD(startTrace);
+            static NAN_METHOD(stopTrace);
+            static NAN_METHOD(dumpTrace);
+            static NAN_METHOD(isTraceAvailable);
+            static NAN_METHOD(getKernelInfo);
+            static NAN_METHOD(setKernelLevel);
+            static NAN_METHOD(getWorkerPoolStats);
+            static void NotifyOutputs(void* userData);
+            bool drain(size_t maxMessages) override;
             static void Destructor(void*);
             static Nan::Persistent<Function> constructor;
             static std::vector<AudioInputWrapper*> instances;
 
             AudioInput* ai;
-            uv_async_t message_async;
-            uv_mutex_t message_mutex;
-            std::queue<Message*> message_queue;
+            bool attached = false;
+            AdaptiveEmit adaptive;
+            MessageQueue messages;
+            bool discontinuity = false; //The next 'data' chunk follows a stall
             Nan::AsyncResource* asyncRes;
+            TapProcessor* taps = nullptr;
+            std::map<int, FileSink*> fileSinks;
+            std::map<int, RtpSink*> rtpSinks;
+            std::map<int, FdSink*> fdSinks;
+            std::map<int, ProcessingGraph*> graphs;
+            std::shared_ptr<CaptureSpool> spool;
+            int nextSinkId = 0;
+
+            void removeSinks();
+            void detach();
+    };
+
+    //Diffs of the device list for 'devicesChanged'. The refresh can be done in a close() called
+    //by the GC, where JS cannot run, so they are emitted from the loop. It is only attached to
+    //the dispatcher while there are diffs, so it does not keep the loop alive
+    class DeviceEvents: public Dispatcher::Client {
+        public:
+            static DeviceEvents& get() {
+                static DeviceEvents events;
+                return events;
+            }
+
+            //Called in the loop thread
+            void push(const std::vector<std::string> &added, const std::vector<std::string> &removed) {
+                if(callback == nullptr) return;
+                pending.push_back({ added, removed });
+                if(!attached) {
+                    Dispatcher::get().attach(this);
+                    attached = true;
+                }
+                Dispatcher::get().schedule(this);
+            }
+
+            void setCallback(Local<Function> function) {
+                if(callback == nullptr) {
+                    callback = new Nan::Callback();
+                    asyncRes = new Nan::AsyncResource("AudioInput:devicesChanged");
+                }
+                callback->Reset(function);
+            }
+
+            //At exit, while the isolate is still alive
+            void reset() {
+                pending.clear();
+                if(attached) {
+                    Dispatcher::get().detach(this);
+                    attached = false;
+                }
+                if(callback != nullptr) {
+                    callback->Reset();
+                    delete callback;
+                    delete asyncRes;
+                    callback = nullptr;
+                    asyncRes = nullptr;
+                }
+            }
+
+        protected:
+            bool drain(size_t maxMessages) override {
+                Nan::HandleScope scope;
+                size_t emitted = 0;
+                while(emitted < maxMessages && !pending.empty() && callback != nullptr) {
+                    Diff diff = pending.front();
+                    pending.pop_front();
+                    Local<v8::Array> added = Nan::New<v8::Array>();
+                    for(uint32_t i = 0; i < diff.added.size(); i++) {
+                        Nan::Set(added, i, Nan::New(diff.added[i]).ToLocalChecked());
+                    }
+                    Local<v8::Array> removed = Nan::New<v8::Array>();
+                    for(uint32_t i = 0; i < diff.removed.size(); i++) {
+                        Nan::Set(removed, i, Nan::New(diff.removed[i]).ToLocalChecked());
+                    }
+                    v8::Local<v8::Value> args[2] = { added, removed };
+                    callback->Call(2, args, asyncRes);
+                    emitted++;
+                }
+
+                if(!pending.empty() && callback != nullptr) return true;
+                pending.clear();
+                if(attached) {
+                    Dispatcher::get().detach(this);
+                    attached = false;
+                }
+                return false;
+            }
+
+        private:
+            struct Diff {
+                std::vector<std::string> added;
+                std::vector<std::string> removed;
+            };
+
+            std::deque<Diff> pending;
+            bool attached = false;
+            Nan::Callback* callback = nullptr;
+            Nan::AsyncResource* asyncRes = nullptr;
     };
 
     NAN_MODULE_INIT(init) {
@@ -66,18 +222,24 @@ namespace demo {
     NODE_MODULE(AudioInput, init)
 
 
-    AudioInputWrapper::AudioInputWrapper(const AudioInput::Options &opt) {
+    AudioInputWrapper::AudioInputWrapper(const AudioInput::Options &opt): messages(opt.bitsPerSample / 8 * opt.channels) {
         ai = new AudioInput(opt);
         AudioInputWrapper::instances.push_back(this);
-        uv_mutex_init(&message_mutex);
         asyncRes = new Nan::AsyncResource(Nan::New("AudioInputWrapper:emit").ToLocalChecked());
     }
 
     AudioInputWrapper::~AudioInputWrapper() {
         if(ai->isOpen())
             ai->close();
-        uv_mutex_destroy(&message_mutex);
+        removeSinks();
+        detach();
+        if(adaptive.timer) {
+            uv_close((uv_handle_t*) adaptive.timer, [] (uv_handle_t* handle) { delete (uv_timer_t*) handle; });
+            adaptive.timer = nullptr;
+        }
         delete[] ai->options.devName;
+        delete[] ai->options.inputFile;
+        delete[] ai->options.callbackTrace;
         delete ai;
         delete asyncRes;
         ai = nullptr;
@@ -88,7 +250,25 @@ namespace demo {
         instances.erase(pos);
     }
 
+    static void throwPortAudioError(const char* error) {
+        Nan::ThrowError(error);
+    }
+
+    //Native memory is reported to V8 in steps, so the GC knows about the audio buffers.
+    //It calls into V8, so not from a GC callback
+    static void reportExternalMemory() {
+        int64_t delta = NativeMemory::takeDelta(64 * 1024);
+        //Deltas over 2GB (i.e. a big spool) are reported in several calls
+        while(delta != 0) {
+            int step = (int) std::max<int64_t>(std::min<int64_t>(delta, INT_MAX), -INT_MAX);
+            Nan::AdjustExternalMemory(step);
+            delta -= step;
+        }
+    }
+
     NAN_MODULE_INIT(AudioInputWrapper::Init) {
+        AudioInput::setErrorHandler(throwPortAudioError);
+
         // Prepare constructor template
         Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
         tpl->SetClassName(Nan::New("AudioInput").ToLocalChecked());
@@ -100,6 +280,26 @@ namespace demo {
         Nan::SetPrototypeMethod(tpl, "pause", pause);
         Nan::SetPrototypeMethod(tpl, "isOpen", isOpen);
         Nan::SetPrototypeMethod(tpl, "isPaused", isPaused);
+        Nan::SetPrototypeMethod(tpl, "getStats", getStats);
+        Nan::SetPrototypeMethod(tpl, "getStreamInfo", getStreamInfo);
+        Nan::SetPrototypeMethod(tpl, "_addTap", addTap);
+        Nan::SetPrototypeMethod(tpl, "_removeTap", removeTap);
+        Nan::SetPrototypeMethod(tpl, "_addFileSink", addFileSink);
+        Nan::SetPrototypeMethod(tpl, "_removeFileSink", removeFileSink);
+        Nan::SetPrototypeMethod(tpl, "_addRtpSink", addRtpSink);
+        Nan::SetPrototypeMethod(tpl, "_removeRtpSink", removeRtpSink);
+        Nan::SetPrototypeMethod(tpl, "_addFdSink", addFdSink);
+        Nan::SetPrototypeMethod(tpl, "_removeFdSink", removeFdSink);
+        Nan::SetPrototypeMethod(tpl, "_addGraph", addGraph);
+        Nan::SetPrototypeMethod(tpl, "_removeGraph", removeGraph);
+        Nan::SetPrototypeMethod(tpl, "_getGraphStats", getGraphStats);
+        Nan::SetPrototypeMethod(tpl, "enableSpool", enableSpool);
+        Nan::SetPrototypeMethod(tpl, "disableSpool", disableSpool);
+        Nan::SetPrototypeMethod(tpl, "startCallbackTrace", startCallbackTrace);
+        Nan::SetPrototypeMethod(tpl, "stopCallbackTrace", stopCallbackTrace);
+        Nan::SetPrototypeMethod(tpl, "getSpoolInfo", getSpoolInfo);
+        Nan::SetPrototypeMethod(tpl, "readSpool", readSpool);
+        Nan::SetPrototypeMethod(tpl, "getSpoolSampleAt", getSpoolSampleAt);
         constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
         Nan::Set(target, Nan::New("AudioInput").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
 
@@ -107,10 +307,28 @@ namespace demo {
         Nan::Set(target, Nan::New("AudioInputError").ToLocalChecked(), Nan::GetFunction(audioInputErrorMethod).ToLocalChecked());
         auto getDevicesMethod = Nan::New<FunctionTemplate>(GetDevices);
         Nan::Set(target, Nan::New("GetDevices").ToLocalChecked(), Nan::GetFunction(getDevicesMethod).ToLocalChecked());
+        auto refreshDevices = Nan::New<FunctionTemplate>(AudioInputWrapper::refreshDevices);
+        Nan::Set(target, Nan::New("refreshDevices").ToLocalChecked(), Nan::GetFunction(refreshDevices).ToLocalChecked());
+        auto setDevicesChangedCallback = Nan::New<FunctionTemplate>(AudioInputWrapper::setDevicesChangedCallback);
+        Nan::Set(target, Nan::New("setDevicesChangedCallback").ToLocalChecked(), Nan::GetFunction(setDevicesChangedCallback).ToLocalChecked());
         auto loadPortaudioLibrary = Nan::New<FunctionTemplate>(AudioInputWrapper::loadPortaudioLibrary);
         Nan::Set(target, Nan::New("loadPortaudioLibrary").ToLocalChecked(), Nan::GetFunction(loadPortaudioLibrary).ToLocalChecked());
         auto isNativeLibraryLoaded = Nan::New<FunctionTemplate>(AudioInputWrapper::isNativeLibraryLoaded);
         Nan::Set(target, Nan::New("isNativeLibraryLoaded").ToLocalChecked(), Nan::GetFunction(isNativeLibraryLoaded).ToLocalChecked());
+        auto startTrace = Nan::New<FunctionTemplate>(AudioInputWrapper::startTrace);
+        Nan::Set(target, Nan::New("startTrace").ToLocalChecked(), Nan::GetFunction(startTrace).ToLocalChecked());
+        auto stopTrace = Nan::New<FunctionTemplate>(AudioInputWrapper::stopTrace);
+        Nan::Set(target, Nan::New("stopTrace").ToLocalChecked(), Nan::GetFunction(stopTrace).ToLocalChecked());
+        auto dumpTrace = Nan::New<FunctionTemplate>(AudioInputWrapper::dumpTrace);
+        Nan::Set(target, Nan::New("dumpTrace").ToLocalChecked(), Nan::GetFunction(dumpTrace).ToLocalChecked());
+        auto isTraceAvailable = Nan::New<FunctionTemplate>(AudioInputWrapper::isTraceAvailable);
+        Nan::Set(target, Nan::New("isTraceAvailable").ToLocalChecked(), Nan::GetFunction(isTraceAvailable).ToLocalChecked());
+        auto getKernelInfo = Nan::New<FunctionTemplate>(AudioInputWrapper::getKernelInfo);
+        Nan::Set(target, Nan::New("getKernelInfo").ToLocalChecked(), Nan::GetFunction(getKernelInfo).ToLocalChecked());
+        auto setKernelLevel = Nan::New<FunctionTemplate>(AudioInputWrapper::setKernelLevel);
+        Nan::Set(target, Nan::New("setKernelLevel").ToLocalChecked(), Nan::GetFunction(setKernelLevel).ToLocalChecked());
+        auto getWorkerPoolStats = Nan::New<FunctionTemplate>(AudioInputWrapper::getWorkerPoolStats);
+        Nan::Set(target, Nan::New("getWorkerPoolStats").ToLocalChecked(), Nan::GetFunction(getWorkerPoolStats).ToLocalChecked());
 
         AudioInput::staticInit();
         node::AtExit(AudioInputWrapper::Destructor, nullptr);
@@ -122,7 +340,12 @@ namespace demo {
         if (info.IsConstructCall()) {
             // Invoked as constructor: `new AudioInputWrapper(...)`
             Local<Value> value2 = info[0];
-            AudioInput::Options opt = {44100, 16, 2, 0, nullptr};
+            AudioInput::Options opt = AudioInput::Options();
+            opt.sampleRate = 44100;
+            opt.bitsPerSample = 16;
+            opt.channels = 2;
+            opt.inputSpeed = 1;
+            double minEmitLatency = 0, maxEmitLatency = 0;
             if(!value2->IsUndefined() and value2->IsObject()) {
                 Local<Object> value = value2->ToObject();
                 auto sampleRate = Nan::Get(value, Nan::New("samplerate").ToLocalChecked());
@@ -130,6 +353,24 @@ namespace demo {
                 auto ch = Nan::Get(value, Nan::New("channels").ToLocalChecked());
                 auto devName = Nan::Get(value, Nan::New("deviceName").ToLocalChecked());
                 auto timeFrame = Nan::Get(value, Nan::New("timePerFrame").ToLocalChecked());
+                auto framesPerChunk = Nan::Get(value, Nan::New("framesPerChunk").ToLocalChecked());
+                auto threadPolicy = Nan::Get(value, Nan::New("threadPolicy").ToLocalChecked());
+                auto threadPriority = Nan::Get(value, Nan::New("threadPriority").ToLocalChecked());
+                auto threadCpus = Nan::Get(value, Nan::New("threadCpus").ToLocalChecked());
+                auto lockMemory = Nan::Get(value, Nan::New("lockMemory").ToLocalChecked());
+                auto jobPriority = Nan::Get(value, Nan::New("jobPriority").ToLocalChecked());
+                auto minLatency = Nan::Get(value, Nan::New("minEmitLatency").ToLocalChecked());
+                auto maxLatency = Nan::Get(value, Nan::New("maxEmitLatency").ToLocalChecked());
+                auto file = Nan::Get(value, Nan::New("file").ToLocalChecked());
+                auto callbackTrace = Nan::Get(value, Nan::New("callbackTrace").ToLocalChecked());
+                auto speed = Nan::Get(value, Nan::New("speed").ToLocalChecked());
+                auto loop = Nan::Get(value, Nan::New("loop").ToLocalChecked());
+                auto hostApi = Nan::Get(value, Nan::New("hostApi").ToLocalChecked());
+                auto latency = Nan::Get(value, Nan::New("latency").ToLocalChecked());
+                auto clipOff = Nan::Get(value, Nan::New("clipOff").ToLocalChecked());
+                auto ditherOff = Nan::Get(value, Nan::New("ditherOff").ToLocalChecked());
+                auto stallTimeout = Nan::Get(value, Nan::New("stallTimeout").ToLocalChecked());
+                auto fallbackDevices = Nan::Get(value, Nan::New("fallbackDevices").ToLocalChecked());
 
                 if(!sampleRate.IsEmpty()) {
                     Local<Value> v;
@@ -176,10 +417,162 @@ namespace demo {
                     if(timeFrame.ToLocal(&v) && v->IsNumber())
                         opt.frameDuration = Nan::To<uint32_t>(v).FromMaybe(0);
                 }
+
+                if(!framesPerChunk.IsEmpty()) {
+                    Local<Value> v;
+                    if(framesPerChunk.ToLocal(&v) && v->IsNumber())
+                        opt.framesPerChunk = Nan::To<uint32_t>(v).FromMaybe(0);
+                }
+
+                if(!threadPolicy.IsEmpty()) {
+                    Local<Value> v;
+                    if(threadPolicy.ToLocal(&v) && v->IsString()) {
+                        Nan::Utf8String str(v);
+                        if(!strcmp(*str, "fifo")) opt.threads.policy = ThreadConfig::Fifo;
+                        else if(!strcmp(*str, "rr")) opt.threads.policy = ThreadConfig::RoundRobin;
+                    }
+                }
+
+                if(!threadPriority.IsEmpty()) {
+                    Local<Value> v;
+                    if(threadPriority.ToLocal(&v) && v->IsNumber())
+                        opt.threads.priority = Nan::To<int32_t>(v).FromMaybe(0);
+                }
+
+                if(!threadCpus.IsEmpty()) {
+                    Local<Value> v;
+                    if(threadCpus.ToLocal(&v) && v->IsArray()) {
+                        Local<v8::Array> cpus = v.As<v8::Array>();
+                        for(uint32_t i = 0; i < cpus->Length(); i++) {
+                            int32_t cpu = Nan::To<int32_t>(Nan::Get(cpus, i).ToLocalChecked()).FromMaybe(-1);
+                            if(cpu >= 0) opt.threads.cpus.push_back(cpu);
+                        }
+                    }
+                }
+
+                if(!lockMemory.IsEmpty()) {
+                    Local<Value> v;
+                    if(lockMemory.ToLocal(&v))
+                        opt.threads.lockMemory = v->IsTrue();
+                }
+
+                if(!jobPriority.IsEmpty()) {
+                    Local<Value> v;
+                    if(jobPriority.ToLocal(&v) && v->IsString()) {
+                        Nan::Utf8String str(v);
+                        opt.threads.lowPriority = !strcmp(*str, "low");
+                    }
+                }
+
+                if(!minLatency.IsEmpty()) {
+                    Local<Value> v;
+                    if(minLatency.ToLocal(&v) && v->IsNumber())
+                        minEmitLatency = std::max(Nan::To<double>(v).FromMaybe(0), 0.0);
+                }
+
+                if(!maxLatency.IsEmpty()) {
+                    Local<Value> v;
+                    if(maxLatency.ToLocal(&v) && v->IsNumber())
+                        maxEmitLatency = std::max(Nan::To<double>(v).FromMaybe(0), 0.0);
+                }
+
+                if(!file.IsEmpty()) {
+                    Local<Value> v;
+                    if(file.ToLocal(&v) && v->IsString()) {
+                        Nan::Utf8String str(v);
+                        opt.inputFile = new char[str.length() + 1];
+                        strcpy((char*) opt.inputFile, *str);
+                    }
+                }
+
+                if(!callbackTrace.IsEmpty()) {
+                    Local<Value> v;
+                    if(callbackTrace.ToLocal(&v) && v->IsString()) {
+                        Nan::Utf8String str(v);
+                        opt.callbackTrace = new char[str.length() + 1];
+                        strcpy((char*) opt.callbackTrace, *str);
+                    }
+                }
+
+                if(!speed.IsEmpty()) {
+                    Local<Value> v;
+                    if(speed.ToLocal(&v) && v->IsNumber())
+                        opt.inputSpeed = std::max(Nan::To<double>(v).FromMaybe(1), 0.0);
+                }
+
+                if(!loop.IsEmpty()) {
+                    Local<Value> v;
+                    if(loop.ToLocal(&v))
+                        opt.inputLoop = v->IsTrue();
+                }
+
+                if(!hostApi.IsEmpty()) {
+                    Local<Value> v;
+                    if(hostApi.ToLocal(&v) && v->IsString()) {
+                        opt.hostApis.push_back(*Nan::Utf8String(v));
+                    } else if(!v.IsEmpty() && v->IsArray()) {
+                        Local<v8::Array> names = v.As<v8::Array>();
+                        for(uint32_t i = 0; i < names->Length(); i++) {
+                            Local<Value> name = Nan::Get(names, i).ToLocalChecked();
+                            if(name->IsString()) opt.hostApis.push_back(*Nan::Utf8String(name));
+                        }
+                    }
+                }
+
+                if(!latency.IsEmpty()) {
+                    Local<Value> v;
+                    if(latency.ToLocal(&v) && v->IsNumber()) {
+                        opt.latency = std::max(Nan::To<double>(v).FromMaybe(0), 0.0);
+                    } else if(!v.IsEmpty() && v->IsString()) {
+                        Nan::Utf8String str(v);
+                        opt.latency = !strcmp(*str, "high") ? -1 : 0;
+                    }
+                }
+
+                if(!clipOff.IsEmpty()) {
+                    Local<Value> v;
+                    if(clipOff.ToLocal(&v))
+                        opt.clipOff = v->IsTrue();
+                }
+
+                if(!ditherOff.IsEmpty()) {
+                    Local<Value> v;
+                    if(ditherOff.ToLocal(&v))
+                        opt.ditherOff = v->IsTrue();
+                }
+
+                if(!stallTimeout.IsEmpty()) {
+                    Local<Value> v;
+                    if(stallTimeout.ToLocal(&v) && v->IsNumber())
+                        opt.stallTimeout = Nan::To<uint32_t>(v).FromMaybe(0);
+                }
+
+                if(!fallbackDevices.IsEmpty()) {
+                    Local<Value> v;
+                    if(fallbackDevices.ToLocal(&v) && v->IsArray()) {
+                        Local<v8::Array> names = v.As<v8::Array>();
+                        for(uint32_t i = 0; i < names->Length(); i++) {
+                            Local<Value> name = Nan::Get(names, i).ToLocalChecked();
+                            if(name->IsString()) opt.fallbackDevices.push_back(*Nan::Utf8String(name));
+                        }
+                    }
+                }
+            }
+
+            if((uint64_t) opt.framesPerChunk * (opt.bitsPerSample / 8) * opt.channels > AudioInput::maxChunkBytes) {
+                delete[] opt.devName;
+                delete[] opt.inputFile;
+                delete[] opt.callbackTrace;
+                Nan::ThrowError("framesPerChunk is too large, chunks are limited to 16 MiB");
+                return;
             }
 
             AudioInputWrapper* obj = new AudioInputWrapper(opt);
-            obj->message_async.data = obj;
+            if(maxEmitLatency > 0) {
+                obj->adaptive.minLatency = std::min(minEmitLatency, maxEmitLatency);
+                obj->adaptive.maxLatency = maxEmitLatency;
+                obj->adaptive.targetLatency = obj->adaptive.minLatency;
+            }
             obj->Wrap(info.This());
             info.GetReturnValue().Set(info.This());
         } else {
@@ -193,13 +586,19 @@ namespace demo {
 
     void AudioInputWrapper::Destructor(void* nothing) {
         (void)nothing;
+        //Everything is closed and the library unloaded right after
+        AudioInput::cancelRefreshDevices();
+        AudioInput::setDevicesChangedCallback(nullptr);
+        DeviceEvents::get().reset();
 
         for(auto it = AudioInputWrapper::instances.begin(); it != AudioInputWrapper::instances.end(); it++) {
             AudioInputWrapper* p = *it;
             if(p->ai->isOpen())
                 p->ai->close();
+            p->removeSinks();
             delete[] p->ai->options.devName;
-            uv_mutex_destroy(&(p->message_mutex));
+            delete[] p->ai->options.inputFile;
+            delete[] p->ai->options.callbackTrace;
             delete p->ai;
             p->ai = nullptr;
         }
@@ -207,21 +606,130 @@ namespace demo {
         AudioInput::staticDeinit();
     }
 
-    void AudioInputWrapper::cbk(uint32_t size, const void* pcm, void* userData) {
+    void AudioInputWrapper::removeSinks() {
+        if(taps) {
+            ai->removeSink(taps);
+            delete taps;
+            taps = nullptr;
+        }
+
+        for(auto &it: fileSinks) {
+            ai->removeSink(it.second);
+            delete it.second;
+        }
+        fileSinks.clear();
+
+        for(auto &it: rtpSinks) {
+            ai->removeSink(it.second);
+            delete it.second;
+        }
+        rtpSinks.clear();
+
+        for(auto &it: fdSinks) {
+            ai->removeSink(it.second);
+            delete it.second;
+        }
+        fdSinks.clear();
+
+        for(auto &it: graphs) {
+            ai->removeSink(it.second);
+            delete it.second;
+        }
+        graphs.clear();
+
+        if(spool) {
+            ai->removeSink(spool.get());
+            spool->stop();
+            spool.reset();
+        }
+    }
+
+    void AudioInputWrapper::detach() {
+        if(attached) {
+            Dispatcher::get().detach(this);
+            attached = false;
+        }
+        if(adaptive.timer) {
+            uv_timer_stop(adaptive.timer);
+        }
+
+        messages.clear();
+        adaptive.pendingSince = 0;
+        discontinuity = false;
+    }
+
+    void AudioInputWrapper::cbk(uint32_t size, const void* pcm, uint64_t sample, bool discontinuity, void* userData) {
+        AudioInputWrapper* obj = (AudioInputWrapper*) userData;
+        MessageQueue::Message message(pcm, size, sample, obj->ai->getClock().timeOf(sample));
+        message.discontinuity = discontinuity;
+        uint64_t pendingFrames = obj->messages.push(message);
+
+        //In adaptive mode the loop is woken up when the queue has enough audio
+        AdaptiveEmit &adaptive = obj->adaptive;
+        if(adaptive.maxLatency > 0) {
+            double pendingMs = pendingFrames * 1000.0 / obj->ai->options.sampleRate;
+            if(pendingMs < adaptive.targetLatency.load(std::memory_order_relaxed)) {
+                uint64_t none = 0;
+                adaptive.pendingSince.compare_exchange_strong(none, uv_hrtime());
+                return;
+            }
+            uint64_t expected = 0;
+            adaptive.scheduledAt.compare_exchange_strong(expected, uv_hrtime());
+        }
+        Dispatcher::get().schedule(obj);
+    }
+
+    void AudioInputWrapper::endCbk(void* userData) {
+        //Queued behind the last chunks, so 'end' is emitted after them
+        AudioInputWrapper* obj = (AudioInputWrapper*) userData;
+        obj->messages.push({ nullptr, 0, 0, 0, MessageQueue::End });
+        Dispatcher::get().schedule(obj);
+    }
+
+    size_t AudioInputWrapper::backlogCbk(void* userData) {
         AudioInputWrapper* obj = (AudioInputWrapper*) userData;
-        Message* m = new Message();
-        m->pcm = pcm;
-        m->size = size;
-        uv_mutex_lock(&obj->message_mutex);
-        obj->message_queue.push(m);
-        uv_mutex_unlock(&obj->message_mutex);
-        uv_async_send(&obj->message_async);
+        return obj->messages.size();
+    }
+
+    void AudioInputWrapper::stallCbk(bool recovered, double gap, uint64_t sample, void* userData) {
+        //'recovered' is queued before the first chunk of the new stream
+        AudioInputWrapper* obj = (AudioInputWrapper*) userData;
+        obj->messages.push({ nullptr, 0, sample, 0, recovered ? MessageQueue::Recovered : MessageQueue::Stall, gap });
+        Dispatcher::get().schedule(obj);
+    }
+
+    //The last chunks before a pause or a slow device may never complete a batch
+    void AudioInputWrapper::emitTimerCbk(uv_timer_t* timer) {
+        AudioInputWrapper* obj = (AudioInputWrapper*) timer->data;
+        uint64_t since = obj->adaptive.pendingSince;
+        if(since != 0 && uv_hrtime() - since >= uv_timer_get_repeat(timer) * 1000000) {
+            Dispatcher::get().schedule(obj);
+        }
     }
 
     NAN_METHOD(AudioInputWrapper::open) {
         AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
-        uv_async_init(uv_default_loop(), &obj->message_async, &AudioInputWrapper::EmitMessage);
+        if(!obj->attached) {
+            Dispatcher::get().attach(obj);
+            obj->attached = true;
+        }
+        AdaptiveEmit &adaptive = obj->adaptive;
+        if(adaptive.maxLatency > 0) {
+            if(!adaptive.timer) {
+                adaptive.timer = new uv_timer_t;
+                uv_timer_init(uv_default_loop(), adaptive.timer);
+                adaptive.timer->data = obj;
+                //The dispatcher keeps the loop alive while the input is open
+                uv_unref((uv_handle_t*) adaptive.timer);
+            }
+            //Twice per maxEmitLatency, so no audio waits longer than that
+            uint64_t interval = std::max<uint64_t>(1, (uint64_t) (adaptive.maxLatency / 2));
+            uv_timer_start(adaptive.timer, AudioInputWrapper::emitTimerCbk, interval, interval);
+        }
         obj->ai->setInputCallback(AudioInputWrapper::cbk, obj);
+        obj->ai->setEndCallback(AudioInputWrapper::endCbk);
+        obj->ai->setStallCallback(AudioInputWrapper::stallCbk);
+        obj->ai->setBacklogCallback(AudioInputWrapper::backlogCbk);
         Local<Number> number = Nan::New(obj->ai->open());
         info.GetReturnValue().Set(number);
     }
@@ -234,14 +742,18 @@ namespace demo {
     NAN_METHOD(AudioInputWrapper::close) {
         AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
         obj->ai->close();
-        uv_close((uv_handle_t*) &obj->message_async, nullptr);
-        uv_unref((uv_handle_t*) &obj->message_async);
+        obj->removeSinks();
+        obj->detach();
         info.GetReturnValue().Set(Nan::Undefined());
     }
 
     NAN_METHOD(AudioInputWrapper::pause) {
         AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
-        obj->ai->pause();
+        obj->ai->pause(info[0]->IsTrue());
+        if(obj->adaptive.maxLatency > 0) {
+            //Audio waiting for a full batch is emitted now
+            Dispatcher::get().schedule(obj);
+        }
         info.GetReturnValue().Set(Nan::Undefined());
     }
 
@@ -250,6 +762,754 @@ namespace demo {
         info.GetReturnValue().Set(Nan::New(obj->ai->isPaused()));
     }
 
+    NAN_METHOD(AudioInputWrapper::getStreamInfo) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        AudioInput::StreamInfo streamInfo;
+        if(!obj->ai->getStreamInfo(streamInfo)) {
+            info.GetReturnValue().Set(Nan::Null());
+            return;
+        }
+
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("device").ToLocalChecked(), Nan::New(streamInfo.device).ToLocalChecked());
+        Nan::Set(result, Nan::New("hostApi").ToLocalChecked(), Nan::New(streamInfo.hostApi).ToLocalChecked());
+        Nan::Set(result, Nan::New("inputLatency").ToLocalChecked(), Nan::New<Number>(streamInfo.inputLatency));
+        Nan::Set(result, Nan::New("sampleRate").ToLocalChecked(), Nan::New<Number>(streamInfo.sampleRate));
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::getStats) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        AudioInput::Stats stats;
+        obj->ai->getStats(stats);
+
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("callbacks").ToLocalChecked(), Nan::New<Number>(stats.callbacks));
+        Nan::Set(result, Nan::New("frames").ToLocalChecked(), Nan::New<Number>(stats.frames));
+        Nan::Set(result, Nan::New("inputOverflows").ToLocalChecked(), Nan::New<Number>(stats.inputOverflows));
+        Nan::Set(result, Nan::New("inputUnderflows").ToLocalChecked(), Nan::New<Number>(stats.inputUnderflows));
+        Nan::Set(result, Nan::New("maxCallbackTime").ToLocalChecked(), Nan::New<Number>(stats.maxCallbackTime));
+        Nan::Set(result, Nan::New("droppedFrames").ToLocalChecked(), Nan::New<Number>(stats.droppedFrames));
+        Nan::Set(result, Nan::New("stalls").ToLocalChecked(), Nan::New<Number>(stats.stalls));
+        Nan::Set(result, Nan::New("recoveries").ToLocalChecked(), Nan::New<Number>(stats.recoveries));
+
+        Local<v8::Array> taps = Nan::New<v8::Array>();
+        if(obj->taps) {
+            uint32_t pos = 0;
+            for(auto &tap: obj->taps->getTaps()) {
+                AudioTap::Stats tapStats;
+                tap->getStats(tapStats);
+                Local<Object> t = Nan::New<Object>();
+                Nan::Set(t, Nan::New("id").ToLocalChecked(), Nan::New(tap->id));
+                Nan::Set(t, Nan::New("chunks").ToLocalChecked(), Nan::New<Number>(tapStats.chunks));
+                Nan::Set(t, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>(tapStats.bytes));
+                Nan::Set(t, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>(tapStats.dropped));
+                Nan::Set(t, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(tapStats.queued));
+                Nan::Set(t, Nan::New("peak").ToLocalChecked(), Nan::New<Number>(tapStats.peak));
+                Nan::Set(taps, pos++, t);
+            }
+            Nan::Set(result, Nan::New("tapInputDropped").ToLocalChecked(), Nan::New<Number>(obj->taps->getDroppedInput()));
+        }
+        Nan::Set(result, Nan::New("taps").ToLocalChecked(), taps);
+
+        Local<v8::Array> fileSinks = Nan::New<v8::Array>();
+        uint32_t pos = 0;
+        for(auto &it: obj->fileSinks) {
+            FileSink::Stats sinkStats;
+            it.second->getStats(sinkStats);
+            Local<Object> f = Nan::New<Object>();
+            Nan::Set(f, Nan::New("id").ToLocalChecked(), Nan::New(it.first));
+            Nan::Set(f, Nan::New("file").ToLocalChecked(), Nan::New(sinkStats.currentFile).ToLocalChecked());
+            Nan::Set(f, Nan::New("files").ToLocalChecked(), Nan::New<Number>(sinkStats.files));
+            Nan::Set(f, Nan::New("bytesWritten").ToLocalChecked(), Nan::New<Number>(sinkStats.bytesWritten));
+            Nan::Set(f, Nan::New("writes").ToLocalChecked(), Nan::New<Number>(sinkStats.writes));
+            Nan::Set(f, Nan::New("droppedChunks").ToLocalChecked(), Nan::New<Number>(sinkStats.droppedChunks));
+            Nan::Set(f, Nan::New("discontinuities").ToLocalChecked(), Nan::New<Number>(sinkStats.discontinuities));
+            Nan::Set(f, Nan::New("lostBytes").ToLocalChecked(), Nan::New<Number>(sinkStats.lostBytes));
+            Nan::Set(f, Nan::New("failed").ToLocalChecked(), Nan::New(sinkStats.failed));
+            Nan::Set(f, Nan::New("avgWriteLatency").ToLocalChecked(), Nan::New<Number>(sinkStats.avgWriteLatency));
+            Nan::Set(f, Nan::New("maxWriteLatency").ToLocalChecked(), Nan::New<Number>(sinkStats.maxWriteLatency));
+            if(!sinkStats.lastError.empty()) {
+                Nan::Set(f, Nan::New("lastError").ToLocalChecked(), Nan::New(sinkStats.lastError).ToLocalChecked());
+            }
+            Nan::Set(fileSinks, pos++, f);
+        }
+        Nan::Set(result, Nan::New("fileSinks").ToLocalChecked(), fileSinks);
+
+        Local<v8::Array> rtpSinks = Nan::New<v8::Array>();
+        pos = 0;
+        for(auto &it: obj->rtpSinks) {
+            RtpSink::Stats sinkStats;
+            it.second->getStats(sinkStats);
+            Local<Object> r = Nan::New<Object>();
+            Nan::Set(r, Nan::New("id").ToLocalChecked(), Nan::New(it.first));
+            Nan::Set(r, Nan::New("packets").ToLocalChecked(), Nan::New<Number>(sinkStats.packets));
+            Nan::Set(r, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>(sinkStats.bytes));
+            Nan::Set(r, Nan::New("reports").ToLocalChecked(), Nan::New<Number>(sinkStats.reports));
+            Nan::Set(r, Nan::New("sendCalls").ToLocalChecked(), Nan::New<Number>(sinkStats.sendCalls));
+            Nan::Set(r, Nan::New("droppedChunks").ToLocalChecked(), Nan::New<Number>(sinkStats.droppedChunks));
+            Nan::Set(r, Nan::New("droppedPackets").ToLocalChecked(), Nan::New<Number>(sinkStats.droppedPackets));
+            Nan::Set(r, Nan::New("sendErrors").ToLocalChecked(), Nan::New<Number>(sinkStats.sendErrors));
+            Nan::Set(r, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(sinkStats.queued));
+            Nan::Set(r, Nan::New("packetTime").ToLocalChecked(), Nan::New<Number>(sinkStats.packetTime));
+            if(!sinkStats.lastError.empty()) {
+                Nan::Set(r, Nan::New("lastError").ToLocalChecked(), Nan::New(sinkStats.lastError).ToLocalChecked());
+            }
+            Nan::Set(rtpSinks, pos++, r);
+        }
+        Nan::Set(result, Nan::New("rtpSinks").ToLocalChecked(), rtpSinks);
+
+        Local<v8::Array> fdSinks = Nan::New<v8::Array>();
+        pos = 0;
+        for(auto &it: obj->fdSinks) {
+            FdSink::Stats sinkStats;
+            it.second->getStats(sinkStats);
+            Local<Object> f = Nan::New<Object>();
+            Nan::Set(f, Nan::New("id").ToLocalChecked(), Nan::New(it.first));
+            Nan::Set(f, Nan::New("bytesWritten").ToLocalChecked(), Nan::New<Number>(sinkStats.bytesWritten));
+            Nan::Set(f, Nan::New("splicedBytes").ToLocalChecked(), Nan::New<Number>(sinkStats.splicedBytes));
+            Nan::Set(f, Nan::New("writes").ToLocalChecked(), Nan::New<Number>(sinkStats.writes));
+            Nan::Set(f, Nan::New("droppedChunks").ToLocalChecked(), Nan::New<Number>(sinkStats.droppedChunks));
+            Nan::Set(f, Nan::New("discontinuities").ToLocalChecked(), Nan::New<Number>(sinkStats.discontinuities));
+            Nan::Set(f, Nan::New("inFlight").ToLocalChecked(), Nan::New<Number>(sinkStats.inFlight));
+            Nan::Set(f, Nan::New("zeroCopy").ToLocalChecked(), Nan::New(sinkStats.zeroCopy));
+            Nan::Set(f, Nan::New("closed").ToLocalChecked(), Nan::New(sinkStats.closed));
+            if(!sinkStats.lastError.empty()) {
+                Nan::Set(f, Nan::New("lastError").ToLocalChecked(), Nan::New(sinkStats.lastError).ToLocalChecked());
+            }
+            Nan::Set(fdSinks, pos++, f);
+        }
+        Nan::Set(result, Nan::New("fdSinks").ToLocalChecked(), fdSinks);
+
+        ThreadConfig::Status &threadStatus = *obj->ai->options.threads.status;
+        Local<Object> threads = Nan::New<Object>();
+        Local<v8::Array> threadErrors = Nan::New<v8::Array>();
+        {
+            std::lock_guard<std::mutex> lock(threadStatus.mutex);
+            for(uint32_t i = 0; i < threadStatus.errors.size(); i++) {
+                Nan::Set(threadErrors, i, Nan::New(threadStatus.errors[i]).ToLocalChecked());
+            }
+        }
+        Nan::Set(threads, Nan::New("configured").ToLocalChecked(), Nan::New<Number>(threadStatus.threads));
+        Nan::Set(threads, Nan::New("lockedBytes").ToLocalChecked(), Nan::New<Number>(threadStatus.lockedBytes));
+        Nan::Set(threads, Nan::New("errors").ToLocalChecked(), threadErrors);
+        Nan::Set(result, Nan::New("threads").ToLocalChecked(), threads);
+
+        Dispatcher::Stats dispatcherStats;
+        Dispatcher::get().getStats(dispatcherStats);
+        Local<Object> dispatcher = Nan::New<Object>();
+        Nan::Set(dispatcher, Nan::New("wakeups").ToLocalChecked(), Nan::New<Number>(dispatcherStats.wakeups));
+        Nan::Set(dispatcher, Nan::New("drains").ToLocalChecked(), Nan::New<Number>(dispatcherStats.drains));
+        Nan::Set(dispatcher, Nan::New("instances").ToLocalChecked(), Nan::New(dispatcherStats.clients));
+        Nan::Set(result, Nan::New("dispatcher").ToLocalChecked(), dispatcher);
+
+        Local<Object> emit = Nan::New<Object>();
+        Nan::Set(emit, Nan::New("adaptive").ToLocalChecked(), Nan::New(obj->adaptive.maxLatency > 0));
+        Nan::Set(emit, Nan::New("targetLatency").ToLocalChecked(), Nan::New<Number>(obj->adaptive.targetLatency));
+        Nan::Set(emit, Nan::New("loopLag").ToLocalChecked(), Nan::New<Number>(obj->adaptive.loopLag));
+        Nan::Set(result, Nan::New("emit").ToLocalChecked(), emit);
+
+        reportExternalMemory();
+        Local<Object> memory = Nan::New<Object>();
+        Nan::Set(memory, Nan::New("nativeBytes").ToLocalChecked(), Nan::New<Number>(NativeMemory::current()));
+        Nan::Set(memory, Nan::New("reportedBytes").ToLocalChecked(), Nan::New<Number>(NativeMemory::reported()));
+        Nan::Set(result, Nan::New("memory").ToLocalChecked(), memory);
+
+        SampleClock::Info clockInfo;
+        obj->ai->getClock().getInfo(clockInfo);
+        Local<Object> clock = Nan::New<Object>();
+        Nan::Set(clock, Nan::New("samples").ToLocalChecked(), Nan::New<Number>((double) clockInfo.samples));
+        Nan::Set(clock, Nan::New("rate").ToLocalChecked(), Nan::New<Number>(clockInfo.rate));
+        Nan::Set(clock, Nan::New("driftPpm").ToLocalChecked(), Nan::New<Number>(clockInfo.driftPpm));
+        Nan::Set(clock, Nan::New("jitter").ToLocalChecked(), Nan::New<Number>(clockInfo.jitter));
+        Nan::Set(clock, Nan::New("locked").ToLocalChecked(), Nan::New(clockInfo.locked));
+        Nan::Set(result, Nan::New("clock").ToLocalChecked(), clock);
+
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::addTap) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        AudioTap::Options opt = { obj->ai->options.sampleRate, obj->ai->options.bitsPerSample, {}, ProcessingGraph::defaultMaxQueue, true, 1.0f, false };
+
+        if(info[0]->IsObject()) {
+            Local<Object> value = Nan::To<Object>(info[0]).ToLocalChecked();
+            Local<Value> v;
+            if(Nan::Get(value, Nan::New("samplerate").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                opt.sampleRate = Nan::To<uint32_t>(v).FromMaybe(opt.sampleRate);
+                if(opt.sampleRate < 8000 || opt.sampleRate > 192000) {
+                    opt.sampleRate = obj->ai->options.sampleRate;
+                }
+            }
+
+            if(Nan::Get(value, Nan::New("bps").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                opt.bitsPerSample = Nan::To<uint32_t>(v).FromMaybe(opt.bitsPerSample);
+                if(opt.bitsPerSample != 16 && opt.bitsPerSample != 24 && opt.bitsPerSample != 32 && opt.bitsPerSample != 8) {
+                    opt.bitsPerSample = obj->ai->options.bitsPerSample;
+                }
+            }
+
+            if(Nan::Get(value, Nan::New("channelMap").ToLocalChecked()).ToLocal(&v) && v->IsArray()) {
+                Local<v8::Array> map = v.As<v8::Array>();
+                for(uint32_t i = 0; i < map->Length(); i++) {
+                    Local<Value> c = Nan::Get(map, i).ToLocalChecked();
+                    opt.channelMap.push_back(Nan::To<int32_t>(c).FromMaybe(-1));
+                }
+            } else if(Nan::Get(value, Nan::New("channels").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                uint32_t channels = Nan::To<uint32_t>(v).FromMaybe(obj->ai->options.channels);
+                if(channels == 1 || channels == 2) {
+                    for(uint32_t c = 0; c < channels; c++) {
+                        opt.channelMap.push_back(c < obj->ai->options.channels ? c : 0);
+                    }
+                }
+            }
+
+            if(Nan::Get(value, Nan::New("maxQueue").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                opt.maxQueue = Nan::To<uint32_t>(v).FromMaybe(opt.maxQueue);
+            }
+
+            if(Nan::Get(value, Nan::New("queuePolicy").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+                Nan::Utf8String policy(v);
+                opt.dropOldest = strcmp(*policy, "dropNewest") != 0;
+            }
+
+            if(Nan::Get(value, Nan::New("gain").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                opt.gain = (float) Nan::To<double>(v).FromMaybe(1.0);
+            }
+
+            if(Nan::Get(value, Nan::New("clockCorrection").ToLocalChecked()).ToLocal(&v)) {
+                opt.clockCorrection = v->IsTrue();
+            }
+        }
+
+        if(obj->taps == nullptr) {
+            obj->taps = new TapProcessor(obj->ai->options, &obj->ai->getClock(), AudioInputWrapper::NotifyOutputs, obj);
+            obj->ai->addSink(obj->taps);
+        }
+
+        info.GetReturnValue().Set(Nan::New(obj->taps->addTap(opt)));
+    }
+
+    NAN_METHOD(AudioInputWrapper::removeTap) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        bool removed = obj->taps != nullptr && obj->taps->removeTap(id);
+        info.GetReturnValue().Set(Nan::New(removed));
+    }
+
+    //Options shared by the sinks of the input and the outputs of the graphs, they throw on errors
+    static bool parseFileSinkOptions(Local<Object> value, FileSink::Options &opt) {
+        Local<Value> v;
+        if(Nan::Get(value, Nan::New("path").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+            opt.path = *Nan::Utf8String(v);
+        } else {
+            Nan::ThrowError("Option 'path' must be a string");
+            return false;
+        }
+
+        if(Nan::Get(value, Nan::New("format").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+            Nan::Utf8String format(v);
+            if(!strcmp(*format, "raw")) opt.format = FileSink::Raw;
+            else if(!strcmp(*format, "flac")) opt.format = FileSink::Flac;
+        }
+
+        if(Nan::Get(value, Nan::New("rotateBytes").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.rotateBytes = (uint64_t) Nan::To<double>(v).FromMaybe(0);
+        }
+
+        if(Nan::Get(value, Nan::New("rotateSeconds").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.rotateSeconds = Nan::To<uint32_t>(v).FromMaybe(0);
+        }
+
+        if(Nan::Get(value, Nan::New("batchBytes").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.batchBytes = Nan::To<uint32_t>(v).FromMaybe(opt.batchBytes);
+        }
+        return true;
+    }
+
+    static bool parseRtpSinkOptions(Local<Object> value, RtpSink::Options &opt) {
+        Local<Value> v;
+        if(Nan::Get(value, Nan::New("host").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+            opt.host = *Nan::Utf8String(v);
+        } else {
+            Nan::ThrowError("Option 'host' must be a string");
+            return false;
+        }
+
+        if(Nan::Get(value, Nan::New("port").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.port = (uint16_t) Nan::To<uint32_t>(v).FromMaybe(0);
+        }
+        if(opt.port == 0) {
+            Nan::ThrowError("Option 'port' must be a port number");
+            return false;
+        }
+
+        if(Nan::Get(value, Nan::New("encoding").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+            Nan::Utf8String encoding(v);
+            if(!strcmp(*encoding, "L24")) opt.encoding = RtpSink::L24;
+            else if(!strcmp(*encoding, "opus")) opt.encoding = RtpSink::Opus;
+        }
+
+        if(Nan::Get(value, Nan::New("payloadType").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.payloadType = (uint8_t) std::min<uint32_t>(Nan::To<uint32_t>(v).FromMaybe(0), 127);
+        }
+
+        if(Nan::Get(value, Nan::New("packetTime").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.packetTime = std::max(Nan::To<double>(v).FromMaybe(opt.packetTime), 0.1);
+        }
+
+        if(Nan::Get(value, Nan::New("ttl").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.ttl = (uint8_t) Nan::To<uint32_t>(v).FromMaybe(opt.ttl);
+        }
+
+        if(Nan::Get(value, Nan::New("rtcpInterval").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.rtcpInterval = Nan::To<uint32_t>(v).FromMaybe(opt.rtcpInterval);
+        }
+
+        if(Nan::Get(value, Nan::New("bitrate").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.bitrate = Nan::To<uint32_t>(v).FromMaybe(0);
+        }
+        return true;
+    }
+
+    static void parseFdSinkOptions(Local<Object> value, FdSink::Options &opt) {
+        Local<Value> v;
+        if(Nan::Get(value, Nan::New("batchBytes").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.batchBytes = Nan::To<uint32_t>(v).FromMaybe(opt.batchBytes);
+        }
+
+        if(Nan::Get(value, Nan::New("zeroCopy").ToLocalChecked()).ToLocal(&v) && v->IsBoolean()) {
+            opt.zeroCopy = v->IsTrue();
+        }
+    }
+
+    NAN_METHOD(AudioInputWrapper::addFileSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        FileSink::Options opt = { "", FileSink::Wav, 0, 0, 1024 * 1024 };
+
+        if(!info[0]->IsObject()) {
+            Nan::ThrowError("First argument must be an object");
+            return;
+        }
+
+        if(!parseFileSinkOptions(Nan::To<Object>(info[0]).ToLocalChecked(), opt)) {
+            return;
+        }
+
+        FileSink* sink = new FileSink(opt, obj->ai->options);
+        std::string error;
+        if(!sink->start(error)) {
+            delete sink;
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+
+        int id = obj->nextSinkId++;
+        obj->fileSinks[id] = sink;
+        obj->ai->addSink(sink);
+        info.GetReturnValue().Set(Nan::New(id));
+    }
+
+    NAN_METHOD(AudioInputWrapper::removeFileSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        auto it = obj->fileSinks.find(id);
+        if(it == obj->fileSinks.end()) {
+            info.GetReturnValue().Set(Nan::False());
+            return;
+        }
+
+        obj->ai->removeSink(it->second);
+        delete it->second;
+        obj->fileSinks.erase(it);
+        info.GetReturnValue().Set(Nan::True());
+    }
+
+    NAN_METHOD(AudioInputWrapper::addRtpSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        RtpSink::Options opt = { "", 0, RtpSink::L16, 0, 5, 1, 5, 0 };
+
+        if(!info[0]->IsObject()) {
+            Nan::ThrowError("First argument must be an object");
+            return;
+        }
+
+        if(!parseRtpSinkOptions(Nan::To<Object>(info[0]).ToLocalChecked(), opt)) {
+            return;
+        }
+
+        RtpSink* sink = new RtpSink(opt, obj->ai->options, &obj->ai->getClock());
+        std::string error;
+        if(!sink->start(error)) {
+            delete sink;
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+
+        int id = obj->nextSinkId++;
+        obj->rtpSinks[id] = sink;
+        obj->ai->addSink(sink);
+
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("id").ToLocalChecked(), Nan::New(id));
+        Nan::Set(result, Nan::New("sdp").ToLocalChecked(), Nan::New(sink->sdp()).ToLocalChecked());
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::removeRtpSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        auto it = obj->rtpSinks.find(id);
+        if(it == obj->rtpSinks.end()) {
+            info.GetReturnValue().Set(Nan::False());
+            return;
+        }
+
+        obj->ai->removeSink(it->second);
+        delete it->second;
+        obj->rtpSinks.erase(it);
+        info.GetReturnValue().Set(Nan::True());
+    }
+
+    NAN_METHOD(AudioInputWrapper::addFdSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        FdSink::Options opt = { -1, 16 * 1024, true };
+
+        if(!info[0]->IsNumber()) {
+            Nan::ThrowError("First argument must be a file descriptor");
+            return;
+        }
+        opt.fd = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+
+        if(info[1]->IsObject()) {
+            parseFdSinkOptions(Nan::To<Object>(info[1]).ToLocalChecked(), opt);
+        }
+
+        FdSink* sink = new FdSink(opt, obj->ai->options);
+        std::string error;
+        if(!sink->start(error)) {
+            delete sink;
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+
+        int id = obj->nextSinkId++;
+        obj->fdSinks[id] = sink;
+        obj->ai->addSink(sink);
+        info.GetReturnValue().Set(Nan::New(id));
+    }
+
+    NAN_METHOD(AudioInputWrapper::removeFdSink) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        auto it = obj->fdSinks.find(id);
+        if(it == obj->fdSinks.end()) {
+            info.GetReturnValue().Set(Nan::False());
+            return;
+        }
+
+        obj->ai->removeSink(it->second);
+        delete it->second;
+        obj->fdSinks.erase(it);
+        info.GetReturnValue().Set(Nan::True());
+    }
+
+    NAN_METHOD(AudioInputWrapper::addGraph) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+
+        if(!info[0]->IsArray()) {
+            Nan::ThrowError("First argument must be an array of nodes");
+            return;
+        }
+
+        Local<v8::Array> array = Local<v8::Array>::Cast(info[0]);
+        std::vector<ProcessingGraph::NodeOptions> nodes;
+        for(uint32_t i = 0; i < array->Length(); i++) {
+            Local<Value> item;
+            if(!Nan::Get(array, i).ToLocal(&item) || !item->IsObject()) {
+                Nan::ThrowError("Every node must be an object");
+                return;
+            }
+            Local<Object> value = Nan::To<Object>(item).ToLocalChecked();
+
+            ProcessingGraph::NodeOptions node;
+            node.type = ProcessingGraph::Gain;
+            node.gain = 1.0f;
+            node.sampleRate = obj->ai->options.sampleRate;
+            node.bitsPerSample = obj->ai->options.bitsPerSample;
+            node.clockCorrection = false;
+            node.maxQueue = ProcessingGraph::defaultMaxQueue;
+            node.file = { "", FileSink::Wav, 0, 0, 1024 * 1024 };
+            node.fd = { -1, 16 * 1024, true };
+            node.rtp = { "", 0, RtpSink::L16, 0, 5, 1, 5, 0 };
+
+            Local<Value> v;
+            if(Nan::Get(value, Nan::New("id").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+                node.id = *Nan::Utf8String(v);
+            }
+            if(Nan::Get(value, Nan::New("input").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+                node.input = *Nan::Utf8String(v);
+            }
+
+            std::string type;
+            if(Nan::Get(value, Nan::New("type").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+                type = *Nan::Utf8String(v);
+            }
+            if(type == "gain") {
+                node.type = ProcessingGraph::Gain;
+                if(Nan::Get(value, Nan::New("gain").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                    node.gain = (float) Nan::To<double>(v).FromMaybe(1.0);
+                }
+            } else if(type == "convert") {
+                node.type = ProcessingGraph::Convert;
+                if(Nan::Get(value, Nan::New("bitsPerSample").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                    node.bitsPerSample = (uint8_t) Nan::To<uint32_t>(v).FromMaybe(0);
+                }
+                if(node.bitsPerSample != 16 && node.bitsPerSample != 24 && node.bitsPerSample != 32 && node.bitsPerSample != 8) {
+                    Nan::ThrowError("Option 'bitsPerSample' must be 8, 16, 24 or 32");
+                    return;
+                }
+            } else if(type == "resample") {
+                node.type = ProcessingGraph::Resample;
+                if(Nan::Get(value, Nan::New("sampleRate").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                    node.sampleRate = Nan::To<uint32_t>(v).FromMaybe(0);
+                }
+                if(node.sampleRate == 0) {
+                    Nan::ThrowError("Option 'sampleRate' must be a positive number");
+                    return;
+                }
+                if(Nan::Get(value, Nan::New("clockCorrection").ToLocalChecked()).ToLocal(&v) && v->IsBoolean()) {
+                    node.clockCorrection = v->IsTrue();
+                }
+            } else if(type == "map") {
+                node.type = ProcessingGraph::Map;
+                if(Nan::Get(value, Nan::New("channelMap").ToLocalChecked()).ToLocal(&v) && v->IsArray()) {
+                    Local<v8::Array> map = Local<v8::Array>::Cast(v);
+                    for(uint32_t c = 0; c < map->Length(); c++) {
+                        Local<Value> channel;
+                        int index = Nan::Get(map, c).ToLocal(&channel) ? Nan::To<int32_t>(channel).FromMaybe(-1) : -1;
+                        node.channelMap.push_back(index);
+                    }
+                }
+            } else if(type == "file") {
+                node.type = ProcessingGraph::FileOutput;
+                if(!parseFileSinkOptions(value, node.file)) {
+                    return;
+                }
+            } else if(type == "fd") {
+                node.type = ProcessingGraph::FdOutput;
+                if(Nan::Get(value, Nan::New("fd").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                    node.fd.fd = Nan::To<int32_t>(v).FromMaybe(-1);
+                }
+                if(node.fd.fd < 0) {
+                    Nan::ThrowError("Option 'fd' must be a file descriptor");
+                    return;
+                }
+                parseFdSinkOptions(value, node.fd);
+            } else if(type == "rtp") {
+                node.type = ProcessingGraph::RtpOutput;
+                if(!parseRtpSinkOptions(value, node.rtp)) {
+                    return;
+                }
+            } else if(type == "js") {
+                node.type = ProcessingGraph::JsOutput;
+                if(Nan::Get(value, Nan::New("maxQueue").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+                    node.maxQueue = Nan::To<uint32_t>(v).FromMaybe(node.maxQueue);
+                }
+            } else {
+                Nan::ThrowError(("Unknown type of node '" + type + "'").c_str());
+                return;
+            }
+            nodes.push_back(node);
+        }
+
+        ProcessingGraph* graph = new ProcessingGraph(obj->ai->options, &obj->ai->getClock(), AudioInputWrapper::NotifyOutputs, obj);
+        std::string error;
+        if(!graph->start(nodes, error)) {
+            delete graph;
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+
+        int id = obj->nextSinkId++;
+        obj->graphs[id] = graph;
+        obj->ai->addSink(graph);
+        info.GetReturnValue().Set(Nan::New(id));
+    }
+
+    NAN_METHOD(AudioInputWrapper::removeGraph) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        auto it = obj->graphs.find(id);
+        if(it == obj->graphs.end()) {
+            info.GetReturnValue().Set(Nan::False());
+            return;
+        }
+
+        obj->ai->removeSink(it->second);
+        delete it->second;
+        obj->graphs.erase(it);
+        info.GetReturnValue().Set(Nan::True());
+    }
+
+    NAN_METHOD(AudioInputWrapper::getGraphStats) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        int id = Nan::To<int32_t>(info[0]).FromMaybe(-1);
+        auto it = obj->graphs.find(id);
+        if(it == obj->graphs.end()) {
+            return;
+        }
+
+        std::vector<ProcessingGraph::NodeStats> stats;
+        size_t queued;
+        uint64_t dropped;
+        it->second->getStats(stats, queued, dropped);
+
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(queued));
+        Nan::Set(result, Nan::New("droppedInput").ToLocalChecked(), Nan::New<Number>(dropped));
+        Local<v8::Array> nodes = Nan::New<v8::Array>();
+        uint32_t pos = 0;
+        for(auto &s: stats) {
+            Local<Object> n = Nan::New<Object>();
+            Nan::Set(n, Nan::New("id").ToLocalChecked(), Nan::New(s.id).ToLocalChecked());
+            Nan::Set(n, Nan::New("chunks").ToLocalChecked(), Nan::New<Number>(s.chunks));
+            Nan::Set(n, Nan::New("avgTime").ToLocalChecked(), Nan::New<Number>(s.avgTime));
+            Nan::Set(n, Nan::New("maxTime").ToLocalChecked(), Nan::New<Number>(s.maxTime));
+            Nan::Set(n, Nan::New("queued").ToLocalChecked(), Nan::New<Number>(s.queued));
+            Nan::Set(n, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>(s.dropped));
+            Nan::Set(nodes, pos++, n);
+        }
+        Nan::Set(result, Nan::New("nodes").ToLocalChecked(), nodes);
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::enableSpool) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        CaptureSpool::Options opt = { "", 60 };
+
+        if(!info[0]->IsObject()) {
+            Nan::ThrowError("First argument must be an object");
+            return;
+        }
+
+        Local<Object> value = Nan::To<Object>(info[0]).ToLocalChecked();
+        Local<Value> v;
+        if(Nan::Get(value, Nan::New("path").ToLocalChecked()).ToLocal(&v) && v->IsString()) {
+            opt.path = *Nan::Utf8String(v);
+        } else {
+            Nan::ThrowError("Option 'path' must be a string");
+            return;
+        }
+
+        if(Nan::Get(value, Nan::New("seconds").ToLocalChecked()).ToLocal(&v) && v->IsNumber()) {
+            opt.seconds = std::max<uint32_t>(Nan::To<uint32_t>(v).FromMaybe(opt.seconds), 1);
+        }
+
+        if(obj->spool) {
+            obj->ai->removeSink(obj->spool.get());
+            obj->spool->stop();
+        }
+
+        obj->spool = std::make_shared<CaptureSpool>(opt, obj->ai->options, &obj->ai->getClock());
+        std::string error;
+        if(!obj->spool->start(error)) {
+            obj->spool.reset();
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+        obj->ai->addSink(obj->spool.get());
+        info.GetReturnValue().Set(Nan::Undefined());
+    }
+
+    NAN_METHOD(AudioInputWrapper::disableSpool) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        if(obj->spool) {
+            obj->ai->removeSink(obj->spool.get());
+            obj->spool->stop();
+            obj->spool.reset();
+        }
+        info.GetReturnValue().Set(Nan::Undefined());
+    }
+
+    NAN_METHOD(AudioInputWrapper::startCallbackTrace) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        if(!info[0]->IsString()) {
+            Nan::ThrowError("First argument must be a string");
+            return;
+        }
+
+        std::string error;
+        if(!obj->ai->startCallbackTrace(*Nan::Utf8String(info[0]), error)) {
+            Nan::ThrowError(error.c_str());
+            return;
+        }
+        info.GetReturnValue().Set(Nan::Undefined());
+    }
+
+    NAN_METHOD(AudioInputWrapper::stopCallbackTrace) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        uint64_t recorded, dropped;
+        if(!obj->ai->stopCallbackTrace(recorded, dropped)) {
+            info.GetReturnValue().Set(Nan::Null());
+            return;
+        }
+
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("callbacks").ToLocalChecked(), Nan::New<Number>((double) recorded));
+        Nan::Set(result, Nan::New("dropped").ToLocalChecked(), Nan::New<Number>((double) dropped));
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::getSpoolInfo) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        if(!obj->spool) {
+            info.GetReturnValue().Set(Nan::Null());
+            return;
+        }
+
+        CaptureSpool::Info spoolInfo;
+        obj->spool->getInfo(spoolInfo);
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("sampleRate").ToLocalChecked(), Nan::New(obj->ai->options.sampleRate));
+        Nan::Set(result, Nan::New("firstSample").ToLocalChecked(), Nan::New<Number>(spoolInfo.firstSample));
+        Nan::Set(result, Nan::New("lastSample").ToLocalChecked(), Nan::New<Number>(spoolInfo.lastSample));
+        Nan::Set(result, Nan::New("firstTime").ToLocalChecked(), Nan::New<Number>(spoolInfo.firstTime));
+        Nan::Set(result, Nan::New("lastTime").ToLocalChecked(), Nan::New<Number>(spoolInfo.lastTime));
+        info.GetReturnValue().Set(result);
+    }
+
+    static void releaseSpoolRef(char*, void* hint) {
+        delete (std::shared_ptr<CaptureSpool>*) hint;
+    }
+
+    NAN_METHOD(AudioInputWrapper::readSpool) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        uint64_t sample = (uint64_t) Nan::To<double>(info[0]).FromMaybe(0);
+        uint64_t frames = (uint64_t) Nan::To<double>(info[1]).FromMaybe(0);
+        const char* data = obj->spool ? obj->spool->read(sample, frames) : nullptr;
+        if(data == nullptr) {
+            info.GetReturnValue().Set(Nan::Null());
+            return;
+        }
+
+        //The Buffer points into the mapping, which is kept alive while the Buffer exists
+        size_t size = frames * obj->ai->options.bitsPerSample / 8 * obj->ai->options.channels;
+        info.GetReturnValue().Set(Nan::NewBuffer(
+            (char*) data,
+            size,
+            releaseSpoolRef,
+            new std::shared_ptr<CaptureSpool>(obj->spool)
+        ).ToLocalChecked());
+    }
+
+    NAN_METHOD(AudioInputWrapper::getSpoolSampleAt) {
+        AudioInputWrapper* obj = Nan::ObjectWrap::Unwrap<AudioInputWrapper>(info.Holder());
+        double time = Nan::To<double>(info[0]).FromMaybe(0);
+        int64_t sample = obj->spool ? obj->spool->sampleAt(time) : -1;
+        info.GetReturnValue().Set(Nan::New<Number>((double) sample));
+    }
+
     NAN_METHOD(AudioInputWrapper::loadPortaudioLibrary) {
         Local<Value> arg = info[0];
         if(arg->IsString()) {
@@ -266,35 +1526,198 @@ namespace demo {
         info.GetReturnValue().Set(Nan::New(AudioInput::isLoaded()));
     }
 
-    static void deleteUsingCpp(char* ptr, void*) {
-        delete[] ptr;
+    NAN_METHOD(AudioInputWrapper::startTrace) {
+        Trace::start();
+        info.GetReturnValue().Set(Nan::New(Trace::isAvailable()));
+    }
+
+    NAN_METHOD(AudioInputWrapper::stopTrace) {
+        Trace::stop();
+        info.GetReturnValue().Set(Nan::Undefined());
+    }
+
+    NAN_METHOD(AudioInputWrapper::dumpTrace) {
+        info.GetReturnValue().Set(Nan::New(Trace::dump()).ToLocalChecked());
     }
 
-    void AudioInputWrapper::EmitMessage(uv_async_t *w) {
-        AudioInputWrapper *input = static_cast<AudioInputWrapper*>(w->data);
+    NAN_METHOD(AudioInputWrapper::isTraceAvailable) {
+        info.GetReturnValue().Set(Nan::New(Trace::isAvailable()));
+    }
+
+    NAN_METHOD(AudioInputWrapper::getKernelInfo) {
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("level").ToLocalChecked(), Nan::New(PcmKernels::get().level).ToLocalChecked());
+        Local<v8::Array> available = Nan::New<v8::Array>();
+        uint32_t pos = 0;
+        for(auto &level: PcmKernels::available()) {
+            Nan::Set(available, pos++, Nan::New(level).ToLocalChecked());
+        }
+        Nan::Set(result, Nan::New("available").ToLocalChecked(), available);
+        info.GetReturnValue().Set(result);
+    }
+
+    NAN_METHOD(AudioInputWrapper::setKernelLevel) {
+        if(info.Length() < 1 || !info[0]->IsString()) {
+            Nan::ThrowTypeError("Expected the name of the kernel level");
+            return;
+        }
+
+        Nan::Utf8String level(info[0]);
+        info.GetReturnValue().Set(Nan::New(PcmKernels::setLevel(*level)));
+    }
+
+    NAN_METHOD(AudioInputWrapper::getWorkerPoolStats) {
+        WorkerPool::Stats stats;
+        WorkerPool::get().getStats(stats);
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New("workers").ToLocalChecked(), Nan::New(stats.workers));
+        Nan::Set(result, Nan::New("jobs").ToLocalChecked(), Nan::New<Number>(stats.jobs));
+        Nan::Set(result, Nan::New("steals").ToLocalChecked(), Nan::New<Number>(stats.steals));
+        Nan::Set(result, Nan::New("utilization").ToLocalChecked(), Nan::New<Number>(stats.utilization));
+        const char* names[] = { "high", "low" };
+        for(int p = 0; p < 2; p++) {
+            Local<Object> wait = Nan::New<Object>();
+            Nan::Set(wait, Nan::New("avg").ToLocalChecked(), Nan::New<Number>(stats.avgWait[p]));
+            Nan::Set(wait, Nan::New("max").ToLocalChecked(), Nan::New<Number>(stats.maxWait[p]));
+            Nan::Set(result, Nan::New(names[p]).ToLocalChecked(), wait);
+        }
+        info.GetReturnValue().Set(result);
+    }
+
+    //Called by the GC, the released memory is reported by the next drain or getStats()
+    static void releaseAudioBuffer(char* ptr, void*) {
+        AudioBuffer::release(ptr);
+    }
+
+    void AudioInputWrapper::NotifyOutputs(void* userData) {
+        AudioInputWrapper* obj = (AudioInputWrapper*) userData;
+        Dispatcher::get().schedule(obj);
+    }
+
+    bool AudioInputWrapper::drain(size_t maxMessages) {
         Nan::HandleScope scope;
+        TRACE_THREAD_NAME("node main");
+        TRACE_SCOPE("EmitMessage", 0);
+        reportExternalMemory();
+
+        if(not ai->isOpen()) return false;
 
-        if(not input->ai->isOpen()) return;
+        uint64_t scheduledAt = adaptive.scheduledAt.exchange(0);
+        if(adaptive.maxLatency > 0 && scheduledAt != 0) {
+            //Batches of about twice the loop lag, the target moves slowly to avoid oscillations
+            double lag = (uv_hrtime() - scheduledAt) / 1e6;
+            adaptive.loopLag = adaptive.loopLag * 0.9 + lag * 0.1;
+            double desired = std::max(adaptive.minLatency, std::min(adaptive.maxLatency, adaptive.loopLag * 2));
+            double target = adaptive.targetLatency;
+            adaptive.targetLatency = target + (desired - target) * 0.2;
+            TRACE_COUNTER("emit target latency (us)", (int64_t) (adaptive.targetLatency * 1000));
+        }
+        //Before popping, so a chunk queued meanwhile sets it again
+        adaptive.pendingSince = 0;
 
-        uv_mutex_lock(&input->message_mutex);
-        while (!input->message_queue.empty()) {
-            Message* message = input->message_queue.front();
-            v8::Local<v8::Value> args[2];
+        size_t emitted = 0;
+        MessageQueue::Message message;
+        while(emitted < maxMessages && messages.pop(message)) {
+            if(message.type == MessageQueue::End) {
+                v8::Local<v8::Value> args[1] = { Nan::New("end").ToLocalChecked() };
+                asyncRes->runInAsyncScope(handle(), "emit", 1, args);
+                emitted++;
+                if(not ai->isOpen()) return false;
+                continue;
+            } else if(message.type == MessageQueue::Stall) {
+                v8::Local<v8::Value> args[2] = { Nan::New("stall").ToLocalChecked(), Nan::New<Number>(message.gap) };
+                asyncRes->runInAsyncScope(handle(), "emit", 2, args);
+                emitted++;
+                if(not ai->isOpen()) return false;
+                continue;
+            } else if(message.type == MessageQueue::Recovered) {
+                discontinuity = true;
+                Local<Object> recovered = Nan::New<Object>();
+                Nan::Set(recovered, Nan::New("sample").ToLocalChecked(), Nan::New<Number>((double) message.sample));
+                AudioInput::StreamInfo streamInfo;
+                if(ai->getStreamInfo(streamInfo)) {
+                    Nan::Set(recovered, Nan::New("device").ToLocalChecked(), Nan::New(streamInfo.device).ToLocalChecked());
+                }
+                v8::Local<v8::Value> args[3] = { Nan::New("recovered").ToLocalChecked(), Nan::New<Number>(message.gap), recovered };
+                asyncRes->runInAsyncScope(handle(), "emit", 3, args);
+                emitted++;
+                if(not ai->isOpen()) return false;
+                continue;
+            }
+
+            TRACE_SCOPE("emit", message.size);
+            v8::Local<v8::Value> args[3];
             args[0] = Nan::New("data").ToLocalChecked();
 
             //Create a node.js Buffer for audio data
             args[1] = Nan::NewBuffer(
-                (char*) message->pcm,
-                message->size,
-                deleteUsingCpp,
+                (char*) message.pcm,
+                message.size,
+                releaseAudioBuffer,
                 nullptr
             ).ToLocalChecked();
+            Local<Object> time = Nan::New<Object>();
+            Nan::Set(time, Nan::New("pts").ToLocalChecked(), Nan::New<Number>(message.pts));
+            Nan::Set(time, Nan::New("sample").ToLocalChecked(), Nan::New<Number>((double) message.sample));
+            if(discontinuity || message.discontinuity) {
+                //Audio is missing before this chunk, after a stall, a soft pause or a full pool
+                Nan::Set(time, Nan::New("discontinuity").ToLocalChecked(), Nan::True());
+                discontinuity = false;
+            }
+            args[2] = time;
+
+            asyncRes->runInAsyncScope(handle(), "emit", 3, args);
+            emitted++;
+            //A listener could have closed the input
+            if(not ai->isOpen()) return false;
+        }
+
+        if(taps) {
+            for(auto &tap: taps->getTaps()) {
+                const void* pcm;
+                uint32_t size;
+                while(emitted < maxMessages && tap->pop(&pcm, &size)) {
+                    TRACE_SCOPE("emit tap", size);
+                    v8::Local<v8::Value> args[3];
+                    args[0] = Nan::New("tap").ToLocalChecked();
+                    args[1] = Nan::New(tap->id);
+                    args[2] = Nan::NewBuffer((char*) pcm, size, releaseAudioBuffer, nullptr).ToLocalChecked();
+                    asyncRes->runInAsyncScope(handle(), "emit", 3, args);
+                    emitted++;
+                    if(not ai->isOpen()) return false;
+                }
+            }
+        }
 
-            input->asyncRes->runInAsyncScope(input->handle(), "emit", 2, args);
-            input->message_queue.pop();
-            delete message;
+        //A listener can remove a graph, so it is looked up again after every emit
+        std::vector<int> graphIds;
+        for(auto &it: graphs) graphIds.push_back(it.first);
+        for(int id: graphIds) {
+            ProcessingGraph::Output out;
+            while(emitted < maxMessages) {
+                auto it = graphs.find(id);
+                if(it == graphs.end() || !it->second->pop(out)) break;
+                TRACE_SCOPE("emit graph", out.size);
+                v8::Local<v8::Value> args[5];
+                args[0] = Nan::New("graph").ToLocalChecked();
+                args[1] = Nan::New(id);
+                args[2] = Nan::New(out.node).ToLocalChecked();
+                args[3] = Nan::NewBuffer((char*) out.pcm, out.size, releaseAudioBuffer, nullptr).ToLocalChecked();
+                Local<Object> time = Nan::New<Object>();
+                Nan::Set(time, Nan::New("pts").ToLocalChecked(), Nan::New<Number>(out.pts));
+                Nan::Set(time, Nan::New("sample").ToLocalChecked(), Nan::New<Number>((double) out.sample));
+                if(out.discontinuity) {
+                    Nan::Set(time, Nan::New("discontinuity").ToLocalChecked(), Nan::True());
+                }
+                args[4] = time;
+                asyncRes->runInAsyncScope(handle(), "emit", 5, args);
+                emitted++;
+                if(not ai->isOpen()) return false;
+            }
         }
-        uv_mutex_unlock(&input->message_mutex);
+
+        //If the batch is full there could be more messages, they are emitted in the next pass
+        return emitted == maxMessages;
     }
 
     NAN_METHOD(AudioInputWrapper::ErrorToString) {
@@ -320,4 +1743,23 @@ namespace demo {
         info.GetReturnValue().Set(array);
     }
 
+    NAN_METHOD(AudioInputWrapper::refreshDevices) {
+        info.GetReturnValue().Set(Nan::New(AudioInput::refreshDevices()));
+    }
+
+    NAN_METHOD(AudioInputWrapper::setDevicesChangedCallback) {
+        if(!info[0]->IsFunction()) {
+            Nan::ThrowError("First argument must be a function");
+            return;
+        }
+        DeviceEvents::get().setCallback(info[0].As<Function>());
+        AudioInput::setDevicesChangedCallback(AudioInputWrapper::devicesChangedCbk);
+        info.GetReturnValue().Set(Nan::Undefined());
+    }
+
+    void AudioInputWrapper::devicesChangedCbk(const std::vector<std::string> &added, const std::vector<std::string> &removed) {
+        //Called from refreshDevices() or close(), in the main thread
+        DeviceEvents::get().push(added, removed);
+    }
+
 }